@@ -0,0 +1,89 @@
+#include "argumentparser.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+ArgumentParser::ArgumentParser(int argc, char **argv){
+    optimize = true;
+    jit = true;
+    parallel = false;
+    threads = 0;
+    show_rewrites = false;
+    read_arguments(argc, argv);
+}
+
+bool ArgumentParser::file_present() {
+    return !filename.empty();
+}
+
+bool ArgumentParser::short_program() {
+    return !program.empty();
+}
+
+std::string ArgumentParser::getProgram() {
+    return program;
+}
+
+std::string ArgumentParser::getFilename() {
+    return filename;
+}
+
+bool ArgumentParser::optimization_enabled() {
+    return optimize;
+}
+
+bool ArgumentParser::jit_enabled() {
+    return jit;
+}
+
+bool ArgumentParser::parallel_enabled() {
+    return parallel;
+}
+
+bool ArgumentParser::rewrites_shown() {
+    return show_rewrites;
+}
+
+std::string ArgumentParser::getEngine() {
+    return engine;
+}
+
+int ArgumentParser::getThreads() {
+    return threads;
+}
+
+bool ArgumentParser::read_arguments(int argc, char **argv) {
+    // options may appear anywhere, everything else is positional
+    const std::string engine_option = "--engine=";
+    const std::string threads_option = "--threads=";
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i){
+        std::string str = argv[i];
+        if (str.compare(0, engine_option.size(), engine_option) == 0)
+            engine = str.substr(engine_option.size());
+        else if (str.compare(0, threads_option.size(), threads_option) == 0)
+            threads = std::atoi(str.c_str() + threads_option.size());
+        else if (str == "--no-optimize")
+            optimize = false;
+        else if (str == "--no-jit")
+            jit = false;
+        else if (str == "--parallel")
+            parallel = true;
+        else if (str == "--show-rewrites")
+            show_rewrites = true;
+        else
+            positional.push_back(str);
+    }
+
+    if (positional.size() == 2){
+        if (positional[0] != "-e")
+            return false;
+        program = positional[1];
+    }
+    else if (positional.size() == 1)
+        filename = positional[0];
+    else if (positional.size() > 2)
+        return false;
+    return true;
+}
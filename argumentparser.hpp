@@ -1,31 +1,50 @@
-#ifndef ARGUMENTPARSER
-#define ARGUMENTPARSER
-
-#include <string>
-
-
-class ArgumentParser {
-public:
-    ArgumentParser() {
-        filename = "";
-        program = "";
-    };
-    ArgumentParser(int argc, char **argv);
-
-    //returns true if arguments read, false if reader error
-    bool read_arguments(int argc, char **argv);
-
-    //get functions
-    std::string getProgram();
-    std::string getFilename();
-
-    //check optional arguments
-    bool file_present();
-    bool short_program();
-
-private:
-    std::string filename;
-    std::string program;
-};
-
-#endif
+#ifndef ARGUMENTPARSER
+#define ARGUMENTPARSER
+
+#include <string>
+
+
+class ArgumentParser {
+public:
+    ArgumentParser() {
+        filename = "";
+        program = "";
+        engine = "";
+        optimize = true;
+        jit = true;
+        parallel = false;
+        threads = 0;
+        show_rewrites = false;
+    };
+    ArgumentParser(int argc, char **argv);
+
+    //returns true if arguments read, false if reader error
+    bool read_arguments(int argc, char **argv);
+
+    //get functions
+    std::string getProgram();
+    std::string getFilename();
+    std::string getEngine();
+    //threads requested with --threads=N, 0 if not given
+    int getThreads();
+
+    //check optional arguments
+    bool file_present();
+    bool short_program();
+    bool optimization_enabled();
+    bool jit_enabled();
+    bool parallel_enabled();
+    bool rewrites_shown();
+
+private:
+    std::string filename;
+    std::string program;
+    std::string engine;
+    bool optimize;
+    bool jit;
+    bool parallel;
+    int threads;
+    bool show_rewrites;
+};
+
+#endif
@@ -0,0 +1,520 @@
+#include "batch.hpp"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+// module includes
+#include "environment.hpp"
+#include "error.hpp"
+#include "interpreter_semantic_error.hpp"
+
+// A Kernel applies one operator to a block of rows
+enum Kernel {LoadKernel, PlusKernel, SumKernel, AddKernel, NegateKernel, SubKernel, MulKernel, DivKernel,
+             Log10Kernel, PowKernel, LessKernel, LessEqualKernel, MoreKernel, MoreEqualKernel, EqualKernel,
+             NotKernel, AndKernel, OrKernel, SelectKernel};
+
+// where a kernel reads a block: the column of a Number parameter, or a
+// register holding a block of values, Booleans as 0 or 1
+struct Operand {
+  bool column;
+  std::size_t index;
+};
+
+// out = kernel(a, b, c), a LoadKernel reading the Boolean column a.index
+struct Step {
+  Kernel kernel;
+  std::size_t out;
+  Operand a;
+  Operand b;
+  Operand c;
+};
+
+struct BatchProgram::Plan {
+  std::vector<Step> steps;
+  std::size_t registers = 0;
+
+  // registers holding a constant, filled once for every block
+  std::vector<std::pair<std::size_t, double>> constants;
+
+  // the operand holding the results of a block
+  Operand output;
+};
+
+// Each kernel is a plain loop over a block, which the compiler vectorizes
+// where the operator allows, computing each row exactly as the builtin
+// does. No kernel writes a register it reads, which would stop that.
+static void load(double * out, const bool * a, std::size_t n){
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = a[i];
+    }
+}
+
+static void arithmetic(Kernel kernel, double * out, const double * a, const double * b, std::size_t n){
+    switch (kernel) {
+    case PlusKernel:
+        // + starts from 0, which turns -0 into 0
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = 0.0 + a[i];
+        }
+        break;
+    case SumKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = (0.0 + a[i]) + b[i];
+        }
+        break;
+    case AddKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] + b[i];
+        }
+        break;
+    case NegateKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * -1;
+        }
+        break;
+    case SubKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] - b[i];
+        }
+        break;
+    case MulKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * b[i];
+        }
+        break;
+    case DivKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] / b[i];
+        }
+        break;
+    case Log10Kernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = log10(a[i]);
+        }
+        break;
+    case PowKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = pow(a[i], b[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void logic(Kernel kernel, double * out, const double * a, const double * b, std::size_t n){
+    switch (kernel) {
+    case LessKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] < b[i] ? 1.0 : 0.0;
+        }
+        break;
+    case LessEqualKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] <= b[i] ? 1.0 : 0.0;
+        }
+        break;
+    case MoreKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] > b[i] ? 1.0 : 0.0;
+        }
+        break;
+    case MoreEqualKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] >= b[i] ? 1.0 : 0.0;
+        }
+        break;
+    case EqualKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] == b[i] ? 1.0 : 0.0;
+        }
+        break;
+    case NotKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = 1.0 - a[i];
+        }
+        break;
+    case AndKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * b[i];
+        }
+        break;
+    case OrKernel:
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] > b[i] ? a[i] : b[i];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// both branches are computed, each row takes one by its condition
+static void select(double * out, const double * mask, const double * a, const double * b, std::size_t n){
+    for (std::size_t i = 0; i < n; ++i) {
+        // read unconditionally, so the choice is a blend
+        double taken = a[i];
+        double otherwise = b[i];
+        out[i] = mask[i] != 0.0 ? taken : otherwise;
+    }
+}
+
+// A Planner turns the body of a program into the kernels of a Plan,
+// giving each its own register and reusing those no longer read
+struct Planner {
+  Planner(BatchProgram::Plan & plan, const std::vector<Type> & types): plan(plan), types(types){};
+
+  bool compile(const Expression & exp, Operand & operand, Type & type);
+  bool arguments(const Expression & exp, Type wanted, std::vector<Operand> & operands);
+  Operand constant(double value);
+  std::size_t temporary();
+  void release(const Operand & operand);
+  std::size_t emit(Kernel kernel, Operand a, Operand b = Operand(), Operand c = Operand());
+
+  BatchProgram::Plan & plan;
+  const std::vector<Type> & types;
+  Environment env;
+
+  // registers no kernel reads any more, and those read to the end: the
+  // constants, Boolean parameters and shared subexpressions
+  std::vector<std::size_t> free;
+  std::vector<bool> kept;
+
+  // the operands of Boolean parameters loaded, and shared subexpressions computed
+  std::map<std::size_t, Operand> parameters;
+  std::map<int, std::pair<Operand, Type>> shared;
+};
+
+std::size_t Planner::temporary(){
+    if (!free.empty()) {
+        std::size_t index = free.back();
+        free.pop_back();
+        return index;
+    }
+    kept.push_back(false);
+    return plan.registers++;
+}
+
+void Planner::release(const Operand & operand){
+    if (!operand.column && !kept[operand.index])
+        free.push_back(operand.index);
+}
+
+// a register of its own, since it is filled before any kernel runs
+Operand Planner::constant(double value){
+    Operand operand = {false, plan.registers++};
+    kept.push_back(true);
+    plan.constants.push_back(std::make_pair(operand.index, value));
+    return operand;
+}
+
+// a kernel writing a new register, once it is taken its operands may
+// be released
+std::size_t Planner::emit(Kernel kernel, Operand a, Operand b, Operand c){
+    Step step = {kernel, temporary(), a, b, c};
+    plan.steps.push_back(step);
+    return step.out;
+}
+
+// compile the arguments of a builtin call, all of type wanted
+bool Planner::arguments(const Expression & exp, Type wanted, std::vector<Operand> & operands){
+    for (auto & child: exp.tail) {
+        Operand operand;
+        Type type;
+        if (!compile(child, operand, type) || type != wanted)
+            return false;
+        operands.push_back(operand);
+    }
+    return true;
+}
+
+// compile exp to kernels, returning false if it uses anything no kernel
+// does or its type depends on the row
+bool Planner::compile(const Expression & exp, Operand & operand, Type & type){
+    std::vector<Operand> operands;
+    switch (exp.op) {
+    case LiteralOp:
+        if (exp.head.type == NumberType) {
+            operand = constant(exp.head.value.num_value);
+            type = NumberType;
+            return true;
+        }
+        if (exp.head.type == BooleanType) {
+            operand = constant(exp.head.value.bool_value ? 1.0 : 0.0);
+            type = BooleanType;
+            return true;
+        }
+        return false;
+    case VariableOp: {
+        // a program reads no globals but constants
+        const Expression * value = env.findExpression(exp.head.value.sym_value);
+        if (value == nullptr || !exp.tail.empty())
+            return false;
+        return compile(Expression(value->head), operand, type);
+    }
+    case LocalOp: {
+        if (exp.depth != 0 || std::size_t(exp.index) >= types.size())
+            return false;
+        std::size_t index = exp.index;
+        type = types[index];
+        if (type == NumberType) {
+            operand.column = true;
+            operand.index = index;
+            return true;
+        }
+        auto found = parameters.find(index);
+        if (found == parameters.end()) {
+            Operand column = {true, index};
+            Operand loaded = {false, emit(LoadKernel, column)};
+            kept[loaded.index] = true;
+            found = parameters.insert(std::make_pair(index, loaded)).first;
+        }
+        operand = found->second;
+        return true;
+    }
+    case CachedOp: {
+        auto found = shared.find(exp.index);
+        if (found == shared.end()) {
+            if (!compile(exp.tail.at(0), operand, type))
+                return false;
+            if (!operand.column)
+                kept[operand.index] = true;
+            found = shared.insert(std::make_pair(exp.index, std::make_pair(operand, type))).first;
+        }
+        operand = found->second.first;
+        type = found->second.second;
+        return true;
+    }
+    case BeginOp:
+        if (exp.tail.empty())
+            return false;
+        for (auto & child: exp.tail) {
+            if (!compile(child, operand, type))
+                return false;
+            if (&child != &exp.tail.back())
+                release(operand);
+        }
+        return true;
+    case IfOp: {
+        Type condition, other;
+        if (exp.tail.size() != 3 || !compile(exp.tail[0], operand, condition) || condition != BooleanType)
+            return false;
+        operands.push_back(operand);
+        for (std::size_t i = 1; i < 3; ++i) {
+            if (!compile(exp.tail[i], operand, i == 1 ? type : other))
+                return false;
+            operands.push_back(operand);
+        }
+        if (type != other)
+            return false;
+        operand.column = false;
+        operand.index = emit(SelectKernel, operands[0], operands[1], operands[2]);
+        break;
+    }
+    case NotOp:
+    case Log10Op:
+        type = (exp.op == NotOp) ? BooleanType : NumberType;
+        if (exp.tail.size() != 1 || !arguments(exp, type, operands))
+            return false;
+        operand.column = false;
+        operand.index = emit(exp.op == NotOp ? NotKernel : Log10Kernel, operands[0]);
+        break;
+    case LessOp:
+    case LessEqualOp:
+    case MoreOp:
+    case MoreEqualOp:
+    case EqualOp:
+    case DivOp:
+    case PowOp: {
+        const Kernel kernels[] = {LessKernel, LessEqualKernel, MoreKernel, MoreEqualKernel, EqualKernel, AddKernel,
+                                  SubKernel, MulKernel, DivKernel, Log10Kernel, PowKernel};
+        type = (exp.op >= DivOp) ? NumberType : BooleanType;
+        if (exp.tail.size() != 2 || !arguments(exp, NumberType, operands))
+            return false;
+        operand.column = false;
+        operand.index = emit(kernels[exp.op - LessOp], operands[0], operands[1]);
+        break;
+    }
+    case SubOp:
+        type = NumberType;
+        if (exp.tail.empty() || exp.tail.size() > 2 || !arguments(exp, NumberType, operands))
+            return false;
+        operand.column = false;
+        if (operands.size() == 1)
+            operand.index = emit(NegateKernel, operands[0]);
+        else
+            operand.index = emit(SubKernel, operands[0], operands[1]);
+        break;
+    case AddOp:
+    case MulOp:
+    case AndOp:
+    case OrOp: {
+        // folded left to right, as the builtin does
+        type = (exp.op == AddOp || exp.op == MulOp) ? NumberType : BooleanType;
+        if (!arguments(exp, type, operands))
+            return false;
+        if (operands.empty()) {
+            if (exp.op != MulOp)
+                return false;
+            operand = constant(1);
+            return true;
+        }
+        Kernel first = (exp.op == AddOp) ? SumKernel : (exp.op == MulOp) ? MulKernel :
+                       (exp.op == AndOp) ? AndKernel : OrKernel;
+        Kernel rest = (exp.op == AddOp) ? AddKernel : first;
+        operand = operands[0];
+        if (operands.size() == 1) {
+            // 1 * x and a single and or or are x, 0 + x is not when x is -0
+            if (exp.op != AddOp)
+                return true;
+            operand.column = false;
+            operand.index = emit(PlusKernel, operands[0]);
+            release(operands[0]);
+            return true;
+        }
+        for (std::size_t i = 1; i < operands.size(); ++i) {
+            Operand folded = {false, emit(i == 1 ? first : rest, operand, operands[i])};
+            release(operand);
+            release(operands[i]);
+            operand = folded;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+    for (auto & used: operands) {
+        release(used);
+    }
+    return true;
+}
+
+BatchProgram::BatchProgram(const std::string & source, const std::vector<Symbol> & parameters,
+                           const std::vector<Type> & types): program(source, parameters), types(types),
+                                                            result(NoneType){
+    if (types.size() != parameters.size())
+        throw InterpreterSemanticError(error_message(ArgumentCountError));
+    for (auto type: types) {
+        if (type != NumberType && type != BooleanType)
+            throw InterpreterSemanticError(error_message(ArgumentTypeError));
+    }
+    std::unique_ptr<Plan> planned(new Plan());
+    Planner planner(*planned, types);
+    Type type;
+    if (!planner.compile(program.procedure->code->body, planned->output, type))
+        return;
+    result = type;
+    plan.swap(planned);
+}
+
+BatchProgram::~BatchProgram(){
+}
+
+Type BatchProgram::resultType() const{
+    return result;
+}
+
+bool BatchProgram::vectorized() const{
+    return plan != nullptr;
+}
+
+void BatchProgram::evaluate(const Column * columns, std::size_t rows, double * results) const{
+    check(columns, NumberType);
+    if (plan)
+        run(columns, rows, results, nullptr);
+    else
+        walk(columns, rows, results, nullptr);
+}
+
+void BatchProgram::evaluate(const Column * columns, std::size_t rows, bool * results) const{
+    check(columns, BooleanType);
+    if (plan)
+        run(columns, rows, nullptr, results);
+    else
+        walk(columns, rows, nullptr, results);
+}
+
+// throw unless the columns hold the types compiled for, and the
+// results can be wanted
+void BatchProgram::check(const Column * columns, Type wanted) const{
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        if (columns[i].type != types[i])
+            throw InterpreterSemanticError(error_message(ArgumentTypeError));
+    }
+    if (result != NoneType && result != wanted)
+        throw InterpreterSemanticError(error_message(ArgumentTypeError));
+}
+
+// run the kernels over each block of rows in turn, writing the results
+// to numbers or booleans
+void BatchProgram::run(const Column * columns, std::size_t rows, double * numbers, bool * booleans) const{
+    std::vector<double> file(plan->registers * batch_block);
+    for (auto & constant: plan->constants) {
+        std::fill(file.begin() + constant.first * batch_block, file.begin() + (constant.first + 1) * batch_block,
+                  constant.second);
+    }
+    for (std::size_t start = 0; start < rows; start += batch_block) {
+        std::size_t n = std::min(batch_block, rows - start);
+        auto block = [&](const Operand & operand) -> const double * {
+            if (operand.column)
+                return columns[operand.index].numbers + start;
+            return &file[operand.index * batch_block];
+        };
+        for (auto & step: plan->steps) {
+            double * out = &file[step.out * batch_block];
+            switch (step.kernel) {
+            case LoadKernel:
+                load(out, columns[step.a.index].booleans + start, n);
+                break;
+            case SelectKernel:
+                select(out, block(step.a), block(step.b), block(step.c), n);
+                break;
+            case LessKernel:
+            case LessEqualKernel:
+            case MoreKernel:
+            case MoreEqualKernel:
+            case EqualKernel:
+            case NotKernel:
+            case AndKernel:
+            case OrKernel:
+                logic(step.kernel, out, block(step.a), step.kernel == NotKernel ? nullptr : block(step.b), n);
+                break;
+            default:
+                arithmetic(step.kernel, out, block(step.a), (step.kernel == PlusKernel ||
+                           step.kernel == NegateKernel || step.kernel == Log10Kernel) ? nullptr : block(step.b), n);
+                break;
+            }
+        }
+        const double * values = block(plan->output);
+        if (numbers) {
+            std::copy(values, values + n, numbers + start);
+        }
+        else {
+            for (std::size_t i = 0; i < n; ++i) {
+                booleans[start + i] = values[i] != 0.0;
+            }
+        }
+    }
+}
+
+// evaluate the program for each row in turn
+void BatchProgram::walk(const Column * columns, std::size_t rows, double * numbers, bool * booleans) const{
+    std::vector<Expression> bindings(types.size());
+    for (std::size_t row = 0; row < rows; ++row) {
+        for (std::size_t i = 0; i < types.size(); ++i) {
+            if (types[i] == NumberType)
+                bindings[i] = Expression(columns[i].numbers[row]);
+            else
+                bindings[i] = Expression(columns[i].booleans[row]);
+        }
+        Expression value = program.evaluate(bindings.data());
+        if (value.head.type != (numbers ? NumberType : BooleanType))
+            throw InterpreterSemanticError(error_message(ArgumentTypeError));
+        if (numbers)
+            numbers[row] = value.head.value.num_value;
+        else
+            booleans[row] = value.head.value.bool_value;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+// system includes
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "program.hpp"
+
+// the rows a batch evaluates together, one operator at a time
+const std::size_t batch_block = 1024;
+
+// A Column is the values one parameter takes in each row of a batch,
+// Numbers or Booleans
+struct Column {
+  Column(const double * values): type(NumberType), numbers(values), booleans(nullptr){};
+  Column(const bool * values): type(BooleanType), numbers(nullptr), booleans(values){};
+
+  Type type;
+  const double * numbers;
+  const bool * booleans;
+};
+
+// A BatchProgram is a Program evaluated over columns of values rather
+// than one row at a time. An expression of numbers and Booleans built
+// from literals, the parameters, + - * /, log10, pow, comparisons, not,
+// and, or, if and begin compiles to a list of kernels, each applying one
+// operator to a block of rows in a loop the compiler can vectorize, an
+// if selecting between both its branches by the mask of its condition.
+// The results are the same bit for bit as evaluating each row. Anything
+// else, or an expression whose types only its rows show, is evaluated
+// one row at a time.
+class BatchProgram {
+public:
+  // compile source in the named parameters, whose columns hold types,
+  // throwing InterpreterSemanticError as Program does
+  BatchProgram(const std::string & source, const std::vector<Symbol> & parameters,
+               const std::vector<Type> & types);
+  ~BatchProgram();
+
+  // NumberType or BooleanType if every row has a result of that type,
+  // otherwise NoneType
+  Type resultType() const;
+
+  // whether the rows are evaluated by kernels
+  bool vectorized() const;
+
+  // evaluate rows rows, with columns[i] bound to parameter i, writing
+  // each result to results, throwing InterpreterSemanticError if a
+  // column or result is not of the type expected
+  void evaluate(const Column * columns, std::size_t rows, double * results) const;
+  void evaluate(const Column * columns, std::size_t rows, bool * results) const;
+private:
+  void check(const Column * columns, Type wanted) const;
+  void run(const Column * columns, std::size_t rows, double * numbers, bool * booleans) const;
+  void walk(const Column * columns, std::size_t rows, double * numbers, bool * booleans) const;
+
+  Program program;
+  std::vector<Type> types;
+  Type result;
+
+  // the kernels the rows are evaluated by, null if they are walked,
+  // and what builds them, see batch.cpp
+  struct Plan;
+  friend struct Planner;
+  std::unique_ptr<Plan> plan;
+};
+
+#endif
@@ -0,0 +1,382 @@
+// Micro-benchmarks for the slisp interpreter
+// run with: ./benchmarks [iterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "expression.hpp"
+#include "program.hpp"
+#include "batch.hpp"
+
+// a stream buffer that discards everything, used to silence eval()
+class NullBuffer: public std::streambuf {
+protected:
+  int overflow(int c) { return c; }
+};
+
+// count the nodes of an expression tree
+std::size_t count_nodes(const Expression & exp){
+  std::size_t count = 1;
+  for (auto & child: exp.tail)
+      count += count_nodes(child);
+  return count;
+}
+
+// (+ 1 (+ 1 (+ 1 ... leaf)))
+std::string deep_addition(int depth, const std::string & leaf = "1"){
+  std::string program;
+  for (int i = 0; i < depth; ++i)
+      program += "(+ 1 ";
+  program += leaf;
+  for (int i = 0; i < depth; ++i)
+      program += ")";
+  return program;
+}
+
+// a balanced tree alternating * and + over pi and small literals
+std::string balanced_arithmetic(int depth){
+  if (depth == 0)
+      return "1.0001";
+  std::string op = (depth % 2) ? "*" : "+";
+  std::string left = (depth == 1) ? "pi" : balanced_arithmetic(depth - 1);
+  return "(" + op + " " + left + " " + balanced_arithmetic(depth - 1) + ")";
+}
+
+// comparisons and conditionals over arithmetic
+std::string conditional_arithmetic(int depth){
+  if (depth == 0)
+      return "(- 3 1)";
+  std::string inner = conditional_arithmetic(depth - 1);
+  return "(if (< " + inner + " 100) (+ " + inner + " 1) (/ " + inner + " 2))";
+}
+
+// time a callable, returning seconds per call
+double time_per_call(const std::function<void()> & fn, int iterations){
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+      fn();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count() / iterations;
+}
+
+void report(const std::string & name, std::size_t nodes, double seconds){
+  std::cout << name << ": " << nodes << " nodes, "
+            << seconds * 1e6 << " us/eval, "
+            << seconds * 1e9 / nodes << " ns/node" << std::endl;
+}
+
+void bench_engine(const std::string & name, const std::string & program, Engine engine, int iterations,
+                  bool jit = false){
+  // these programs are constant, optimization would fold them away
+  Interpreter interp;
+  interp.setEngine(engine);
+  interp.setOptimization(false);
+  interp.setJit(jit);
+  std::istringstream iss(program);
+  if (!interp.parse(iss)){
+      std::cout << name << ": failed to parse" << std::endl;
+      return;
+  }
+
+  std::istringstream tokens_in(program);
+  TokenSequenceType tokens = tokenize(tokens_in);
+  std::size_t nodes = count_nodes(interp.build_ast(tokens));
+
+  NullBuffer null_buffer;
+  std::streambuf * saved = std::cout.rdbuf(&null_buffer);
+  double seconds = time_per_call([&]{ interp.eval(); }, iterations);
+  std::cout.rdbuf(saved);
+
+  report(name, nodes, seconds);
+}
+
+// seconds to parse and evaluate a program once in a fresh interpreter
+double time_program(const std::string & program, bool optimize, bool parallel = false,
+                    unsigned long step_limit = 0){
+  Interpreter interp;
+  interp.setOptimization(optimize);
+  interp.setParallel(parallel);
+  interp.setStepLimit(step_limit);
+  std::istringstream iss(program);
+
+  NullBuffer null_buffer;
+  std::streambuf * saved = std::cout.rdbuf(&null_buffer);
+  double seconds = time_per_call([&]{ interp.parse(iss); interp.eval(); }, 1);
+  std::cout.rdbuf(saved);
+  return seconds;
+}
+
+// a tail-recursive loop, reporting procedure calls per second
+void bench_tail_calls(int calls){
+  std::ostringstream program;
+  program << "(begin (define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))"
+          << " (loop " << calls << " 0))";
+
+  double seconds = time_program(program.str(), true);
+  std::cout << "tail calls: " << calls << " calls, "
+            << calls / seconds << " calls/s" << std::endl;
+}
+
+// a program that fails when evaluated, parsed once and run repeatedly
+// after setup, reporting failed evaluations per second
+void bench_failures(const std::string & name, const std::string & setup,
+                    const std::string & program, int iterations){
+  Interpreter interp;
+  NullBuffer null_buffer;
+  std::streambuf * saved = std::cout.rdbuf(&null_buffer);
+  std::istringstream setup_in(setup);
+  if (interp.parse(setup_in))
+      interp.eval();
+  std::cout.rdbuf(saved);
+
+  std::istringstream iss(program);
+  if (!interp.parse(iss)){
+      std::cout << name << ": failed to parse" << std::endl;
+      return;
+  }
+
+  saved = std::cout.rdbuf(&null_buffer);
+  double seconds = time_per_call([&]{ interp.eval(); }, iterations);
+  std::cout.rdbuf(saved);
+
+  std::cout << name << ": " << 1 / seconds << " failed evals/s" << std::endl;
+}
+
+// a program run once, optimized
+void bench_program(const std::string & name, const std::string & program){
+  std::cout << name << ": " << time_program(program, true) * 1e3 << " ms" << std::endl;
+}
+
+// a program with and without optimization
+void bench_optimizer(const std::string & name, const std::string & program){
+  double plain = time_program(program, false);
+  double optimized = time_program(program, true);
+  std::cout << name << ": " << plain * 1e3 << " ms plain, "
+            << optimized * 1e3 << " ms optimized" << std::endl;
+}
+
+// a program evaluated in order and with independent arguments spread over the thread pool
+void bench_parallel(const std::string & name, const std::string & program){
+  double sequential = time_program(program, true);
+  double parallel = time_program(program, true, true);
+  std::cout << name << ": " << sequential * 1e3 << " ms sequential, "
+            << parallel * 1e3 << " ms parallel" << std::endl;
+}
+
+// a loop building a list and dropping the last, reporting lists per
+// second and what the interpreter's heap did
+void bench_lists(const std::string & name, const std::string & list, int count){
+  Interpreter interp;
+  std::ostringstream program;
+  program << "(do ((i 0 (+ i 1)) (xs (list) " << list << ")) ((= i " << count << ") i))";
+  std::istringstream iss(program.str());
+
+  NullBuffer null_buffer;
+  std::streambuf * saved = std::cout.rdbuf(&null_buffer);
+  double seconds = time_per_call([&]{ interp.parse(iss); interp.eval(); }, 1);
+  std::cout.rdbuf(saved);
+
+  HeapStats stats = interp.heapStats();
+  std::cout << name << ": " << count / seconds << " lists/s, "
+            << stats.allocations << " blocks, " << stats.reused << " reused, "
+            << stats.reserved / 1024 << " KB reserved, peak "
+            << interp.peakMemory() / 1024 << " KB" << std::endl;
+}
+
+// formula with each of the variables a, b and c written as its value
+std::string written(const std::string & formula, const std::vector<std::string> & values){
+  std::string text;
+  for (std::size_t i = 0; i < formula.size(); ++i) {
+      char c = formula[i];
+      bool alone = (i == 0 || formula[i - 1] == ' ' || formula[i - 1] == '(') &&
+                   (i + 1 == formula.size() || formula[i + 1] == ' ' || formula[i + 1] == ')');
+      if (alone && c >= 'a' && c <= 'c')
+          text += values[c - 'a'];
+      else
+          text += c;
+  }
+  return text;
+}
+
+// a formula over three parameters evaluated for many records: parsed and
+// evaluated for each with its values written in, and compiled once as a
+// Program with numbers and with Expressions bound
+void bench_formula(const std::string & name, const std::string & formula, int records){
+  std::vector<Symbol> names = {"a", "b", "c"};
+  Program program(formula, names);
+  double sum = 0;
+  double per_record = time_per_call([&]{
+    static int i = 0;
+    double values[] = {double(i % 100), 2.5, 0.25};
+    sum += program.evaluate(values).head.value.num_value;
+    ++i;
+  }, records);
+  double per_binding = time_per_call([&]{
+    static int i = 0;
+    Expression bindings[] = {Expression(double(i % 100)), Expression(2.5), Expression(0.25)};
+    sum += program.evaluate(bindings).head.value.num_value;
+    ++i;
+  }, records);
+
+  Interpreter interp;
+  NullBuffer null_buffer;
+  std::ostream silent(&null_buffer);
+  interp.setOutput(silent);
+  double per_parse = time_per_call([&]{
+    static int i = 0;
+    std::istringstream iss(written(formula, {std::to_string(i % 100), "2.5", "0.25"}));
+    interp.parse(iss);
+    sum += interp.eval().head.value.num_value;
+    ++i;
+  }, records / 100);
+
+  std::cout << name << ": " << per_parse * 1e9 << " ns parsed per record, "
+            << per_record * 1e9 << " ns with numbers bound, "
+            << per_binding * 1e9 << " ns with Expressions bound"
+            << (program.machineCode() ? " [jit]" : "") << " (" << (sum != 0) << ")" << std::endl;
+}
+
+// a formula over a, b and a Boolean column flag evaluated for every row
+// of columns: one row at a time through a Program, and a block at a time
+// through a BatchProgram
+void bench_batch(const std::string & name, const std::string & formula, std::size_t rows){
+  std::vector<double> a(rows), b(rows), results(rows);
+  std::unique_ptr<bool[]> flag(new bool[rows]);
+  for (std::size_t i = 0; i < rows; ++i) {
+      a[i] = double(i % 100);
+      b[i] = 2.5 + double(i % 7);
+      flag[i] = (i % 3) == 0;
+  }
+  std::vector<Symbol> names = {"a", "b", "flag"};
+  Program program(formula, names);
+  BatchProgram batch(formula, names, {NumberType, NumberType, BooleanType});
+
+  double by_row = time_per_call([&]{
+    std::vector<Expression> row(3);
+    for (std::size_t i = 0; i < rows; ++i) {
+        row[0] = Expression(a[i]);
+        row[1] = Expression(b[i]);
+        row[2] = Expression(flag[i]);
+        results[i] = program.evaluate(row.data()).head.value.num_value;
+    }
+  }, 1);
+  // machine code only takes numbers, so only formulas not reading flag
+  bool numeric = program.machineCode() && formula.find("flag") == std::string::npos;
+  double by_number = time_per_call([&]{
+    for (std::size_t i = 0; numeric && i < rows; ++i) {
+        double row[] = {a[i], b[i], 0};
+        results[i] = program.evaluate(row).head.value.num_value;
+    }
+  }, 1);
+  Column columns[] = {a.data(), b.data(), flag.get()};
+  double by_block = time_per_call([&]{ batch.evaluate(columns, rows, results.data()); }, 1);
+
+  std::cout << name << ": " << by_row * 1e9 / rows << " ns/row walked, ";
+  if (numeric)
+      std::cout << by_number * 1e9 / rows << " ns/row [jit], ";
+  std::cout << by_block * 1e9 / rows << " ns/row in blocks"
+            << (batch.vectorized() ? "" : " [walked]") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = (argc > 1) ? std::atoi(argv[1]) : 2000;
+
+  const Engine engines[] = {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine};
+  const char * engine_names[] = {"tree", "vm", "closure"};
+
+  for (int e = 0; e < 3; ++e) {
+      std::string suffix = std::string(" [") + engine_names[e] + "]";
+      bench_engine("deep addition" + suffix, deep_addition(400), engines[e], iterations);
+      bench_engine("balanced arithmetic" + suffix, balanced_arithmetic(10), engines[e], iterations);
+      bench_engine("conditional arithmetic" + suffix, conditional_arithmetic(6), engines[e], iterations);
+  }
+  if (jit_available()) {
+      bench_engine("deep addition [jit]", deep_addition(400), TreeWalkerEngine, iterations, true);
+      bench_engine("balanced arithmetic [jit]", balanced_arithmetic(10), TreeWalkerEngine, iterations, true);
+      bench_engine("conditional arithmetic [jit]", conditional_arithmetic(6), TreeWalkerEngine, iterations, true);
+  }
+  std::string sum_loop = "(do ((i 0 (+ i 1)) (s 0 (+ s i))) ((= i 100000) s))";
+  bench_engine("sum loop of 100000", sum_loop, TreeWalkerEngine, 20);
+  if (jit_available())
+      bench_engine("sum loop of 100000 [jit]", sum_loop, TreeWalkerEngine, 20, true);
+
+  bench_failures("unknown symbol in nested calls", "(begin)", deep_addition(40, "x"), iterations * 50);
+  bench_failures("unknown symbol in a procedure", "(define (f n) (if (= n 0) missing (+ 1 (f (- n 1)))))",
+                 "(f 30)", iterations * 50);
+
+  bench_tail_calls(1000000);
+  { // metering every step, with a limit far enough off to finish
+    std::string program = "(begin (define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1)))) (loop 1000000 0))";
+    double unbounded = time_program(program, true);
+    double bounded = time_program(program, true, false, 1000000000);
+    std::cout << "tail calls with a step limit: " << unbounded * 1e3 << " ms unbounded, "
+              << bounded * 1e3 << " ms bounded" << std::endl;
+  }
+  bench_program("guarded rule body",
+                "(begin (define (costly n) (< (pow (log10 (+ n 1)) 3) (pow (log10 (+ n 2)) 2.5)))"
+                " (define (loop n hits) (if (= n 0) hits"
+                " (loop (- n 1) (if (and (< n 1000) (costly n) (costly (+ n 1))) (+ hits 1) hits))))"
+                " (loop 200000 0))");
+  bench_optimizer("constant loop body",
+                  "(begin (define (loop n acc) (if (= n 0) acc"
+                  " (loop (- n 1) (+ acc (* (* 2 pi) (pow 10 3) (if (< 1 2) n 0))))))"
+                  " (loop 200000 0))");
+  bench_optimizer("config constants in loop body",
+                  "(begin (define rate 0.05) (define scale 3) (define enabled True)"
+                  " (define (loop n acc) (if (= n 0) acc"
+                  " (loop (- n 1) (if enabled (+ acc (* rate scale (pow scale 2) n)) acc))))"
+                  " (loop 200000 0))");
+  bench_optimizer("repeated subexpressions in loop body",
+                  "(begin (define (rule a b c) (+ (pow (/ a b) c) (* 2 (pow (/ a b) c))"
+                  " (if (< (pow (/ a b) c) 1) (pow (/ a b) c) (- (pow (/ a b) c)))))"
+                  " (define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc (rule n 7 1.5)))))"
+                  " (loop 200000 0))");
+  for (std::string form: {"define", "define-memo"}) {
+      bench_program("repeated pure rule [" + form + "]",
+                    "(begin (" + form + " (rule k) (if (= k 0) 0 (+ (pow (log10 (+ k 10)) 2) (rule (- k 1)))))"
+                    " (define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc (rule 40) (rule 60)))))"
+                    " (loop 20000 0))");
+  }
+
+  bench_parallel("independent recursive calls",
+                 "(begin (define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+                 " (+ (fib 21) (fib 21) (fib 21) (fib 21) (fib 21) (fib 21) (fib 21) (fib 21)))");
+
+  { // the same map with a procedure made impure, which pmap runs in order
+    std::string setup = "(begin (define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+                        " (define (in-order n) (begin (lambda () 0) (fib n)))";
+    double sequential = time_program(setup + " (pmap in-order (pfor (lambda (i) 18) 0 64)))", true);
+    double parallel = time_program(setup + " (pmap fib (pfor (lambda (i) 18) 0 64)))", true);
+    std::cout << "pmap of 64 recursive calls: " << sequential * 1e3 << " ms in order, "
+              << parallel * 1e3 << " ms on the pool" << std::endl;
+  }
+
+  bench_lists("build and drop lists of 3", "(list i i i)", 2000000);
+  bench_lists("build and drop ranges of 100", "(range 100)", 200000);
+
+  { // indexing a list of a million items, a slice of one, and the same loop adding its indices
+    std::string loop = "(do ((i 0 (+ i 1)) (s 0 (+ s ";
+    std::string end = "))) ((= i (length xs)) s)))";
+    double indexed = time_program("(begin (define xs (range 1000000)) " + loop + "(nth xs i)" + end, true);
+    double sliced = time_program("(begin (define xs (slice (range 1000001) 1)) " + loop + "(nth xs i)" + end, true);
+    double counted = time_program("(begin (define xs (range 1000000)) " + loop + "i" + end, true);
+    std::cout << "walk a list of 1000000: " << indexed * 1e3 << " ms indexed, "
+              << sliced * 1e3 << " ms sliced, " << counted * 1e3 << " ms adding indices" << std::endl;
+  }
+
+  bench_formula("price formula", "(if (< a 10) (* a b) (* a b (- 1 c)))", 1000000);
+  bench_batch("price formula over columns", "(if (< a 10) (* a b) (* a b (- 1 (/ b 100))))", 1000000);
+  bench_batch("flagged formula over columns",
+              "(if (and flag (or (< a 20) (> b 5))) (+ (* a b) 1) (- (* a a) (* 2 b)))", 1000000);
+  bench_formula("list formula", "(nth (list a b c) (if (< a 50) 0 1))", 1000000);
+
+  return EXIT_SUCCESS;
+}
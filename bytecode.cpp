@@ -0,0 +1,287 @@
+#include "bytecode.hpp"
+
+// system includes
+#include <algorithm>
+
+// module includes
+#include "error.hpp"
+
+// labels as values are a GCC/Clang extension, fall back to a switch elsewhere
+#if defined(__GNUC__)
+#define SLISP_COMPUTED_GOTO 1
+#else
+#define SLISP_COMPUTED_GOTO 0
+#endif
+
+static int name_index(Chunk & chunk, const Symbol & name){
+    for (std::size_t i = 0; i < chunk.names.size(); ++i) {
+        if (chunk.names[i] == name)
+            return i;
+    }
+    chunk.names.push_back(name);
+    return chunk.names.size() - 1;
+}
+
+static void emit_constant(Chunk & chunk, const Atom & atom){
+    chunk.code.push_back(ConstCode);
+    chunk.code.push_back(chunk.constants.size());
+    chunk.constants.push_back(atom);
+}
+
+// emit a jump with a placeholder target, returning where to patch it
+static std::size_t emit_jump(Chunk & chunk, Bytecode code){
+    chunk.code.push_back(code);
+    chunk.code.push_back(0);
+    return chunk.code.size() - 1;
+}
+
+static Error compile_node(const Expression & exp, Chunk & chunk);
+
+// a builtin call, evaluating every argument
+static Error compile_call(const Expression & exp, Chunk & chunk){
+    for (auto & child: exp.tail) {
+        Error error = compile_node(child, chunk);
+        if (error != NoError)
+            return error;
+    }
+    chunk.code.push_back(exp.verified ? UncheckedCode : CallCode);
+    chunk.code.push_back(exp.op);
+    chunk.code.push_back(exp.tail.size());
+    return NoError;
+}
+
+static Error compile_node(const Expression & exp, Chunk & chunk){
+    Error error = NoError;
+    switch (exp.op) {
+    case LiteralOp:
+        emit_constant(chunk, exp.head);
+        break;
+    case VariableOp:
+    case ApplyOp:
+        // applying a value that is not a procedure yields the value
+        chunk.code.push_back(GlobalCode);
+        chunk.code.push_back(name_index(chunk, exp.head.value.sym_value));
+        break;
+    case BeginOp:
+        if (exp.tail.empty()) {
+            emit_constant(chunk, Expression().head);
+            break;
+        }
+        for (std::size_t i = 0; i < exp.tail.size() && error == NoError; ++i) {
+            if (i > 0)
+                chunk.code.push_back(PopCode);
+            error = compile_node(exp.tail[i], chunk);
+        }
+        break;
+    case IfOp: {
+        if (exp.tail.size() != 3)
+            return InvalidIfError;
+        error = compile_node(exp.tail[0], chunk);
+        if (error != NoError)
+            return error;
+        std::size_t to_else = emit_jump(chunk, JumpIfFalseCode);
+        error = compile_node(exp.tail[1], chunk);
+        if (error != NoError)
+            return error;
+        std::size_t to_end = emit_jump(chunk, JumpCode);
+        chunk.code[to_else] = chunk.code.size();
+        error = compile_node(exp.tail[2], chunk);
+        chunk.code[to_end] = chunk.code.size();
+        break;
+    }
+    case DefineOp:
+        if (exp.tail.size() != 2)
+            return InvalidDefineError;
+        error = compile_node(exp.tail[1], chunk);
+        chunk.code.push_back(DefineCode);
+        chunk.code.push_back(name_index(chunk, exp.tail[0].head.value.sym_value));
+        break;
+    case CachedOp: {
+        chunk.code.push_back(CachedCode);
+        chunk.code.push_back(exp.index);
+        std::size_t to_end = chunk.code.size();
+        chunk.code.push_back(0);
+        error = compile_node(exp.tail.at(0), chunk);
+        chunk.code.push_back(StoreCode);
+        chunk.code.push_back(exp.index);
+        chunk.code[to_end] = chunk.code.size();
+        chunk.cache_slots = std::max(chunk.cache_slots, std::size_t(exp.index) + 1);
+        break;
+    }
+    case AndOp:
+    case OrOp: {
+        if (exp.tail.empty())
+            return compile_call(exp, chunk);
+        // jump out at the first operand that decides the result
+        bool decisive = (exp.op == OrOp);
+        std::vector<std::size_t> to_decided;
+        for (auto & child: exp.tail) {
+            error = compile_node(child, chunk);
+            if (error != NoError)
+                return error;
+            to_decided.push_back(emit_jump(chunk, decisive ? JumpIfTrueCode : JumpIfFalseCode));
+        }
+        emit_constant(chunk, Expression(!decisive).head);
+        std::size_t to_end = emit_jump(chunk, JumpCode);
+        for (auto target: to_decided) {
+            chunk.code[target] = chunk.code.size();
+        }
+        emit_constant(chunk, Expression(decisive).head);
+        chunk.code[to_end] = chunk.code.size();
+        break;
+    }
+    case LocalOp:
+    case LambdaOp:
+    case DoOp:
+    case WhileOp:
+    case SetOp:
+    case PmapOp:
+    case PreduceOp:
+    case PforOp:
+        return UnsupportedProcedureError;
+    default:
+        return compile_call(exp, chunk);
+    }
+    return error;
+}
+
+Error compile_chunk(const Expression & ast, Chunk & chunk){
+    chunk = Chunk();
+    Error error = compile_node(ast, chunk);
+    if (error != NoError) {
+        chunk = Chunk();
+        return error;
+    }
+    chunk.code.push_back(ReturnCode);
+    return NoError;
+}
+
+#if SLISP_COMPUTED_GOTO
+#define VM_CASE(code) code##_label:
+#define VM_DISPATCH() goto *dispatch_table[*pc++]
+#else
+#define VM_CASE(code) case code:
+#define VM_DISPATCH() break
+#endif
+
+Error VirtualMachine::run(const Chunk & chunk, Environment & env, Expression & result){
+    const int * code = chunk.code.data();
+    const int * pc = code;
+    stack.clear();
+    cache.assign(chunk.cache_slots, Expression().head);
+
+#if SLISP_COMPUTED_GOTO
+    static void * dispatch_table[BytecodeCount] = {
+      &&ConstCode_label, &&GlobalCode_label, &&DefineCode_label, &&CallCode_label, &&UncheckedCode_label,
+      &&JumpCode_label, &&JumpIfFalseCode_label, &&JumpIfTrueCode_label, &&PopCode_label, &&CachedCode_label,
+      &&StoreCode_label, &&ReturnCode_label
+    };
+    VM_DISPATCH();
+#else
+    for (;;) {
+    switch (*pc++) {
+#endif
+
+    VM_CASE(ConstCode)
+        stack.push_back(chunk.constants[*pc++]);
+        VM_DISPATCH();
+
+    VM_CASE(GlobalCode) {
+        const Expression * value = env.findExpression(chunk.names[*pc++]);
+        if (value == nullptr)
+            return UnknownSymbolError;
+        stack.push_back(value->head);
+        VM_DISPATCH();
+    }
+
+    VM_CASE(DefineCode) {
+        const Symbol & name = chunk.names[*pc++];
+        if (env.keyPresent(name)) {
+            env.clear();
+            return RedefinitionError;
+        }
+        if (!env.addExpression(name, Expression(stack.back())))
+            return MemoryLimitError;
+        VM_DISPATCH();
+    }
+
+    // the arguments are passed in place on the stack, then replaced by the result
+    VM_CASE(CallCode) {
+        Opcode op = static_cast<Opcode>(pc[0]);
+        int argc = pc[1];
+        pc += 2;
+        if (!accepts_arguments(builtin_signature(op), argc)) {
+            env.clear();
+            return ArgumentCountError;
+        }
+        std::size_t base = stack.size() - argc;
+        Atom value = builtin_unchecked(op)(stack.data() + base, argc);
+        stack.resize(base);
+        stack.push_back(value);
+        VM_DISPATCH();
+    }
+
+    VM_CASE(UncheckedCode) {
+        Opcode op = static_cast<Opcode>(pc[0]);
+        int argc = pc[1];
+        pc += 2;
+        std::size_t base = stack.size() - argc;
+        Atom value = builtin_unchecked(op)(stack.data() + base, argc);
+        stack.resize(base);
+        stack.push_back(value);
+        VM_DISPATCH();
+    }
+
+    VM_CASE(JumpCode)
+        pc = code + *pc;
+        VM_DISPATCH();
+
+    VM_CASE(JumpIfFalseCode) {
+        bool cond = stack.back().value.bool_value;
+        stack.pop_back();
+        if (cond)
+            ++pc;
+        else
+            pc = code + *pc;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(JumpIfTrueCode) {
+        bool cond = stack.back().value.bool_value;
+        stack.pop_back();
+        if (cond)
+            pc = code + *pc;
+        else
+            ++pc;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(PopCode)
+        stack.pop_back();
+        VM_DISPATCH();
+
+    VM_CASE(CachedCode) {
+        const Atom & cached = cache[pc[0]];
+        if (cached.type == NoneType) {
+            pc += 2;
+        }
+        else {
+            stack.push_back(cached);
+            pc = code + pc[1];
+        }
+        VM_DISPATCH();
+    }
+
+    VM_CASE(StoreCode)
+        cache[*pc++] = stack.back();
+        VM_DISPATCH();
+
+    VM_CASE(ReturnCode)
+        result = Expression(stack.back());
+        return NoError;
+
+#if !SLISP_COMPUTED_GOTO
+    }
+    }
+#endif
+}
@@ -0,0 +1,55 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+// system includes
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+// A Bytecode is one instruction of the slisp virtual machine,
+// operands follow it inline in the code stream
+enum Bytecode {
+  ConstCode,        // [index] push constants[index]
+  GlobalCode,       // [index] push the value of names[index]
+  DefineCode,       // [index] bind names[index] to the top of stack, leaving it there
+  CallCode,         // [op, argc] pop argc arguments, push the builtin's result
+  UncheckedCode,    // [op, argc] as CallCode, for a call whose arity is verified
+  JumpCode,         // [target] continue at target
+  JumpIfFalseCode,  // [target] pop a condition, continue at target when false
+  JumpIfTrueCode,   // [target] pop a condition, continue at target when true
+  PopCode,          // discard the top of stack
+  CachedCode,       // [slot, target] once cache[slot] is filled push it and continue at target
+  StoreCode,        // [slot] fill cache[slot] with the top of stack, leaving it there
+  ReturnCode,       // stop, the result is the top of stack
+  BytecodeCount
+};
+
+// A Chunk is a compiled program: its code stream, the
+// constants and global names the code refers to by index,
+// and how many cache slots its shared subexpressions use
+struct Chunk {
+  std::vector<int> code;
+  std::vector<Atom> constants;
+  std::vector<Symbol> names;
+  std::size_t cache_slots = 0;
+};
+
+// compile a parsed AST to bytecode in chunk, returning an error for
+// a malformed special form or a lambda, which only the tree walker runs
+Error compile_chunk(const Expression & ast, Chunk & chunk);
+
+// A VirtualMachine runs chunks against an environment using a value stack,
+// leaving the value of the chunk in result unless it returns an error
+class VirtualMachine {
+public:
+  Error run(const Chunk & chunk, Environment & env, Expression & result);
+private:
+  std::vector<Atom> stack;
+  std::vector<Atom> cache;
+};
+
+#endif
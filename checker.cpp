@@ -0,0 +1,300 @@
+#include "checker.hpp"
+
+// system includes
+#include <map>
+#include <set>
+
+// module includes
+#include "optimizer.hpp"
+
+// what is known of the globals bound by an earlier define in this
+// program: the types of their values, and which are pure procedures
+struct TypeMap {
+    std::map<Symbol, Type> types;
+    std::set<Symbol> pure;
+};
+
+// the type of the value a global holds at this point,
+// returning false if it is not yet known
+static bool global_type(const Symbol & name, const TypeMap & globals,
+                        const Environment & env, Type & type){
+    auto it = globals.types.find(name);
+    if (it != globals.types.end()) {
+        type = it->second;
+        return true;
+    }
+    const Expression * bound = env.findExpression(name);
+    if (bound == nullptr)
+        return false;
+    type = bound->head.type;
+    return true;
+}
+
+static Error check(Expression & exp, const TypeMap & globals, const Environment & env,
+                   Type & type, bool & known);
+
+// whether applying a global, other than the procedure self being
+// defined, cannot have effects: it holds a value, or a pure procedure
+static bool pure_callee(const Symbol & name, const Symbol & self, const TypeMap & globals,
+                        const Environment & env){
+    if (name == self || globals.pure.count(name))
+        return true;
+    auto it = globals.types.find(name);
+    if (it != globals.types.end())
+        return it->second != LambdaType;
+    const Expression * bound = env.findExpression(name);
+    if (bound == nullptr)
+        return false;
+    return bound->head.type != LambdaType || bound->head.value.lambda_value->code->pure;
+}
+
+// whether evaluating exp in the body of self has no effects and reads
+// nothing but globals, which can never be rebound, and the variables of
+// its own innermost scopes, which each call creates afresh.
+// Creating or applying procedures that are not known to be pure is
+// taken as impure.
+static bool is_pure(const Expression & exp, int scopes, const Symbol & self, const TypeMap & globals,
+                    const Environment & env){
+    switch (exp.op) {
+    case DefineOp:
+    case LambdaOp:
+        return false;
+    case LocalOp:
+        return exp.depth < scopes;
+    case SetOp:
+        return exp.tail.size() == 2 && is_pure(exp.tail[0], scopes, self, globals, env) &&
+               is_pure(exp.tail[1], scopes, self, globals, env);
+    case ApplyOp:
+        if (exp.depth >= 0 || !pure_callee(exp.head.value.sym_value, self, globals, env))
+            return false;
+        break;
+    case PmapOp:
+    case PreduceOp:
+    case PforOp:
+        // the procedure they apply comes first
+        if (exp.tail.empty() || exp.tail[0].op != VariableOp ||
+            !pure_callee(exp.tail[0].head.value.sym_value, self, globals, env))
+            return false;
+        break;
+    case DoOp:
+        // the loop variables are one scope further in after their inits
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            int inner = scopes + (i < std::size_t(exp.index) ? 0 : 1);
+            if (!is_pure(exp.tail[i], inner, self, globals, env))
+                return false;
+        }
+        return true;
+    default:
+        break;
+    }
+    for (auto & child: exp.tail) {
+        if (!is_pure(child, scopes, self, globals, env))
+            return false;
+    }
+    return true;
+}
+
+// whether the unboxed evaluator handles a node of this opcode
+static bool unboxable(Opcode op){
+    switch (op) {
+    case LiteralOp:
+    case VariableOp:
+    case ApplyOp:
+    case CachedOp:
+    case IfOp:
+        return true;
+    default:
+        // the builtins over numbers and booleans, not those reading lists
+        return op >= FirstBuiltinOp && op < ListOp;
+    }
+}
+
+static Error check_call(Expression & exp, const TypeMap & globals, const Environment & env,
+                        Type & type, bool & known){
+    const Signature & signature = builtin_signature(exp.op);
+    for (auto & child: exp.tail) {
+        Type argument;
+        bool inferred;
+        Error error = check(child, globals, env, argument, inferred);
+        if (error != NoError)
+            return error;
+        if (inferred && signature.argument != NoneType && argument != signature.argument)
+            return ArgumentTypeError;
+    }
+    if (!accepts_arguments(signature, exp.tail.size()))
+        return ArgumentCountError;
+    exp.verified = true;
+    type = signature.result;
+    known = (signature.result != NoneType);
+    return NoError;
+}
+
+// check exp and infer the type of its value, known is false if it cannot be
+static Error check_node(Expression & exp, const TypeMap & globals, const Environment & env,
+                        Type & type, bool & known){
+    known = false;
+    switch (exp.op) {
+    case LiteralOp:
+        type = exp.head.type;
+        known = true;
+        return NoError;
+    case VariableOp:
+        known = global_type(exp.head.value.sym_value, globals, env, type);
+        return NoError;
+    case LocalOp:
+        return NoError;
+    case ApplyOp: {
+        Type argument;
+        bool inferred;
+        for (auto & child: exp.tail) {
+            Error error = check(child, globals, env, argument, inferred);
+            if (error != NoError)
+                return error;
+        }
+        // applying a value that is not a procedure yields the value
+        known = exp.depth < 0 && global_type(exp.head.value.sym_value, globals, env, type) &&
+                type != LambdaType;
+        return NoError;
+    }
+    case CachedOp:
+        return check(exp.tail.at(0), globals, env, type, known);
+    case BeginOp: {
+        // a define binds its name for the rest of the sequence
+        TypeMap sequence = globals;
+        type = NoneType;
+        known = true;
+        for (auto & child: exp.tail) {
+            Error error = check(child, sequence, env, type, known);
+            if (error != NoError)
+                return error;
+            if (known && child.op == DefineOp) {
+                const Symbol & name = child.tail[0].head.value.sym_value;
+                sequence.types[name] = type;
+                const Expression & value = child.tail[1];
+                if (value.op == LambdaOp && value.head.value.lambda_value->code->pure)
+                    sequence.pure.insert(name);
+            }
+        }
+        return NoError;
+    }
+    case IfOp: {
+        if (exp.tail.size() != 3)
+            return InvalidIfError;
+        Type cond, alternative;
+        bool inferred;
+        Error error = check(exp.tail[0], globals, env, cond, inferred);
+        if (error != NoError)
+            return error;
+        if (inferred && cond != BooleanType)
+            return ConditionTypeError;
+        error = check(exp.tail[1], globals, env, type, known);
+        if (error != NoError)
+            return error;
+        error = check(exp.tail[2], globals, env, alternative, inferred);
+        known = known && inferred && type == alternative;
+        return error;
+    }
+    case DefineOp: {
+        if (exp.tail.size() != 2 || exp.tail[0].head.type != SymbolType)
+            return InvalidDefineError;
+        Error error = check(exp.tail[1], globals, env, type, known);
+        if (error != NoError || exp.tail[1].op != LambdaOp)
+            return error;
+        // a procedure bound to a name may call itself
+        LambdaCode & code = *exp.tail[1].head.value.lambda_value->code;
+        code.pure = is_pure(code.body, 1, exp.tail[0].head.value.sym_value, globals, env);
+        if (code.memo && !code.pure)
+            return ImpureMemoError;
+        return NoError;
+    }
+    case DoOp: {
+        // the test decides whether the loop goes on, the results give its value
+        std::size_t count = exp.index;
+        Type child;
+        bool inferred;
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            if (i == 2 * count + 1)
+                continue;
+            Error error = check(exp.tail[i], globals, env, child, inferred);
+            if (error != NoError)
+                return error;
+            if (i == 2 * count && inferred && child != BooleanType)
+                return ConditionTypeError;
+        }
+        return check(exp.tail.at(2 * count + 1), globals, env, type, known);
+    }
+    case WhileOp: {
+        Type child;
+        bool inferred;
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            Error error = check(exp.tail[i], globals, env, child, inferred);
+            if (error != NoError)
+                return error;
+            if (i == 0 && inferred && child != BooleanType)
+                return ConditionTypeError;
+        }
+        type = NoneType;
+        known = true;
+        return NoError;
+    }
+    case SetOp:
+        // only the variables of procedures and loops may be assigned
+        if (exp.tail.size() != 2 || exp.tail[0].op != LocalOp || !exp.tail[0].tail.empty())
+            return InvalidSetError;
+        return check(exp.tail[1], globals, env, type, known);
+    case PmapOp:
+    case PreduceOp:
+    case PforOp: {
+        // a procedure, then the list it maps or reduces, after the initial
+        // value for preduce, or the numbers pfor starts and ends at
+        std::size_t count = (exp.op == PmapOp) ? 2 : 3;
+        if (exp.tail.size() != count)
+            return ArgumentCountError;
+        for (std::size_t i = 0; i < count; ++i) {
+            Type argument;
+            bool inferred;
+            Error error = check(exp.tail[i], globals, env, argument, inferred);
+            if (error != NoError)
+                return error;
+            Type expected = (exp.op == PforOp) ? NumberType : ListType;
+            if (i == 0)
+                expected = LambdaType;
+            else if (exp.op == PreduceOp && i == 1)
+                continue;
+            if (inferred && argument != expected)
+                return ArgumentTypeError;
+        }
+        type = ListType;
+        known = (exp.op != PreduceOp);
+        return NoError;
+    }
+    case LambdaOp: {
+        // the body runs later, when every global known here still holds
+        Type result;
+        bool inferred;
+        Expression & body = private_lambda_body(exp);
+        Error error = check(body, globals, env, result, inferred);
+        exp.head.value.lambda_value->code->pure = is_pure(body, 1, Symbol(), globals, env);
+        type = LambdaType;
+        known = true;
+        return error;
+    }
+    default:
+        return check_call(exp, globals, env, type, known);
+    }
+}
+
+// check exp, recording the type inferred for it
+static Error check(Expression & exp, const TypeMap & globals, const Environment & env,
+                   Type & type, bool & known){
+    Error error = check_node(exp, globals, env, type, known);
+    bool scalar = known && (type == NumberType || type == BooleanType);
+    exp.proven = (error == NoError && scalar && unboxable(exp.op)) ? type : NoneType;
+    return error;
+}
+
+Error check_program(Expression & ast, const Environment & env){
+    Type type;
+    bool known;
+    return check(ast, TypeMap(), env, type, known);
+}
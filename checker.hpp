@@ -0,0 +1,20 @@
+#ifndef CHECKER_HPP
+#define CHECKER_HPP
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+// check a prepared AST once before it runs: special forms must be well
+// formed, builtin calls must pass a number of arguments their signature
+// accepts, and arguments whose type can be inferred from literals, builtin
+// results and globals holding a value must be of the type it takes.
+// Returns the first error found, reached by evaluation or not, marks the
+// builtin calls checked as verified, records the Number and Boolean
+// types proven for each node, and marks procedures whose bodies are
+// pure, which define-memo requires and pmap, preduce and pfor need to
+// apply them on the thread pool.
+Error check_program(Expression & ast, const Environment & env);
+
+#endif
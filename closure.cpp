@@ -0,0 +1,227 @@
+#include "closure.hpp"
+
+static Error constant_code(const Closure & self, Environment &, Atom & value){
+    value = self.constant;
+    return NoError;
+}
+
+static Error global_code(const Closure & self, Environment &, Atom & value){
+    if (!self.slot->bound)
+        return UnknownSymbolError;
+    value = self.slot->value;
+    return NoError;
+}
+
+static Error begin_code(const Closure & self, Environment & env, Atom & value){
+    value = Expression().head;
+    for (auto & child: self.children) {
+        Error error = child.code(child, env, value);
+        if (error != NoError)
+            return error;
+    }
+    return NoError;
+}
+
+static Error if_code(const Closure & self, Environment & env, Atom & value){
+    const Closure & cond = self.children[0];
+    Error error = cond.code(cond, env, value);
+    if (error != NoError)
+        return error;
+    const Closure & branch = self.children[value.value.bool_value ? 1 : 2];
+    return branch.code(branch, env, value);
+}
+
+static Error define_code(const Closure & self, Environment & env, Atom & value){
+    if (env.keyPresent(self.slot->name)) {
+        env.clear();
+        return RedefinitionError;
+    }
+    const Closure & child = self.children[0];
+    Error error = child.code(child, env, value);
+    if (error != NoError)
+        return error;
+    if (!env.addExpression(self.slot->name, Expression(value)))
+        return MemoryLimitError;
+    self.slot->bound = true;
+    self.slot->value = value;
+    return NoError;
+}
+
+static Error cached_code(const Closure & self, Environment & env, Atom & value){
+    if (!self.slot->bound) {
+        const Closure & child = self.children[0];
+        Error error = child.code(child, env, self.slot->value);
+        if (error != NoError)
+            return error;
+        self.slot->bound = true;
+    }
+    value = self.slot->value;
+    return NoError;
+}
+
+// constant is the operand value that decides the result
+static Error short_circuit_code(const Closure & self, Environment & env, Atom & value){
+    bool decisive = self.constant.value.bool_value;
+    for (auto & child: self.children) {
+        Error error = child.code(child, env, value);
+        if (error != NoError)
+            return error;
+        if (value.value.bool_value == decisive)
+            return NoError;
+    }
+    value = Expression(!decisive).head;
+    return NoError;
+}
+
+// evaluate the arguments of a builtin call into its buffer
+static Error call_arguments(const Closure & self, Environment & env){
+    // children fill the buffer by index, they never reach this node again
+    for (std::size_t i = 0; i < self.children.size(); ++i) {
+        const Closure & child = self.children[i];
+        Error error = child.code(child, env, self.args[i]);
+        if (error != NoError)
+            return error;
+    }
+    return NoError;
+}
+
+static Error call_code(const Closure & self, Environment & env, Atom & value){
+    Error error = call_arguments(self, env);
+    if (error != NoError)
+        return error;
+    if (!accepts_arguments(builtin_signature(self.op), self.args.size())) {
+        env.clear();
+        return ArgumentCountError;
+    }
+    value = self.proc(self.args.data(), self.args.size());
+    return NoError;
+}
+
+// a call the checker verified, whose arity needs no check
+static Error unchecked_code(const Closure & self, Environment & env, Atom & value){
+    Error error = call_arguments(self, env);
+    if (error != NoError)
+        return error;
+    value = self.proc(self.args.data(), self.args.size());
+    return NoError;
+}
+
+Error ClosureProgram::compile(const Expression & ast){
+    // slots are allocated up front so closures can point at them
+    slots.clear();
+    cache.clear();
+    collect_slots(ast);
+    return compile_node(ast, root);
+}
+
+void ClosureProgram::collect_slots(const Expression & exp){
+    if ((exp.op == VariableOp || exp.op == ApplyOp) && find_slot(exp.head.value.sym_value) == nullptr) {
+        GlobalSlot slot;
+        slot.name = exp.head.value.sym_value;
+        slot.bound = false;
+        slots.push_back(slot);
+    }
+    if (exp.op == CachedOp && cache.size() <= std::size_t(exp.index))
+        cache.resize(exp.index + 1);
+    for (auto & child: exp.tail) {
+        collect_slots(child);
+    }
+}
+
+GlobalSlot * ClosureProgram::find_slot(const Symbol & name){
+    for (auto & slot: slots) {
+        if (slot.name == name)
+            return &slot;
+    }
+    return nullptr;
+}
+
+Error ClosureProgram::compile_node(const Expression & exp, Closure & closure){
+    closure.op = exp.op;
+    closure.proc = nullptr;
+    closure.slot = nullptr;
+    closure.children.clear();
+
+    switch (exp.op) {
+    case LiteralOp:
+        closure.code = &constant_code;
+        closure.constant = exp.head;
+        return NoError;
+    case VariableOp:
+    case ApplyOp:
+        // applying a value that is not a procedure yields the value
+        closure.code = &global_code;
+        closure.slot = find_slot(exp.head.value.sym_value);
+        return NoError;
+    case CachedOp:
+        closure.code = &cached_code;
+        closure.slot = &cache[exp.index];
+        break;
+    case BeginOp:
+        closure.code = &begin_code;
+        break;
+    case IfOp:
+        if (exp.tail.size() != 3)
+            return InvalidIfError;
+        closure.code = &if_code;
+        break;
+    case DefineOp:
+        if (exp.tail.size() != 2)
+            return InvalidDefineError;
+        closure.code = &define_code;
+        closure.slot = find_slot(exp.tail[0].head.value.sym_value);
+        closure.children.resize(1);
+        return compile_node(exp.tail[1], closure.children[0]);
+    case AndOp:
+    case OrOp:
+        if (!exp.tail.empty()) {
+            closure.code = &short_circuit_code;
+            closure.constant = Expression(exp.op == OrOp).head;
+            break;
+        }
+        // with no operands, call the builtin to report its error
+        closure.code = &call_code;
+        closure.proc = builtin_unchecked(exp.op);
+        break;
+    case LocalOp:
+    case LambdaOp:
+    case DoOp:
+    case WhileOp:
+    case SetOp:
+    case PmapOp:
+    case PreduceOp:
+    case PforOp:
+        return UnsupportedProcedureError;
+    default:
+        closure.code = exp.verified ? &unchecked_code : &call_code;
+        closure.proc = builtin_unchecked(exp.op);
+        closure.args.resize(exp.tail.size());
+        break;
+    }
+
+    closure.children.resize(exp.tail.size());
+    for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+        Error error = compile_node(exp.tail[i], closure.children[i]);
+        if (error != NoError)
+            return error;
+    }
+    return NoError;
+}
+
+Error ClosureProgram::run(Environment & env, Expression & result){
+    // one environment lookup per global per run
+    for (auto & slot: slots) {
+        const Expression * value = env.findExpression(slot.name);
+        slot.bound = (value != nullptr);
+        if (slot.bound)
+            slot.value = value->head;
+    }
+    for (auto & slot: cache) {
+        slot.bound = false;
+    }
+    Atom value;
+    Error error = root.code(root, env, value);
+    if (error == NoError)
+        result = Expression(value);
+    return error;
+}
@@ -0,0 +1,62 @@
+#ifndef CLOSURE_HPP
+#define CLOSURE_HPP
+
+// system includes
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+#include "error.hpp"
+
+// A GlobalSlot caches one global for the duration of a run,
+// filled from the environment once and written by define.
+// Shared subexpressions are cached in unnamed slots the same way.
+struct GlobalSlot {
+  Symbol name;
+  bool bound;
+  Atom value;
+};
+
+// A Closure is one compiled AST node: the code to run it, pre-bound to
+// its constant, builtin procedure, global slot and compiled children.
+// Code leaves the node's value in value unless it returns an error.
+struct Closure {
+  typedef Error (*Code)(const Closure & self, Environment & env, Atom & value);
+
+  Code code;
+  Opcode op;
+  Atom constant;
+  Procedure proc;
+  GlobalSlot * slot;
+  std::vector<Closure> children;
+
+  // argument buffer reused by builtin calls, safe because
+  // a node is never re-entered while it is running
+  mutable std::vector<Atom> args;
+};
+
+// A ClosureProgram is an AST compiled once into a tree of closures,
+// running it calls the root with no dispatch or environment lookups per node
+class ClosureProgram {
+public:
+  ClosureProgram(){};
+  // compile ast, returning an error for a malformed special form
+  // or a lambda, which only the tree walker runs
+  Error compile(const Expression & ast);
+  Error run(Environment & env, Expression & result);
+private:
+  ClosureProgram(const ClosureProgram &);
+  ClosureProgram & operator=(const ClosureProgram &);
+
+  void collect_slots(const Expression & exp);
+  GlobalSlot * find_slot(const Symbol & name);
+  Error compile_node(const Expression & exp, Closure & closure);
+
+  std::vector<GlobalSlot> slots;
+  std::vector<GlobalSlot> cache;
+  Closure root;
+};
+
+#endif
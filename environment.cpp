@@ -1,200 +1,526 @@
-#include "environment.hpp"
-
-#include <cassert>
-#include <cmath>
-#include <iostream>
-
-#include "interpreter_semantic_error.hpp"
-
-//  This module should define the C++ types
-//  and code required to implement the slisp environment mapping.
-
-Environment::Environment(){
-  clear();
-}
-
-bool Environment::isProcedure(std::string key){
-    return (envmap[key].type == ProcedureType);
-}
-
-Expression Environment::getExpression(std::string key){
-    return envmap[key].exp;
-}
-
-bool Environment::keyPresent(std::string key){
-    return (envmap.find(key) != envmap.end());
-}
-
-bool Environment::addExpression(std::string key, Expression value){
-    envmap[key].type = ExpressionType;
-    envmap[key].exp = value;
-}
-
-Expression Environment::getResult(std::string key, const std::vector<Atom> & args){
-    return envmap[key].proc(args);
-}
-
-void Environment::clear() {
-
-    envmap = {};
-
-    //adding special procedures as a check for variables
-    envmap["define"].type = ProcedureType;
-    envmap["begin"].type = ProcedureType;
-    envmap["if"].type = ProcedureType;
-    
-    envmap["pi"].type = ExpressionType;
-    envmap["pi"].exp = Expression( atan2(0, -1) );
-
-    envmap["not"].type = ProcedureType;
-    envmap["not"].proc = Procedure(&not_proc);
-
-    envmap["and"].type = ProcedureType;
-    envmap["and"].proc = Procedure(&and_proc);
-
-    envmap["or"].type = ProcedureType;
-    envmap["or"].proc = Procedure(&or_proc);
-
-    envmap["<="].type = ProcedureType;
-    envmap["<="].proc = Procedure(&less_than_equal_proc);
-
-    envmap["<"].type = ProcedureType;
-    envmap["<"].proc = Procedure(&less_than_proc);
-
-    envmap[">="].type = ProcedureType;
-    envmap[">="].proc = Procedure(&more_than_equal_proc);
-
-    envmap[">"].type = ProcedureType;
-    envmap[">"].proc = Procedure(&more_than_proc);
-
-    envmap["="].type = ProcedureType;
-    envmap["="].proc = Procedure(&equal_proc);
-
-    envmap["+"].type = ProcedureType;
-    envmap["+"].proc = Procedure(&addition_proc);
-
-    envmap["-"].type = ProcedureType;
-    envmap["-"].proc = Procedure(&dash_proc);
-
-    envmap["*"].type = ProcedureType;
-    envmap["*"].proc = Procedure(&multiplication_proc);
-
-    envmap["/"].type = ProcedureType;
-    envmap["/"].proc = Procedure(&slash_proc);
-
-    envmap["log10"].type = ProcedureType;
-    envmap["log10"].proc = Procedure(&log_ten_proc);
-
-    envmap["pow"].type = ProcedureType;
-    envmap["pow"].proc = Procedure(&pow_proc);
-}
-
-//  Below are all function to be used as Procedures in mapping
-Expression not_proc(const std::vector<Atom> & args) {
-  if (args.size() != 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for not function");
-  return Expression(!args[0].value.bool_value);
-}
-
-Expression and_proc(const std::vector<Atom> & args) {
-  if (args.size() < 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for and function");
-  bool finalValue = true;
-  for (auto arg: args) {
-      finalValue &= arg.value.bool_value;
-  }
-  return Expression(finalValue);
-}
-
-Expression or_proc(const std::vector<Atom> & args) {
-  if (args.size() < 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for or function");
-  bool finalValue = false;
-  for (auto arg: args) {
-      finalValue |= arg.value.bool_value;
-  }
-  return Expression(finalValue);
-}
-
-Expression less_than_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for < function");
-  bool lessThan = args[0].value.num_value < args[1].value.num_value;
-  return Expression(lessThan);
-}
-
-Expression less_than_equal_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for <= function");
-  bool lessThanEq = args[0].value.num_value <= args[1].value.num_value;
-  return Expression(lessThanEq);
-}
-
-Expression more_than_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for > function");
-  bool moreThan = args[0].value.num_value > args[1].value.num_value;
-  return Expression(moreThan);
-}
-
-Expression more_than_equal_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for >= function");
-  bool moreThanEq = args[0].value.num_value >= args[1].value.num_value;
-  return Expression(moreThanEq);
-}
-
-Expression equal_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for = function");
-  bool equals = args[0].value.num_value == args[1].value.num_value;
-  return Expression(equals);
-}
-
-Expression addition_proc(const std::vector<Atom> & args) {
-  if (args.size() < 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for + function");
-  Number sum = 0.0;
-  for (auto arg: args) {
-      sum += arg.value.num_value;
-  }
-  return Expression(sum);
-}
-
-Expression dash_proc(const std::vector<Atom> & args) {
-  if (args.size() > 2 || args.size() < 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for - function");
-  if (args.size() == 1)
-    return Expression(args[0].value.num_value * -1);
-  else if (args.size() == 2)
-    return Expression(args[0].value.num_value - args[1].value.num_value);
-}
-
-Expression multiplication_proc(const std::vector<Atom> & args) {
-  if (args.size() == 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for * function");
-  double product = 1;
-  for (auto it = args.begin(); it != args.end(); ++it) {
-      product *= it->value.num_value;
-  }
-  return Expression(product);
-}
-
-Expression slash_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for / function");
-  return Expression(args[0].value.num_value / args[1].value.num_value);
-}
-
-Expression log_ten_proc(const std::vector<Atom> & args) {
-  if (args.size() != 1)
-      throw InterpreterSemanticError("Error: invalid number of arguments for log10 function");
-  return Expression(log10(args[0].value.num_value));
-}
-
-Expression pow_proc(const std::vector<Atom> & args) {
-  if (args.size() != 2)
-      throw InterpreterSemanticError("Error: invalid number of arguments for pow function");
-  Number power = pow(args[0].value.num_value, args[1].value.num_value);
-  return Expression(power);
-}
+#include "environment.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+#include "error.hpp"
+#include "interpreter_semantic_error.hpp"
+
+//  This module should define the C++ types
+//  and code required to implement the slisp environment mapping.
+
+// A Builtin names a special form or procedure and the opcode it resolves to,
+// with its checked and unchecked procedures and its signature,
+// special forms have no procedures
+struct Builtin {
+  const char * name;
+  Opcode op;
+  Procedure proc;
+  Procedure unchecked;
+  Signature signature;
+};
+
+static const Signature special_form = {0, 0, -1, NoneType, NoneType};
+
+// every special form and builtin, in Opcode order starting at BeginOp
+static const Builtin builtins[] = {
+  {"begin", BeginOp, nullptr, nullptr, special_form},
+  {"if", IfOp, nullptr, nullptr, special_form},
+  {"define", DefineOp, nullptr, nullptr, special_form},
+  {"lambda", LambdaOp, nullptr, nullptr, special_form},
+  {"do", DoOp, nullptr, nullptr, special_form},
+  {"while", WhileOp, nullptr, nullptr, special_form},
+  {"set!", SetOp, nullptr, nullptr, special_form},
+  {"pmap", PmapOp, nullptr, nullptr, special_form},
+  {"preduce", PreduceOp, nullptr, nullptr, special_form},
+  {"pfor", PforOp, nullptr, nullptr, special_form},
+  {"not", NotOp, &not_proc, &not_unchecked, {1, 1, -1, BooleanType, BooleanType}},
+  {"and", AndOp, &and_proc, &and_unchecked, {1, AnyArgs, -1, BooleanType, BooleanType}},
+  {"or", OrOp, &or_proc, &or_unchecked, {1, AnyArgs, -1, BooleanType, BooleanType}},
+  {"<", LessOp, &less_than_proc, &less_than_unchecked, {2, 2, -1, NumberType, BooleanType}},
+  {"<=", LessEqualOp, &less_than_equal_proc, &less_than_equal_unchecked, {2, 2, -1, NumberType, BooleanType}},
+  {">", MoreOp, &more_than_proc, &more_than_unchecked, {2, 2, -1, NumberType, BooleanType}},
+  {">=", MoreEqualOp, &more_than_equal_proc, &more_than_equal_unchecked, {2, 2, -1, NumberType, BooleanType}},
+  {"=", EqualOp, &equal_proc, &equal_unchecked, {2, 2, -1, NumberType, BooleanType}},
+  {"+", AddOp, &addition_proc, &addition_unchecked, {1, AnyArgs, -1, NumberType, NumberType}},
+  {"-", SubOp, &dash_proc, &dash_unchecked, {1, 2, -1, NumberType, NumberType}},
+  {"*", MulOp, &multiplication_proc, &multiplication_unchecked, {0, AnyArgs, 1, NumberType, NumberType}},
+  {"/", DivOp, &slash_proc, &slash_unchecked, {2, 2, -1, NumberType, NumberType}},
+  {"log10", Log10Op, &log_ten_proc, &log_ten_unchecked, {1, 1, -1, NumberType, NumberType}},
+  {"pow", PowOp, &pow_proc, &pow_unchecked, {2, 2, -1, NumberType, NumberType}},
+  {"list", ListOp, &list_proc, &list_unchecked, {0, AnyArgs, -1, NoneType, ListType}},
+  {"range", RangeOp, &range_proc, &range_unchecked, {1, 2, -1, NumberType, ListType}},
+  {"length", LengthOp, &length_proc, &length_unchecked, {1, 1, -1, ListType, NumberType}},
+  {"nth", NthOp, &nth_proc, &nth_unchecked, {2, 2, -1, NoneType, NoneType}},
+  {"slice", SliceOp, &slice_proc, &slice_unchecked, {2, 3, -1, NoneType, ListType}},
+  {"append", AppendOp, &append_proc, &append_unchecked, {0, AnyArgs, -1, ListType, ListType}},
+};
+
+static const std::size_t builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+static_assert(builtin_count == OpcodeCount - BeginOp, "builtin table does not match Opcode");
+
+// The names of the special forms, builtins and builtin constants, built
+// once on first use and never changed after, so every environment on
+// every thread reads it without locks rather than holding a copy
+struct Registry {
+  std::unordered_map<Symbol, Opcode> opcodes;
+  std::unordered_map<Symbol, Expression> constants;
+};
+
+static const Registry & registry(){
+    static const Registry table = [](){
+        Registry built;
+        for (std::size_t i = 0; i < builtin_count; ++i) {
+            built.opcodes[builtins[i].name] = builtins[i].op;
+        }
+        built.constants["pi"] = Expression(atan2(0, -1));
+        return built;
+    }();
+    return table;
+}
+
+Opcode symbol_opcode(const Symbol & sym){
+    auto it = registry().opcodes.find(sym);
+    return (it == registry().opcodes.end()) ? VariableOp : it->second;
+}
+
+Procedure builtin_procedure(Opcode op){
+    assert(op >= FirstBuiltinOp && op < OpcodeCount);
+    return builtins[op - BeginOp].proc;
+}
+
+Procedure builtin_unchecked(Opcode op){
+    assert(op >= FirstBuiltinOp && op < OpcodeCount);
+    return builtins[op - BeginOp].unchecked;
+}
+
+Symbol builtin_name(Opcode op){
+    assert(op >= BeginOp && op < OpcodeCount);
+    return builtins[op - BeginOp].name;
+}
+
+const Signature & builtin_signature(Opcode op){
+    assert(op >= FirstBuiltinOp && op < OpcodeCount);
+    return builtins[op - BeginOp].signature;
+}
+
+bool accepts_arguments(const Signature & signature, int count){
+    return count >= signature.min_args &&
+           (signature.max_args == AnyArgs || count <= signature.max_args) &&
+           count != signature.excluded_args;
+}
+
+Environment::Environment(){
+  clears = 0;
+  charged = 0;
+  clear();
+}
+
+void Environment::setAccount(const std::shared_ptr<MemoryAccount> & charged_account){
+    if (account)
+        account->release(charged);
+    account = charged_account;
+    if (account)
+        account->add(charged);
+}
+
+unsigned long Environment::generation() const{
+    return clears;
+}
+
+bool Environment::isProcedure(const std::string & key){
+    return registry().opcodes.count(key) != 0;
+}
+
+Expression Environment::getExpression(const std::string & key){
+    const Expression * bound = findExpression(key);
+    return (bound == nullptr) ? Expression() : *bound;
+}
+
+const Expression * Environment::findExpression(const std::string & key) const{
+    auto it = envmap.find(key);
+    if (it != envmap.end())
+        return &it->second.exp;
+    auto constant = registry().constants.find(key);
+    return (constant == registry().constants.end()) ? nullptr : &constant->second;
+}
+
+bool Environment::keyPresent(const std::string & key){
+    return envmap.count(key) != 0 || registry().opcodes.count(key) != 0 || registry().constants.count(key) != 0;
+}
+
+bool Environment::addExpression(const std::string & key, const Expression & value){
+    if (envmap.find(key) == envmap.end()) {
+        // an estimate of the map node and its links and name, any
+        // list it is bound to being charged as it was built
+        std::size_t bytes = sizeof(std::map<Symbol,EnvResult>::value_type) + 4 * sizeof(void *) + key.size();
+        if (account && !account->charge(bytes))
+            return false;
+        charged += bytes;
+        added.push_back(key);
+        envmap[key].bytes = bytes;
+    }
+    envmap[key].exp = value;
+    return true;
+}
+
+Expression Environment::getResult(const std::string & key, const std::vector<Atom> & args){
+    return Expression(builtin_procedure(symbol_opcode(key))(args.data(), args.size()));
+}
+
+std::size_t Environment::definitions() const{
+    return added.size();
+}
+
+void Environment::rollback(std::size_t count){
+    if (count >= added.size())
+        return;
+    while (added.size() > count) {
+        auto it = envmap.find(added.back());
+        charged -= it->second.bytes;
+        if (account)
+            account->release(it->second.bytes);
+        envmap.erase(it);
+        added.pop_back();
+    }
+    ++clears;
+}
+
+void Environment::clear() {
+
+    envmap = {};
+    added.clear();
+    ++clears;
+    if (account)
+        account->release(charged);
+    charged = 0;
+}
+
+bool builtin_constant(const Symbol & sym, Expression & value){
+    auto it = registry().constants.find(sym);
+    if (it == registry().constants.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+// the value a builtin returns
+static Atom result(Boolean value){
+  Atom atom;
+  atom.type = BooleanType;
+  atom.value.bool_value = value;
+  return atom;
+}
+
+static Atom result(Number value){
+  Atom atom;
+  atom.type = NumberType;
+  atom.value.num_value = value;
+  return atom;
+}
+
+static Atom result(Items && items){
+  std::shared_ptr<List> list = std::allocate_shared<List>(CountingAllocator<List>());
+  list->items.swap(items);
+  list->first = list->items.data();
+  list->count = list->items.size();
+  Atom atom;
+  atom.type = ListType;
+  atom.value.list_value = list;
+  return atom;
+}
+
+Atom make_list(Items && items){
+  return result(std::move(items));
+}
+
+// the list a builtin argument holds, which the checker may not have
+// proven to be one
+static const List & list_argument(const Atom & arg){
+  if (arg.type != ListType)
+      throw BuiltinError{ArgumentTypeError};
+  return *arg.value.list_value;
+}
+
+// a whole number indexing one of count items, or their end if it may be
+static std::size_t index_argument(const Atom & arg, std::size_t count, bool end){
+  if (arg.type != NumberType)
+      throw BuiltinError{ArgumentTypeError};
+  Number index = arg.value.num_value;
+  Number last = Number(count) - (end ? 0 : 1);
+  if (!(index >= 0 && index <= last) || index != std::floor(index))
+      throw BuiltinError{IndexRangeError};
+  return std::size_t(index);
+}
+
+//  Below are all function to be used as Procedures in mapping,
+//  each checks its arity then runs the unchecked version
+Atom not_proc(const Atom * args, std::size_t count) {
+  if (count != 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for not function");
+  return not_unchecked(args, count);
+}
+
+Atom not_unchecked(const Atom * args, std::size_t count) {
+  return result(!args[0].value.bool_value);
+}
+
+Atom and_proc(const Atom * args, std::size_t count) {
+  if (count < 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for and function");
+  return and_unchecked(args, count);
+}
+
+Atom and_unchecked(const Atom * args, std::size_t count) {
+  bool finalValue = true;
+  for (std::size_t i = 0; i < count; ++i) {
+      finalValue &= args[i].value.bool_value;
+  }
+  return result(finalValue);
+}
+
+Atom or_proc(const Atom * args, std::size_t count) {
+  if (count < 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for or function");
+  return or_unchecked(args, count);
+}
+
+Atom or_unchecked(const Atom * args, std::size_t count) {
+  bool finalValue = false;
+  for (std::size_t i = 0; i < count; ++i) {
+      finalValue |= args[i].value.bool_value;
+  }
+  return result(finalValue);
+}
+
+Atom less_than_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for < function");
+  return less_than_unchecked(args, count);
+}
+
+Atom less_than_unchecked(const Atom * args, std::size_t count) {
+  bool lessThan = args[0].value.num_value < args[1].value.num_value;
+  return result(lessThan);
+}
+
+Atom less_than_equal_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for <= function");
+  return less_than_equal_unchecked(args, count);
+}
+
+Atom less_than_equal_unchecked(const Atom * args, std::size_t count) {
+  bool lessThanEq = args[0].value.num_value <= args[1].value.num_value;
+  return result(lessThanEq);
+}
+
+Atom more_than_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for > function");
+  return more_than_unchecked(args, count);
+}
+
+Atom more_than_unchecked(const Atom * args, std::size_t count) {
+  bool moreThan = args[0].value.num_value > args[1].value.num_value;
+  return result(moreThan);
+}
+
+Atom more_than_equal_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for >= function");
+  return more_than_equal_unchecked(args, count);
+}
+
+Atom more_than_equal_unchecked(const Atom * args, std::size_t count) {
+  bool moreThanEq = args[0].value.num_value >= args[1].value.num_value;
+  return result(moreThanEq);
+}
+
+Atom equal_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for = function");
+  return equal_unchecked(args, count);
+}
+
+Atom equal_unchecked(const Atom * args, std::size_t count) {
+  bool equals = args[0].value.num_value == args[1].value.num_value;
+  return result(equals);
+}
+
+Atom addition_proc(const Atom * args, std::size_t count) {
+  if (count < 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for + function");
+  return addition_unchecked(args, count);
+}
+
+Atom addition_unchecked(const Atom * args, std::size_t count) {
+  Number sum = 0.0;
+  for (std::size_t i = 0; i < count; ++i) {
+      sum += args[i].value.num_value;
+  }
+  return result(sum);
+}
+
+Atom dash_proc(const Atom * args, std::size_t count) {
+  if (count > 2 || count < 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for - function");
+  return dash_unchecked(args, count);
+}
+
+Atom dash_unchecked(const Atom * args, std::size_t count) {
+  if (count == 1)
+    return result(args[0].value.num_value * -1);
+  return result(args[0].value.num_value - args[1].value.num_value);
+}
+
+Atom multiplication_proc(const Atom * args, std::size_t count) {
+  if (count == 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for * function");
+  return multiplication_unchecked(args, count);
+}
+
+Atom multiplication_unchecked(const Atom * args, std::size_t count) {
+  double product = 1;
+  for (std::size_t i = 0; i < count; ++i) {
+      product *= args[i].value.num_value;
+  }
+  return result(product);
+}
+
+Atom slash_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for / function");
+  return slash_unchecked(args, count);
+}
+
+Atom slash_unchecked(const Atom * args, std::size_t count) {
+  return result(args[0].value.num_value / args[1].value.num_value);
+}
+
+Atom log_ten_proc(const Atom * args, std::size_t count) {
+  if (count != 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for log10 function");
+  return log_ten_unchecked(args, count);
+}
+
+Atom log_ten_unchecked(const Atom * args, std::size_t count) {
+  return result(log10(args[0].value.num_value));
+}
+
+Atom pow_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for pow function");
+  return pow_unchecked(args, count);
+}
+
+Atom pow_unchecked(const Atom * args, std::size_t count) {
+  Number power = pow(args[0].value.num_value, args[1].value.num_value);
+  return result(power);
+}
+
+Atom list_proc(const Atom * args, std::size_t count) {
+  return list_unchecked(args, count);
+}
+
+Atom list_unchecked(const Atom * args, std::size_t count) {
+  return result(Items(args, args + count));
+}
+
+Atom range_proc(const Atom * args, std::size_t count) {
+  if (count > 2 || count < 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for range function");
+  return range_unchecked(args, count);
+}
+
+// the numbers from start, or 0, counting up while below end,
+// none if there would be no end to them
+Atom range_unchecked(const Atom * args, std::size_t count) {
+  Number start = (count == 2) ? args[0].value.num_value : 0;
+  Number end = args[count - 1].value.num_value;
+  bool bounded = end > start && std::isfinite(end - start);
+  std::size_t length = bounded ? std::size_t(std::ceil(end - start)) : 0;
+  Items items;
+  items.reserve(length);
+  for (std::size_t i = 0; i < length; ++i) {
+      items.push_back(result(start + Number(i)));
+  }
+  return result(std::move(items));
+}
+
+Atom length_proc(const Atom * args, std::size_t count) {
+  if (count != 1)
+      throw InterpreterSemanticError("Error: invalid number of arguments for length function");
+  return length_unchecked(args, count);
+}
+
+Atom length_unchecked(const Atom * args, std::size_t count) {
+  return result(Number(list_argument(args[0]).size()));
+}
+
+Atom nth_proc(const Atom * args, std::size_t count) {
+  if (count != 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for nth function");
+  return nth_unchecked(args, count);
+}
+
+// the item at a zero based index
+Atom nth_unchecked(const Atom * args, std::size_t count) {
+  const List & list = list_argument(args[0]);
+  return list[index_argument(args[1], list.size(), false)];
+}
+
+Atom slice_proc(const Atom * args, std::size_t count) {
+  if (count > 3 || count < 2)
+      throw InterpreterSemanticError("Error: invalid number of arguments for slice function");
+  return slice_unchecked(args, count);
+}
+
+// the items from start up to end, or the end of the list, as a view of
+// the list holding them rather than a copy
+Atom slice_unchecked(const Atom * args, std::size_t count) {
+  const List & list = list_argument(args[0]);
+  std::size_t start = index_argument(args[1], list.size(), true);
+  std::size_t end = (count == 3) ? index_argument(args[2], list.size(), true) : list.size();
+  if (end < start)
+      throw BuiltinError{IndexRangeError};
+  if (start == 0 && end == list.size())
+      return args[0];
+  std::shared_ptr<List> slice = std::allocate_shared<List>(CountingAllocator<List>());
+  slice->parent = list.parent ? list.parent : args[0].value.list_value;
+  slice->first = list.first + start;
+  slice->count = end - start;
+  Atom atom;
+  atom.type = ListType;
+  atom.value.list_value = slice;
+  return atom;
+}
+
+Atom append_proc(const Atom * args, std::size_t count) {
+  return append_unchecked(args, count);
+}
+
+// the items of each list in turn, a list itself if the others are empty
+Atom append_unchecked(const Atom * args, std::size_t count) {
+  std::size_t length = 0;
+  const Atom * only = nullptr;
+  for (std::size_t i = 0; i < count; ++i) {
+      std::size_t size = list_argument(args[i]).size();
+      if (size > 0)
+          only = (length == 0) ? &args[i] : nullptr;
+      length += size;
+  }
+  if (only != nullptr)
+      return *only;
+  Items items;
+  items.reserve(length);
+  for (std::size_t i = 0; i < count; ++i) {
+      const List & list = *args[i].value.list_value;
+      items.insert(items.end(), list.begin(), list.end());
+  }
+  return result(std::move(items));
+}
+
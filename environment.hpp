@@ -1,48 +1,143 @@
-#ifndef ENVIRONMENT_HPP
-#define ENVIRONMENT_HPP
-
-// system includes
-#include <map>
-
-// module includes
-#include "expression.hpp"
-
-class Environment{
-public:
-  Environment();
-  void clear();
-  bool keyPresent(std::string key);
-  Expression getExpression(std::string key);
-  bool isProcedure(std::string key);
-  Expression getResult(std::string key, const std::vector<Atom> & args);
-  bool addExpression(std::string key, Expression value);
-
-private:
-
-  // Environment is a mapping from symbols to expressions or procedures
-  enum EnvResultType {ExpressionType, ProcedureType};
-  struct EnvResult{
-    EnvResultType type;
-    Expression exp;
-    Procedure proc;
-  };
-
-  std::map<Symbol,EnvResult> envmap;
-};
-
-Expression not_proc(const std::vector<Atom> & args);
-Expression and_proc(const std::vector<Atom> & args);
-Expression or_proc(const std::vector<Atom> & args);
-Expression less_than_proc(const std::vector<Atom> & args);
-Expression less_than_equal_proc(const std::vector<Atom> & args);
-Expression more_than_proc(const std::vector<Atom> & args);
-Expression more_than_equal_proc(const std::vector<Atom> & args);
-Expression equal_proc(const std::vector<Atom> & args);
-Expression addition_proc(const std::vector<Atom> & args);
-Expression dash_proc(const std::vector<Atom> & args);
-Expression multiplication_proc(const std::vector<Atom> & args);
-Expression slash_proc(const std::vector<Atom> & args);
-Expression log_ten_proc(const std::vector<Atom> & args);
-Expression pow_proc(const std::vector<Atom> & args);
-
-#endif
+#ifndef ENVIRONMENT_HPP
+#define ENVIRONMENT_HPP
+
+// system includes
+#include <map>
+#include <memory>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+class Environment{
+public:
+  Environment();
+  void clear();
+  bool keyPresent(const std::string & key);
+  Expression getExpression(const std::string & key);
+  const Expression * findExpression(const std::string & key) const;
+  bool isProcedure(const std::string & key);
+  Expression getResult(const std::string & key, const std::vector<Atom> & args);
+  // bind key to value, returning false if the memory account
+  // refuses a new binding
+  bool addExpression(const std::string & key, const Expression & value);
+
+  // the account bindings are charged to, null for none
+  void setAccount(const std::shared_ptr<MemoryAccount> & charged);
+
+  // the number of bindings added since the last clear, and removing
+  // those added after the first count, undoing the defines of a program
+  // cut short
+  std::size_t definitions() const;
+  void rollback(std::size_t count);
+
+  // counts calls to clear and rollback, the only ways a binding can change
+  unsigned long generation() const;
+
+private:
+
+  // Environment is a mapping from symbols to the expressions defined,
+  // the builtins and their constants are shared by every environment
+  struct EnvResult{
+    Expression exp;
+    // charged to the account for it
+    std::size_t bytes = 0;
+  };
+
+  std::map<Symbol,EnvResult> envmap;
+  unsigned long clears;
+
+  // the account charged for bindings added since the last clear,
+  // and how much it was charged
+  std::shared_ptr<MemoryAccount> account;
+  std::size_t charged;
+
+  // the keys bound since the last clear, in order
+  std::vector<Symbol> added;
+};
+
+// map a symbol to the opcode of the special form or builtin it names,
+// or VariableOp if it names neither
+Opcode symbol_opcode(const Symbol & sym);
+
+// set value to the builtin constant sym names, such as pi,
+// returning false if it names none
+bool builtin_constant(const Symbol & sym, Expression & value);
+
+// the procedure implementing a builtin opcode
+Procedure builtin_procedure(Opcode op);
+
+// the same procedure without its arity check,
+// only for calls whose arity has been verified
+Procedure builtin_unchecked(Opcode op);
+
+// the symbol naming a special form or builtin opcode
+Symbol builtin_name(Opcode op);
+
+// max_args of a builtin taking any number of arguments
+const int AnyArgs = -1;
+
+// A Signature is the calls a builtin accepts: from min_args to max_args
+// arguments other than excluded_args, which is -1 if none are, each of
+// type argument, or of any type if that is NoneType, returning a value
+// of type result, or of a type only known when it runs if that is NoneType
+struct Signature {
+  int min_args;
+  int max_args;
+  int excluded_args;
+  Type argument;
+  Type result;
+};
+
+// the signature of a builtin opcode
+const Signature & builtin_signature(Opcode op);
+
+// whether a builtin with signature accepts count arguments
+bool accepts_arguments(const Signature & signature, int count);
+
+Atom not_proc(const Atom * args, std::size_t count);
+Atom and_proc(const Atom * args, std::size_t count);
+Atom or_proc(const Atom * args, std::size_t count);
+Atom less_than_proc(const Atom * args, std::size_t count);
+Atom less_than_equal_proc(const Atom * args, std::size_t count);
+Atom more_than_proc(const Atom * args, std::size_t count);
+Atom more_than_equal_proc(const Atom * args, std::size_t count);
+Atom equal_proc(const Atom * args, std::size_t count);
+Atom addition_proc(const Atom * args, std::size_t count);
+Atom dash_proc(const Atom * args, std::size_t count);
+Atom multiplication_proc(const Atom * args, std::size_t count);
+Atom slash_proc(const Atom * args, std::size_t count);
+Atom log_ten_proc(const Atom * args, std::size_t count);
+Atom pow_proc(const Atom * args, std::size_t count);
+Atom list_proc(const Atom * args, std::size_t count);
+Atom range_proc(const Atom * args, std::size_t count);
+Atom length_proc(const Atom * args, std::size_t count);
+Atom nth_proc(const Atom * args, std::size_t count);
+Atom slice_proc(const Atom * args, std::size_t count);
+Atom append_proc(const Atom * args, std::size_t count);
+
+Atom not_unchecked(const Atom * args, std::size_t count);
+Atom and_unchecked(const Atom * args, std::size_t count);
+Atom or_unchecked(const Atom * args, std::size_t count);
+Atom less_than_unchecked(const Atom * args, std::size_t count);
+Atom less_than_equal_unchecked(const Atom * args, std::size_t count);
+Atom more_than_unchecked(const Atom * args, std::size_t count);
+Atom more_than_equal_unchecked(const Atom * args, std::size_t count);
+Atom equal_unchecked(const Atom * args, std::size_t count);
+Atom addition_unchecked(const Atom * args, std::size_t count);
+Atom dash_unchecked(const Atom * args, std::size_t count);
+Atom multiplication_unchecked(const Atom * args, std::size_t count);
+Atom slash_unchecked(const Atom * args, std::size_t count);
+Atom log_ten_unchecked(const Atom * args, std::size_t count);
+Atom pow_unchecked(const Atom * args, std::size_t count);
+Atom list_unchecked(const Atom * args, std::size_t count);
+Atom range_unchecked(const Atom * args, std::size_t count);
+Atom length_unchecked(const Atom * args, std::size_t count);
+Atom nth_unchecked(const Atom * args, std::size_t count);
+Atom slice_unchecked(const Atom * args, std::size_t count);
+Atom append_unchecked(const Atom * args, std::size_t count);
+
+// a list holding items, taken rather than copied
+Atom make_list(Items && items);
+
+#endif
@@ -0,0 +1,32 @@
+#include "error.hpp"
+
+// system includes
+#include <cassert>
+
+// messages in Error order
+static const char * messages[] = {
+  "",
+  "Error: invalid syntax",
+  "Error: unknown symbol",
+  "Error: invalid number of arguments",
+  "Error: invalid argument type",
+  "Error: if expects a Boolean condition",
+  "Error: symbol is already defined",
+  "Error: invalid if expression",
+  "Error: invalid define expression",
+  "Error: set! expects a local variable and a value",
+  "Error: procedures are only run by the tree walker",
+  "Error: define-memo needs a pure procedure",
+  "Error: maximum recursion depth exceeded",
+  "Error: evaluation step limit reached",
+  "Error: evaluation time limit reached",
+  "Error: memory limit exceeded",
+  "Error: list index out of range",
+};
+
+static_assert(sizeof(messages) / sizeof(messages[0]) == ErrorCount, "messages do not match Error");
+
+const char * error_message(Error error){
+    assert(error >= NoError && error < ErrorCount);
+    return messages[error];
+}
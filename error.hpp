@@ -0,0 +1,38 @@
+#ifndef ERROR_HPP
+#define ERROR_HPP
+
+// An Error is the outcome of parsing, checking or evaluating, returned
+// rather than thrown inside the interpreter: NoError, or the error that
+// stopped it, which indexes its message
+enum Error {
+  NoError,
+  SyntaxError,
+  UnknownSymbolError,
+  ArgumentCountError,
+  ArgumentTypeError,
+  ConditionTypeError,
+  RedefinitionError,
+  InvalidIfError,
+  InvalidDefineError,
+  InvalidSetError,
+  UnsupportedProcedureError,
+  ImpureMemoError,
+  RecursionDepthError,
+  StepLimitError,
+  TimeLimitError,
+  MemoryLimitError,
+  IndexRangeError,
+  ErrorCount
+};
+
+// A BuiltinError is thrown by a builtin procedure for an error only the
+// values of its arguments show, such as an index past the end of a
+// list, and caught by the eval running it, which returns error
+struct BuiltinError {
+  Error error;
+};
+
+// the message reported for an error
+const char * error_message(Error error);
+
+#endif
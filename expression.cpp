@@ -1,84 +1,127 @@
-#include "expression.hpp"
-
-#include <cmath>
-#include <limits>
-#include <cctype>
-#include <stdexcept>
-
-// system includes
-#include <sstream>
-#include <iostream>
-
-Expression::Expression(bool tf){
-  head.type = BooleanType;
-  head.value.bool_value = tf;
-}
-
-Expression::Expression(double num){
-  head.type = NumberType;
-  head.value.num_value = num;
-}
-
-Expression::Expression(const std::string & sym){
-  head.type = SymbolType;
-  head.value.sym_value = sym;
-}
-
-bool Expression::operator==(const Expression & exp) const noexcept{
-  bool equals = (this->head.type == exp.head.type);
-  equals &= (this->tail.size() == exp.tail.size());
-
-  if (this->head.type == NumberType)
-      equals &= (this->head.value.num_value == exp.head.value.num_value);
-  else if (this->head.type == BooleanType)
-      equals &= (this->head.value.bool_value == exp.head.value.bool_value);
-  else if (this->head.type == SymbolType)
-      equals &= (this->head.value.sym_value.compare(exp.head.value.sym_value) == 0);
-  return equals;
-}
-
-std::ostream & operator<<(std::ostream & out, const Expression & exp){
-  out << "(";
-  if (exp.head.type == NumberType)
-      out << exp.head.value.num_value;
-  else if (exp.head.type == BooleanType) {
-      if (exp.head.value.bool_value)
-          out << "True";
-      else
-          out << "False";
-  }
-  else if (exp.head.type == SymbolType)
-      out << exp.head.value.sym_value;
-  out << ")";
-  return out;
-}
-
-bool token_to_atom(const std::string & token, Atom & atom){
-    try {
-        size_t end = 0;
-        atom.type = NumberType;
-        atom.value.num_value = stod(token, &end);
-        return (end == token.length());
-      }
-    catch (std::invalid_argument) {
-        if (isdigit(token.front())) {
-          return false;
-        }
-        else if (token == "True") {
-          atom.type = BooleanType;
-          atom.value.bool_value = true;
-          return true;
-        }
-        else if (token == "False") {
-          atom.type = BooleanType;
-          atom.value.bool_value = false;
-          return true;
-        }
-        else {
-          atom.type = SymbolType;
-          atom.value.sym_value = token;
-          return true;
-        }
-    }
-    return false;
-}
+#include "expression.hpp"
+
+#include <cmath>
+#include <limits>
+#include <cctype>
+#include <stdexcept>
+
+// system includes
+#include <sstream>
+#include <iostream>
+
+Expression::Expression(bool tf){
+  op = LiteralOp;
+  head.type = BooleanType;
+  head.value.bool_value = tf;
+}
+
+Expression::Expression(double num){
+  op = LiteralOp;
+  head.type = NumberType;
+  head.value.num_value = num;
+}
+
+Expression::Expression(const std::string & sym){
+  op = VariableOp;
+  head.type = SymbolType;
+  head.value.sym_value = sym;
+}
+
+// lists are equal item by item, procedures only to themselves
+static bool same_value(const Atom & a, const Atom & b){
+  if (a.type != b.type)
+      return false;
+  if (a.type == NumberType)
+      return a.value.num_value == b.value.num_value;
+  else if (a.type == BooleanType)
+      return a.value.bool_value == b.value.bool_value;
+  else if (a.type == SymbolType)
+      return a.value.sym_value.compare(b.value.sym_value) == 0;
+  else if (a.type == LambdaType)
+      return a.value.lambda_value == b.value.lambda_value;
+  else if (a.type == ListType) {
+      const List & x = *a.value.list_value;
+      const List & y = *b.value.list_value;
+      if (x.size() != y.size())
+          return false;
+      for (std::size_t i = 0; i < x.size(); ++i) {
+          if (!same_value(x[i], y[i]))
+              return false;
+      }
+  }
+  return true;
+}
+
+bool Expression::operator==(const Expression & exp) const noexcept{
+  bool equals = same_value(this->head, exp.head);
+  equals &= (this->tail.size() == exp.tail.size());
+  return equals;
+}
+
+// write a value without the parentheses around a whole result
+static void write_value(std::ostream & out, const Atom & atom){
+  if (atom.type == NumberType)
+      out << atom.value.num_value;
+  else if (atom.type == BooleanType) {
+      if (atom.value.bool_value)
+          out << "True";
+      else
+          out << "False";
+  }
+  else if (atom.type == SymbolType)
+      out << atom.value.sym_value;
+  else if (atom.type == LambdaType)
+      out << "<lambda>";
+  else if (atom.type == ListType) {
+      out << "(";
+      const List & items = *atom.value.list_value;
+      for (std::size_t i = 0; i < items.size(); ++i) {
+          if (i > 0)
+              out << " ";
+          write_value(out, items[i]);
+      }
+      out << ")";
+  }
+}
+
+std::ostream & operator<<(std::ostream & out, const Expression & exp){
+  // a list is already parenthesized
+  if (exp.head.type == ListType) {
+      write_value(out, exp.head);
+      return out;
+  }
+  out << "(";
+  write_value(out, exp.head);
+  out << ")";
+  return out;
+}
+
+bool token_to_atom(const std::string & token, Atom & atom){
+    try {
+        size_t end = 0;
+        atom.type = NumberType;
+        atom.value.num_value = stod(token, &end);
+        return (end == token.length());
+      }
+    catch (std::invalid_argument) {
+        if (isdigit(token.front())) {
+          return false;
+        }
+        else if (token == "True") {
+          atom.type = BooleanType;
+          atom.value.bool_value = true;
+          return true;
+        }
+        else if (token == "False") {
+          atom.type = BooleanType;
+          atom.value.bool_value = false;
+          return true;
+        }
+        else {
+          atom.type = SymbolType;
+          atom.value.sym_value = token;
+          return true;
+        }
+    }
+    return false;
+}
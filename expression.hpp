@@ -1,64 +1,173 @@
-#ifndef TYPES_HPP
-#define TYPES_HPP
-
-// system includes
-#include <string>
-#include <vector>
-
-// A Type is a literal boolean, literal number, or symbol
-enum Type {NoneType, BooleanType, NumberType, ListType, SymbolType};
-
-// A Boolean is a C++ bool
-typedef bool Boolean;
-
-// A Number is a C++ double
-typedef double Number;
-
-// A Symbol is a string
-typedef std::string Symbol;
-
-// A Value is a boolean, number, or symbol
-// cannot use a union because symbol is non-POD
-// this wastes space but is simple
-struct Value {
-  Boolean bool_value;
-  Number num_value;
-  Symbol sym_value;
-};
-
-// An Atom has a type and value
-struct Atom{
-  Type type;
-  Value value;
-};
-
-// An expression is an atom called the head
-// followed by a (possibly empty) list of expressions
-// called the tail
-struct Expression{
-  Atom head;
-  std::vector<Expression> tail;
-
-  Expression() {
-    head.type = NoneType;
-  };
-
-  Expression(const Atom & atom): head(atom){};
-  Expression(bool tf);
-  Expression(double num);
-  Expression(const std::string & sym);
-
-  bool operator==(const Expression & exp) const noexcept;
-};
-
-
-// A Procedure is a C++ function pointer taking
-// a vector of Atoms as arguments
-typedef Expression (*Procedure)(const std::vector<Atom> & args);
-
-// format an expression for output
-std::ostream & operator<<(std::ostream & out, const Expression & exp);
-
-// map a token to an Atom
-bool token_to_atom(const std::string & token, Atom & atom);
-#endif
+#ifndef TYPES_HPP
+#define TYPES_HPP
+
+// system includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// module includes
+#include "memory.hpp"
+
+// A Type is a literal boolean, literal number, list, symbol, or procedure
+enum Type {NoneType, BooleanType, NumberType, ListType, SymbolType, LambdaType};
+
+// An Opcode tags a parsed node with how it is evaluated:
+// a literal, a global or local variable reference, an application
+// of a user procedure, a cached subexpression, a special form, or a builtin.
+// The parser resolves it once so evaluation is a single switch.
+enum Opcode {LiteralOp, VariableOp, LocalOp, ApplyOp, CachedOp,
+             BeginOp, IfOp, DefineOp, LambdaOp, DoOp, WhileOp, SetOp,
+             PmapOp, PreduceOp, PforOp,
+             NotOp, AndOp, OrOp,
+             LessOp, LessEqualOp, MoreOp, MoreEqualOp, EqualOp,
+             AddOp, SubOp, MulOp, DivOp, Log10Op, PowOp,
+             ListOp, RangeOp, LengthOp, NthOp, SliceOp, AppendOp,
+             OpcodeCount};
+
+// the first opcode that names a builtin procedure
+const Opcode FirstBuiltinOp = NotOp;
+
+// A Boolean is a C++ bool
+typedef bool Boolean;
+
+// A Number is a C++ double
+typedef double Number;
+
+// A Symbol is a string
+typedef std::string Symbol;
+
+// A Lambda is a user procedure, defined below
+struct Lambda;
+
+// A List is an immutable sequence of values, defined below
+struct List;
+
+// A MemoTable caches the results of a memoized procedure, see memo.hpp
+class MemoTable;
+
+// A Value is a boolean, number, list, symbol, or procedure
+// cannot use a union because symbol is non-POD
+// this wastes space but is simple
+struct Value {
+  Boolean bool_value;
+  Number num_value;
+  Symbol sym_value;
+  std::shared_ptr<Lambda> lambda_value;
+  std::shared_ptr<const List> list_value;
+};
+
+// An Atom has a type and value
+struct Atom{
+  Type type;
+  Value value;
+};
+
+// the items of a list, charged to the memory account current where
+// the list was built
+typedef std::vector<Atom, CountingAllocator<Atom>> Items;
+
+// A List is count items in order from first, shared by every value
+// referring to it and never changed once built, so threads may read it
+// freely. A list built from items holds them contiguously, a slice is a
+// view of the items of the list it was cut from, which it keeps alive.
+// Lists are only handled through pointers, first points into storage.
+struct List{
+  Items items;
+  std::shared_ptr<const List> parent;
+  const Atom * first = nullptr;
+  std::size_t count = 0;
+
+  std::size_t size() const{ return count; };
+  bool empty() const{ return count == 0; };
+  const Atom & operator[](std::size_t i) const{ return first[i]; };
+  const Atom * begin() const{ return first; };
+  const Atom * end() const{ return first + count; };
+};
+
+// An expression is an atom called the head
+// followed by a (possibly empty) list of expressions
+// called the tail
+struct Expression{
+  Atom head;
+  std::vector<Expression> tail;
+  Opcode op;
+
+  // for LocalOp, and ApplyOp of a local, how many frames out
+  // the variable lives and its slot there, for CachedOp the slot
+  // holding the value of the subexpression in its tail, for DoOp
+  // the number of loop variables, otherwise -1
+  int depth = -1;
+  int index = -1;
+
+  // set on a builtin call proved to have a valid arity, by the checker
+  // or a rewrite, so it can skip checking its arguments when it runs
+  bool verified = false;
+
+  // NumberType or BooleanType when the checker proved every evaluation
+  // of this node produces that type, so it can be evaluated unboxed
+  Type proven = NoneType;
+
+  // set on an argument costly and independent enough to be evaluated
+  // on the thread pool alongside its siblings, see parallel.hpp
+  bool parallel = false;
+
+  Expression() {
+    head.type = NoneType;
+    op = LiteralOp;
+  };
+
+  Expression(const Atom & atom): head(atom){
+    op = (atom.type == SymbolType) ? VariableOp : LiteralOp;
+  };
+  Expression(bool tf);
+  Expression(double num);
+  Expression(const std::string & sym);
+
+  bool operator==(const Expression & exp) const noexcept;
+};
+
+// A Frame holds the arguments of one procedure call,
+// linked to the frame the procedure was created in
+struct Frame{
+  std::vector<Expression> slots;
+  std::shared_ptr<Frame> parent;
+};
+
+// A LambdaCode is a parsed lambda: its parameter names and body,
+// shared by every procedure created from it
+struct LambdaCode{
+  std::vector<Symbol> params;
+  Expression body;
+
+  // frame slots after the parameters caching shared subexpressions of body
+  std::size_t cached = 0;
+
+  // whether it was defined with define-memo, and whether the checker
+  // proved its body pure: free of defines and calling only builtins
+  // and pure procedures, so its result depends only on its arguments
+  bool memo = false;
+  bool pure = false;
+};
+
+// A Lambda is a procedure value: code closed over the frame it was created in
+struct Lambda{
+  std::shared_ptr<LambdaCode> code;
+  std::shared_ptr<Frame> frame;
+
+  // the results cached for a procedure created by define-memo
+  std::shared_ptr<MemoTable> memo;
+};
+
+
+// A Procedure is a C++ function pointer taking its arguments as
+// count Atoms starting at args, which callers pass from a reusable
+// value stack so a builtin call allocates nothing
+typedef Atom (*Procedure)(const Atom * args, std::size_t count);
+
+// format an expression for output
+std::ostream & operator<<(std::ostream & out, const Expression & exp);
+
+// map a token to an Atom
+bool token_to_atom(const std::string & token, Atom & atom);
+#endif
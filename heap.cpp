@@ -0,0 +1,98 @@
+#include "heap.hpp"
+
+// system includes
+#include <new>
+
+// the largest block a size class holds, and the nursery reserved at a time
+const std::size_t largest_class = 64 * 1024;
+const std::size_t chunk_size = 1024 * 1024;
+
+// the classes up to 64 bytes are 16 apart, then each doubling has four
+const std::size_t class_count = 4 + 4 * 10;
+
+// the size class of a block of bytes, and the bytes it holds
+static std::size_t size_class(std::size_t bytes){
+    if (bytes <= 64)
+        return bytes == 0 ? 0 : (bytes - 1) / 16;
+    std::size_t power = 6;
+    while ((std::size_t(1) << (power + 1)) < bytes) {
+        ++power;
+    }
+    std::size_t step = std::size_t(1) << (power - 2);
+    return 4 + (power - 6) * 4 + (bytes - 1 - (std::size_t(1) << power)) / step;
+}
+
+static std::size_t class_bytes(std::size_t index){
+    if (index < 4)
+        return 16 * (index + 1);
+    std::size_t power = 6 + (index - 4) / 4;
+    return (std::size_t(1) << power) + ((index - 4) % 4 + 1) * (std::size_t(1) << (power - 2));
+}
+
+ListHeap::ListHeap(): free_blocks(class_count, nullptr), bump(nullptr), bump_end(nullptr){
+    busy.clear();
+}
+
+ListHeap::~ListHeap(){
+    for (auto chunk: chunks) {
+        ::operator delete(chunk);
+    }
+}
+
+void * ListHeap::allocate(std::size_t bytes){
+    if (bytes > largest_class) {
+        void * block = ::operator new(bytes);
+        Guard guard(busy);
+        ++counts.allocations;
+        ++counts.large;
+        return block;
+    }
+
+    std::size_t index = size_class(bytes);
+    std::size_t size = class_bytes(index);
+    {
+        Guard guard(busy);
+        ++counts.allocations;
+        if (free_blocks[index] != nullptr) {
+            FreeBlock * block = free_blocks[index];
+            free_blocks[index] = block->next;
+            ++counts.reused;
+            return block;
+        }
+        if (std::size_t(bump_end - bump) >= size) {
+            char * block = bump;
+            bump += size;
+            return block;
+        }
+    }
+
+    // reserve the next chunk outside the guard, the rest of the last
+    // one is left unused
+    char * chunk = static_cast<char *>(::operator new(chunk_size));
+    Guard guard(busy);
+    chunks.push_back(chunk);
+    counts.reserved += chunk_size;
+    bump = chunk + size;
+    bump_end = chunk + chunk_size;
+    return chunk;
+}
+
+void ListHeap::deallocate(void * block, std::size_t bytes){
+    if (bytes > largest_class) {
+        ::operator delete(block);
+        Guard guard(busy);
+        ++counts.freed;
+        return;
+    }
+    std::size_t index = size_class(bytes);
+    FreeBlock * freed = static_cast<FreeBlock *>(block);
+    Guard guard(busy);
+    freed->next = free_blocks[index];
+    free_blocks[index] = freed;
+    ++counts.freed;
+}
+
+HeapStats ListHeap::stats() const{
+    Guard guard(busy);
+    return counts;
+}
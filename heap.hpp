@@ -0,0 +1,66 @@
+#ifndef HEAP_HPP
+#define HEAP_HPP
+
+// system includes
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// What a ListHeap has done: the blocks it handed out, how many of those
+// reused a freed block rather than the nursery, the blocks given back,
+// those too large for a size class, taken from the system instead, and
+// the bytes of nursery it has reserved
+struct HeapStats {
+  unsigned long allocations = 0;
+  unsigned long reused = 0;
+  unsigned long freed = 0;
+  unsigned long large = 0;
+  std::size_t reserved = 0;
+};
+
+// A ListHeap holds the blocks of the lists an interpreter builds, in
+// size classes a quarter of a power of two apart. A block is bumped off
+// the nursery, chunks reserved in turn and kept until the heap is gone,
+// unless a freed block of its class is waiting to be reused.
+// Lists never change once built so cannot refer to themselves, and are
+// reference counted, so a block is freed as soon as its list is dropped
+// and reclaiming never pauses evaluation.
+// Threads evaluating for the interpreter may share it.
+class ListHeap {
+public:
+  ListHeap();
+  ~ListHeap();
+
+  void * allocate(std::size_t bytes);
+  void deallocate(void * block, std::size_t bytes);
+
+  HeapStats stats() const;
+private:
+  ListHeap(const ListHeap &);
+  ListHeap & operator=(const ListHeap &);
+
+  struct FreeBlock {
+    FreeBlock * next;
+  };
+
+  // guards everything below, held only for a few instructions
+  class Guard {
+  public:
+    explicit Guard(std::atomic_flag & flag): held(flag){
+      while (held.test_and_set(std::memory_order_acquire)) {
+      }
+    };
+    ~Guard(){ held.clear(std::memory_order_release); };
+  private:
+    std::atomic_flag & held;
+  };
+  mutable std::atomic_flag busy;
+
+  std::vector<FreeBlock *> free_blocks;
+  std::vector<char *> chunks;
+  char * bump;
+  char * bump_end;
+  HeapStats counts;
+};
+
+#endif
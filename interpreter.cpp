@@ -1,173 +1,1404 @@
-#include "interpreter.hpp"
-
-// system includes
-#include <stack>
-#include <stdexcept>
-#include <iostream>
-
-// module includes
-#include "tokenize.hpp"
-#include "expression.hpp"
-#include "environment.hpp"
-#include "interpreter_semantic_error.hpp"
-
-bool Interpreter::parse(std::istream & expression) noexcept{
-
-  //tokenize the given expression
-  //std::deque<std::string> TokenSequenceType;
-  //run through tokens and create ast
-  TokenSequenceType tokens = tokenize(expression);
-  try {
-      ast = build_ast(tokens);
-      return true;
-  }
-  catch (const InterpreterSemanticError) {
-      std::cout << "Error: invalid syntax" << std::endl;
-      return false;
-  }
-};
-
-Expression Interpreter::evaluate(Expression exp){
-    Expression evaluated;
-
-    if (exp.head.type == NoneType)
-        return Expression();
-
-    if (exp.head.type == NumberType) {
-        evaluated = Expression(exp.head.value.num_value);
-    }
-    else if (exp.head.type == BooleanType) {
-        evaluated = Expression(exp.head.value.bool_value);
-    }
-    else if (exp.head.value.sym_value == "begin"){
-        for(int i = 0; i < exp.tail.size(); ++i) {
-            evaluated = evaluate(exp.tail.at(i));
-        }
-    }
-    else if (exp.head.value.sym_value == "if"){
-        bool cond = evaluate(exp.tail.at(0)).head.value.bool_value;
-        if (cond) {
-            evaluated = evaluate(exp.tail.at(1));
-        }
-        else {
-            evaluated = evaluate(exp.tail.at(2));
-        }
-    }
-    else if (exp.head.value.sym_value == "define"){
-        std::string addKey = exp.tail.at(0).head.value.sym_value;
-        if (env.keyPresent(addKey)){
-            env.clear();
-            throw InterpreterSemanticError("Error: symbol is already defined");
-        }
-        else {
-            env.addExpression(addKey, evaluate(exp.tail.at(1)));
-            evaluated = env.getExpression(addKey);
-        }
-    }
-    else {
-      std::string key = exp.head.value.sym_value;
-      if (env.keyPresent(key)){
-          if (env.isProcedure(key)) {
-              std::vector<Atom> atms;
-              for(int i = 0; i < exp.tail.size(); ++i) {
-                  atms.push_back(evaluate(exp.tail.at(i)).head);
-              }
-              try {
-                  evaluated = env.getResult(key, atms);
-              }
-              catch (InterpreterSemanticError) {
-                  env.clear();
-                  throw InterpreterSemanticError("Error: invlaid number of arguments");
-                  return Expression();
-              }
-          }
-          else {
-              evaluated = env.getExpression(key);
-          }
-      }
-      else{
-          throw InterpreterSemanticError("Error: unknown symbol");
-          return Expression();
-      }
-    }
-    return evaluated;
-}
-
-Expression Interpreter::eval(){
-    try {
-        Expression exp = evaluate(ast);
-        std::cout << exp << std::endl;
-        return exp;
-    }
-    catch (InterpreterSemanticError) {
-        std::cout << "Error: Semantic Error" << std::endl;
-        return Expression();
-    }
-}
-
-
-
-Expression Interpreter::build_ast(TokenSequenceType &tokens) {
-
-    Expression ast;
-    Atom atm;
-
-    if (tokens.front() == "(") {
-
-        tokens.pop_front();
-        token_to_atom(tokens.front(), atm);
-        tokens.pop_front();
-        ast = Expression(atm);
-        while (tokens.front() != ")") {
-            if (tokens.front() == "(") {
-                ast.tail.push_back(build_ast(tokens));
-                tokens.pop_front();
-            }
-            else {
-                token_to_atom(tokens.front(), atm);
-                tokens.pop_front();
-                ast.tail.push_back( Expression(atm) );
-            }
-        }
-    }
-    else if (tokens.front() == ")") {
-        throw InterpreterSemanticError("Error: invalid syntax");
-    }
-    else {
-        token_to_atom(tokens.front(), atm);
-        tokens.pop_front();
-        ast = Expression(atm);
-    }
-
-    return ast;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-//
+#include "interpreter.hpp"
+
+// system includes
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <stack>
+#include <stdexcept>
+#include <iostream>
+
+// module includes
+#include "tokenize.hpp"
+#include "expression.hpp"
+#include "environment.hpp"
+#include "interpreter_semantic_error.hpp"
+#include "threadpool.hpp"
+#include "error.hpp"
+
+void Interpreter::setEngine(Engine selected){
+  engine = selected;
+}
+
+void Interpreter::setOptimization(bool enabled){
+  optimize = enabled;
+}
+
+void Interpreter::setJit(bool enabled){
+  jit = enabled && jit_available();
+}
+
+void Interpreter::setThrowErrors(bool enabled){
+  throw_errors = enabled;
+}
+
+void Interpreter::setOutput(std::ostream & out){
+  output = &out;
+}
+
+void Interpreter::setMemoCapacity(std::size_t capacity){
+  memo_capacity = capacity;
+}
+
+void Interpreter::setParallel(bool enabled){
+  parallel = enabled;
+}
+
+void Interpreter::setParallelThreshold(double cost){
+  parallel_threshold = cost;
+}
+
+void Interpreter::setStepLimit(unsigned long steps){
+  step_limit = steps;
+}
+
+void Interpreter::setTimeLimit(std::chrono::nanoseconds limit){
+  time_limit = limit;
+}
+
+// the steps the last eval took, those of the thread calling it exactly
+// and those of tasks it ran on the thread pool to within a grant each
+unsigned long Interpreter::stepsTaken() const{
+  return steps_taken + (walk.granted - walk.fuel);
+}
+
+void Interpreter::setMemoryLimit(std::size_t bytes){
+  account->setLimit(bytes);
+}
+
+std::size_t Interpreter::memoryInUse() const{
+  return account->current();
+}
+
+std::size_t Interpreter::peakMemory() const{
+  return account->peak();
+}
+
+HeapStats Interpreter::heapStats() const{
+  return account->heapStats();
+}
+
+const std::vector<std::string> & Interpreter::firedRewrites() const{
+  return rewrites;
+}
+
+// the results cached for the global procedure name, or nullptr
+// if it is not bound to a procedure created by define-memo
+const MemoTable * Interpreter::memoTable(const Symbol & name) const{
+  const Expression * bound = env.findExpression(name);
+  if (bound == nullptr || bound->head.type != LambdaType)
+    return nullptr;
+  return bound->head.value.lambda_value->memo.get();
+}
+
+bool Interpreter::parse(std::istream & expression) noexcept{
+
+  //tokenize the given expression
+  //std::deque<std::string> TokenSequenceType;
+  //run through tokens and create ast
+  TokenSequenceType tokens = tokenize(expression);
+  scopes.clear();
+  Expression parsed;
+  if (parse_tokens(tokens, parsed) != NoError) {
+      *output << "Error: invalid syntax" << std::endl;
+      return false;
+  }
+  source = parsed;
+  prepare();
+  return true;
+};
+
+// the deepest evaluate_in may nest before reporting an error
+const int max_depth = 5000;
+
+// increments a depth counter for the lifetime of one evaluate_in
+class DepthGuard{
+public:
+  DepthGuard(int & counter): count(counter){ ++count; };
+  ~DepthGuard(){ --count; };
+  bool exceeded() const{ return count > max_depth; };
+private:
+  int & count;
+};
+
+// the value of a local variable, depth frames out from frame
+static const Expression & local_value(const Expression & exp, const Frame * frame){
+    for (int i = 0; i < exp.depth; ++i) {
+        frame = frame->parent.get();
+    }
+    return frame->slots[exp.index];
+}
+
+// the slot of a local variable, for set! to assign
+static Expression & local_slot(const Expression & exp, Frame * frame){
+    for (int i = 0; i < exp.depth; ++i) {
+        frame = frame->parent.get();
+    }
+    return frame->slots[exp.index];
+}
+
+// the slot caching the value of a shared subexpression, in the frame of
+// the procedure call in a body, otherwise in the cache of this eval
+Atom & Interpreter::cacheSlot(int index, Frame * frame){
+    if (frame)
+        return frame->slots[index].head;
+    if (cache.size() <= std::size_t(index))
+        cache.resize(index + 1, Expression().head);
+    return cache[index];
+}
+
+// an estimate of the memory an AST holds: its nodes, names and the
+// bodies of its lambdas
+static std::size_t tree_bytes(const Expression & exp){
+  std::size_t bytes = sizeof(Expression) + exp.head.value.sym_value.size();
+  if (exp.op == LambdaOp)
+      bytes += sizeof(LambdaCode) + tree_bytes(exp.head.value.lambda_value->code->body);
+  for (auto & child: exp.tail) {
+      bytes += tree_bytes(child);
+  }
+  return bytes;
+}
+
+// check and optimize the parsed AST against the current environment,
+// discarding anything compiled from a previous preparation
+void Interpreter::prepare(){
+  ast = source;
+  rewrites.clear();
+  check_error = check_program(ast, env);
+  if (optimize && check_error == NoError) {
+      optimize_ast(ast, env, &rewrites);
+      // again, so the types proven describe the optimized nodes
+      check_error = check_program(ast, env);
+  }
+  if (parallel && check_error == NoError)
+      mark_parallel_arguments(ast, env, parallel_threshold);
+  prepared_generation = env.generation();
+  account->release(ast_bytes);
+  ast_bytes = tree_bytes(source) + tree_bytes(ast);
+  account->add(ast_bytes);
+  chunk = Chunk();
+  closure_program.reset();
+  jit_program.reset();
+  jit_tried = false;
+  walk_only = false;
+}
+
+Expression Interpreter::evaluate(const Expression & exp){
+    Expression result;
+    AccountScope scope(account);
+    start_metering();
+    Error error;
+    try {
+        error = evaluate_in(exp, std::shared_ptr<Frame>(), result);
+    }
+    catch (const MemoryLimitExceeded &) {
+        error = MemoryLimitError;
+    }
+    catch (const BuiltinError & failure) {
+        error = failure.error;
+    }
+    if (error != NoError) {
+        walk.values.clear();
+        throw InterpreterSemanticError(error_message(error));
+    }
+    return result;
+}
+
+// the walk state of a task evaluating an argument on the thread pool,
+// null while a thread walks for eval itself
+static thread_local WalkState * current_walk = nullptr;
+
+// spread calls nest at most this deep, past it arguments are evaluated
+// in order, so recursion does not spawn a task per call
+const int max_spread = 3;
+
+// whether a call has arguments marked to evaluate on the thread pool
+static bool spreads(const Expression & exp, const WalkState & walk){
+    if (walk.spread >= max_spread)
+        return false;
+    for (auto & child: exp.tail) {
+        if (child.parallel)
+            return true;
+    }
+    return false;
+}
+
+// an error clears the environment, unless other arguments may be reading
+// it, when the call spreading them does once they are done
+void Interpreter::clear_environment(WalkState & walk){
+    if (walk.deferred)
+        walk.cleared = true;
+    else
+        env.clear();
+}
+
+// the first of a batch of tasks run on the thread pool to fail: its
+// index, or the count of tasks if none did, its error, and whether it
+// would have cleared the environment
+struct SpreadFailure {
+    std::size_t index;
+    Error error;
+    bool cleared;
+};
+
+// run task(i) for every i below count on the thread pool, each with a
+// walk state of its own, nested one spread deeper than walk and deferring
+// any clearing of the environment, charging the caller's account, adding the steps each took of its
+// last grant to steps, and report the lowest to fail
+static SpreadFailure spread_tasks(std::size_t count, const WalkState & walk, std::atomic<unsigned long> & steps,
+                                  const std::function<Error(std::size_t)> & task){
+    std::vector<Error> errors(count, NoError);
+    std::vector<char> cleared(count, 0);
+    std::shared_ptr<MemoryAccount> account = current_account();
+    ThreadPool::shared().run(count, [&](std::size_t i){
+        WalkState state;
+        state.depth = walk.depth;
+        state.spread = walk.spread + 1;
+        state.deferred = true;
+        WalkState * saved = current_walk;
+        current_walk = &state;
+        AccountScope scope(account);
+        try {
+            errors[i] = task(i);
+        }
+        catch (const MemoryLimitExceeded &) {
+            errors[i] = MemoryLimitError;
+        }
+        catch (const BuiltinError & failure) {
+            errors[i] = failure.error;
+        }
+        current_walk = saved;
+        cleared[i] = state.cleared;
+        steps += state.granted - state.fuel;
+    });
+    for (std::size_t i = 0; i < count; ++i) {
+        if (errors[i] != NoError) {
+            SpreadFailure failure = {i, errors[i], cleared[i] != 0};
+            return failure;
+        }
+    }
+    SpreadFailure none = {count, NoError, false};
+    return none;
+}
+
+// evaluate the arguments of exp into args, those marked parallel as tasks
+// on the thread pool, then the rest in order. The first argument to fail
+// decides the error, as if they were evaluated in order, so the result
+// does not depend on how the tasks were scheduled.
+Error Interpreter::spread_arguments(const Expression & exp, const std::shared_ptr<Frame> & frame, WalkState & walk,
+                                    Expression * args){
+    std::size_t count = exp.tail.size();
+    std::vector<std::size_t> spread;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (exp.tail[i].parallel)
+            spread.push_back(i);
+    }
+    SpreadFailure failure = spread_tasks(spread.size(), walk, steps_taken, [&](std::size_t k){
+        return evaluate_in(exp.tail[spread[k]], frame, args[spread[k]]);
+    });
+    std::size_t failed = (failure.error != NoError) ? spread[failure.index] : count;
+    for (std::size_t i = 0; i < failed; ++i) {
+        if (exp.tail[i].parallel)
+            continue;
+        Error error = evaluate_in(exp.tail[i], frame, args[i]);
+        if (error != NoError)
+            return error;
+    }
+    if (failure.cleared)
+        clear_environment(walk);
+    return failure.error;
+}
+
+// steps a walk is granted at a time: metering costs a decrement per step
+// and, once per grant, an atomic add and for a time limit a clock read
+const unsigned long steps_per_grant = 4096;
+
+// begin metering an eval from no steps taken, with its time starting now
+void Interpreter::start_metering(){
+    steps_taken = 0;
+    walk.fuel = 0;
+    walk.granted = 0;
+    if (time_limit.count() != 0)
+        deadline = std::chrono::steady_clock::now() + time_limit;
+}
+
+// count the steps walk was last granted as taken and grant it more,
+// unless the eval has used up its steps or its time
+Error Interpreter::refuel(WalkState & walk){
+    unsigned long taken = (steps_taken += walk.granted);
+    walk.granted = 0;
+    if (step_limit != 0 && taken >= step_limit)
+        return StepLimitError;
+    if (time_limit.count() != 0 && std::chrono::steady_clock::now() >= deadline)
+        return TimeLimitError;
+    unsigned long grant = steps_per_grant;
+    if (step_limit != 0)
+        grant = std::min(grant, step_limit - taken);
+    walk.fuel = grant;
+    walk.granted = grant;
+    return NoError;
+}
+
+// apply a procedure to arguments already evaluated, as a call does
+// but not in tail position
+Error Interpreter::apply_procedure(const Lambda & lambda, const Expression * args, Expression & result){
+    std::size_t count = lambda.code->params.size();
+    std::shared_ptr<Frame> callee_frame = std::make_shared<Frame>();
+    callee_frame->parent = lambda.frame;
+    callee_frame->slots.assign(args, args + count);
+    callee_frame->slots.resize(count + lambda.code->cached);
+    if (lambda.memo) {
+        if (lambda.memo->find(args, count, result))
+            return NoError;
+        Error error = evaluate_in(lambda.code->body, callee_frame, result);
+        if (error == NoError)
+            lambda.memo->insert(args, count, result);
+        return error;
+    }
+    return evaluate_in(lambda.code->body, callee_frame, result);
+}
+
+// preduce folds its list in at most this many chunks, fixed so that
+// how it groups the items depends only on their number
+const std::size_t reduce_chunks = 64;
+
+// the items pmap and pfor apply their procedure to in one task: enough to
+// give each thread several tasks to balance, and enough to cost more
+// than threshold when the procedure's cost can be estimated
+static std::size_t grain_size(std::size_t items, std::size_t threads, double cost, double threshold){
+    std::size_t tasks = 4 * threads;
+    std::size_t grain = (items + tasks - 1) / tasks;
+    if (cost > 0 && cost < threshold)
+        grain = std::max(grain, std::size_t(threshold / cost));
+    return std::max<std::size_t>(grain, 1);
+}
+
+// evaluate pmap, preduce or pfor: apply a procedure to each item of a
+// list, or to each number from start counting up below end for pfor, in
+// chunks run on the thread pool when the procedure is pure, returning
+// the list of results in order. preduce instead folds each chunk from
+// its first item, then folds its initial value with the chunks' results
+// in order, which for an associative procedure is the fold of the whole
+// list, and however the chunks were scheduled is always the same value.
+Error Interpreter::apply_each(const Expression & exp, const std::shared_ptr<Frame> & frame, WalkState & walk,
+                              Expression & result){
+    std::size_t count = (exp.op == PmapOp) ? 2 : 3;
+    if (exp.tail.size() != count)
+        return ArgumentCountError;
+    std::vector<Expression> args(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        Error error = evaluate_in(exp.tail[i], frame, args[i]);
+        if (error != NoError)
+            return error;
+    }
+    if (args[0].head.type != LambdaType)
+        return ArgumentTypeError;
+    const Lambda & lambda = *args[0].head.value.lambda_value;
+    if (lambda.code->params.size() != ((exp.op == PreduceOp) ? 2u : 1u)) {
+        clear_environment(walk);
+        return ArgumentCountError;
+    }
+
+    Atom sequence = args.back().head;
+    if (exp.op == PforOp) {
+        if (args[1].head.type != NumberType || args[2].head.type != NumberType)
+            return ArgumentTypeError;
+        Atom bounds[] = {args[1].head, args[2].head};
+        sequence = range_unchecked(bounds, 2);
+    }
+    if (sequence.type != ListType)
+        return ArgumentTypeError;
+    const List & items = *sequence.value.list_value;
+    if (items.empty()) {
+        result = (exp.op == PreduceOp) ? args[1] : Expression(list_unchecked(nullptr, 0));
+        return NoError;
+    }
+
+    std::size_t threads = ThreadPool::shared().workers() + 1;
+    double cost = estimated_cost(lambda.code->body, env);
+    std::size_t grain = (exp.op == PreduceOp) ? (items.size() + reduce_chunks - 1) / reduce_chunks
+                                              : grain_size(items.size(), threads, cost, parallel_threshold);
+    std::size_t chunks = (items.size() + grain - 1) / grain;
+
+    Items results((exp.op == PreduceOp) ? chunks : items.size());
+    auto run_chunk = [&](std::size_t chunk) -> Error {
+        std::size_t begin = chunk * grain;
+        std::size_t end = std::min(items.size(), begin + grain);
+        Expression value;
+        if (exp.op == PreduceOp) {
+            Expression pair[] = {Expression(items[begin]), Expression()};
+            for (std::size_t i = begin + 1; i < end; ++i) {
+                pair[1] = Expression(items[i]);
+                Error error = apply_procedure(lambda, pair, value);
+                if (error != NoError)
+                    return error;
+                pair[0] = value;
+            }
+            results[chunk] = pair[0].head;
+            return NoError;
+        }
+        for (std::size_t i = begin; i < end; ++i) {
+            Expression item(items[i]);
+            Error error = apply_procedure(lambda, &item, value);
+            if (error != NoError)
+                return error;
+            results[i] = value.head;
+        }
+        return NoError;
+    };
+
+    if (lambda.code->pure && threads > 1 && chunks > 1 && cost * items.size() > parallel_threshold) {
+        SpreadFailure failure = spread_tasks(chunks, walk, steps_taken, run_chunk);
+        if (failure.cleared)
+            clear_environment(walk);
+        if (failure.error != NoError)
+            return failure.error;
+    }
+    else {
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+            Error error = run_chunk(chunk);
+            if (error != NoError)
+                return error;
+        }
+    }
+
+    if (exp.op != PreduceOp) {
+        result = Expression(make_list(std::move(results)));
+        return NoError;
+    }
+    Expression pair[] = {args[1], Expression()};
+    for (auto & partial: results) {
+        pair[1] = Expression(partial);
+        Error error = apply_procedure(lambda, pair, result);
+        if (error != NoError)
+            return error;
+        pair[0] = result;
+    }
+    return NoError;
+}
+
+// evaluate with frame holding the arguments of the enclosing procedure,
+// forms in tail position loop here instead of recursing, so tail calls
+// run in constant stack and release their caller's frame
+Error Interpreter::evaluate_in(const Expression & start, std::shared_ptr<Frame> frame, Expression & result){
+    WalkState & state = current_walk ? *current_walk : walk;
+    DepthGuard guard(state.depth);
+    if (guard.exceeded())
+        return RecursionDepthError;
+    const Expression * node = &start;
+
+    // keeps the body being run alive once its procedure may be released
+    std::shared_ptr<LambdaCode> running;
+
+    for (;;) {
+        const Expression & exp = *node;
+
+        // every node visited is a step, metered a grant at a time
+        if (state.fuel == 0) {
+            Error error = refuel(state);
+            if (error != NoError)
+                return error;
+        }
+        --state.fuel;
+
+        // subtrees proven to produce a Number or Boolean are evaluated
+        // on raw values, boxing only their result
+        if (exp.proven == NumberType && exp.op != LiteralOp) {
+            double value;
+            Error error = evaluate_number(exp, frame, value);
+            if (error == NoError)
+                result = Expression(value);
+            return error;
+        }
+        if (exp.proven == BooleanType && exp.op != LiteralOp) {
+            bool value;
+            Error error = evaluate_boolean(exp, frame, value);
+            if (error == NoError)
+                result = Expression(value);
+            return error;
+        }
+
+        switch (exp.op) {
+        case LiteralOp:
+            result = Expression(exp.head);
+            return NoError;
+        case VariableOp: {
+            const Expression * value = env.findExpression(exp.head.value.sym_value);
+            if (value == nullptr)
+                return UnknownSymbolError;
+            result = *value;
+            return NoError;
+        }
+        case LocalOp:
+            result = local_value(exp, frame.get());
+            return NoError;
+        case CachedOp: {
+            const Atom & slot = cacheSlot(exp.index, frame.get());
+            if (slot.type != NoneType) {
+                result = Expression(slot);
+                return NoError;
+            }
+            Error error = evaluate_in(exp.tail.at(0), frame, result);
+            if (error != NoError)
+                return error;
+            // evaluating may have grown the cache
+            cacheSlot(exp.index, frame.get()) = result.head;
+            return NoError;
+        }
+        case BeginOp:
+            if (exp.tail.empty()) {
+                result = Expression();
+                return NoError;
+            }
+            for (std::size_t i = 0; i + 1 < exp.tail.size(); ++i) {
+                Error error = evaluate_in(exp.tail[i], frame, result);
+                if (error != NoError)
+                    return error;
+            }
+            node = &exp.tail.back();
+            continue;
+        case IfOp: {
+            Expression cond;
+            Error error = evaluate_in(exp.tail.at(0), frame, cond);
+            if (error != NoError)
+                return error;
+            node = cond.head.value.bool_value ? &exp.tail.at(1) : &exp.tail.at(2);
+            continue;
+        }
+        case DefineOp: {
+            const std::string & addKey = exp.tail.at(0).head.value.sym_value;
+            if (env.keyPresent(addKey)){
+                clear_environment(state);
+                return RedefinitionError;
+            }
+            Expression value;
+            Error error = evaluate_in(exp.tail.at(1), frame, value);
+            if (error != NoError)
+                return error;
+            if (!env.addExpression(addKey, value))
+                return MemoryLimitError;
+            result = env.getExpression(addKey);
+            return NoError;
+        }
+        case LambdaOp: {
+            Expression procedure;
+            procedure.head.type = LambdaType;
+            procedure.head.value.lambda_value = std::make_shared<Lambda>();
+            procedure.head.value.lambda_value->code = exp.head.value.lambda_value->code;
+            procedure.head.value.lambda_value->frame = frame;
+            if (procedure.head.value.lambda_value->code->memo)
+                procedure.head.value.lambda_value->memo = std::make_shared<MemoTable>(memo_capacity);
+            result = procedure;
+            return NoError;
+        }
+        case DoOp: {
+            // the loop variables live in a frame of their own, so a
+            // procedure created in the body closes over one iteration
+            std::size_t count = exp.index;
+            std::shared_ptr<Frame> loop = std::make_shared<Frame>();
+            loop->parent = frame;
+            loop->slots.resize(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                Error error = evaluate_in(exp.tail[i], frame, loop->slots[i]);
+                if (error != NoError)
+                    return error;
+            }
+            const Expression & test = exp.tail.at(2 * count);
+            std::vector<Expression> stepped(count);
+            for (;;) {
+                Expression cond;
+                Error error = evaluate_in(test, loop, cond);
+                if (error != NoError)
+                    return error;
+                if (cond.head.value.bool_value)
+                    break;
+                for (std::size_t i = 2 * count + 2; i < exp.tail.size(); ++i) {
+                    error = evaluate_in(exp.tail[i], loop, result);
+                    if (error != NoError)
+                        return error;
+                }
+                // every step sees the values before any is assigned
+                for (std::size_t i = 0; i < count; ++i) {
+                    error = evaluate_in(exp.tail[count + i], loop, stepped[i]);
+                    if (error != NoError)
+                        return error;
+                }
+                if (loop.use_count() > 1) {
+                    std::shared_ptr<Frame> next = std::make_shared<Frame>();
+                    next->parent = frame;
+                    loop = next;
+                }
+                loop->slots.swap(stepped);
+                stepped.resize(count);
+            }
+            frame = loop;
+            node = &exp.tail.at(2 * count + 1);
+            continue;
+        }
+        case WhileOp:
+            for (;;) {
+                Expression cond;
+                Error error = evaluate_in(exp.tail.at(0), frame, cond);
+                if (error != NoError)
+                    return error;
+                if (!cond.head.value.bool_value)
+                    break;
+                for (std::size_t i = 1; i < exp.tail.size(); ++i) {
+                    error = evaluate_in(exp.tail[i], frame, result);
+                    if (error != NoError)
+                        return error;
+                }
+            }
+            result = Expression();
+            return NoError;
+        case SetOp: {
+            Error error = evaluate_in(exp.tail.at(1), frame, result);
+            if (error != NoError)
+                return error;
+            local_slot(exp.tail.at(0), frame.get()) = result;
+            return NoError;
+        }
+        case PmapOp:
+        case PreduceOp:
+        case PforOp:
+            return apply_each(exp, frame, state, result);
+        case ApplyOp: {
+            // applying a value that is not a procedure yields the value
+            Expression callee;
+            if (exp.depth < 0) {
+                const Expression * value = env.findExpression(exp.head.value.sym_value);
+                if (value == nullptr)
+                    return UnknownSymbolError;
+                callee = *value;
+            }
+            else {
+                callee = local_value(exp, frame.get());
+            }
+            if (callee.head.type != LambdaType) {
+                result = callee;
+                return NoError;
+            }
+
+            const Lambda & lambda = *callee.head.value.lambda_value;
+            if (exp.tail.size() != lambda.code->params.size()) {
+                clear_environment(state);
+                return ArgumentCountError;
+            }
+            std::shared_ptr<Frame> callee_frame = std::make_shared<Frame>();
+            callee_frame->parent = lambda.frame;
+            callee_frame->slots.resize(exp.tail.size() + lambda.code->cached);
+            if (parallel && spreads(exp, state)) {
+                Error error = spread_arguments(exp, frame, state, callee_frame->slots.data());
+                if (error != NoError)
+                    return error;
+            }
+            else {
+                for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+                    Error error = evaluate_in(exp.tail[i], frame, callee_frame->slots[i]);
+                    if (error != NoError)
+                        return error;
+                }
+            }
+            if (lambda.memo) {
+                // the result of a pure procedure depends only on its
+                // arguments, so it may be cached, leaving no tail call
+                std::shared_ptr<MemoTable> memo = lambda.memo;
+                if (memo->find(callee_frame->slots.data(), exp.tail.size(), result))
+                    return NoError;
+                running = lambda.code;
+                Error error = evaluate_in(running->body, callee_frame, result);
+                if (error == NoError)
+                    memo->insert(callee_frame->slots.data(), exp.tail.size(), result);
+                return error;
+            }
+            running = lambda.code;
+            frame = callee_frame;
+            node = &running->body;
+            continue;
+        }
+        case AndOp:
+        case OrOp:
+            // evaluate operands only until one decides the result
+            if (!exp.tail.empty()) {
+                bool decisive = (exp.op == OrOp);
+                for (auto & child: exp.tail) {
+                    Error error = evaluate_in(child, frame, result);
+                    if (error != NoError)
+                        return error;
+                    if (result.head.value.bool_value == decisive)
+                        return NoError;
+                }
+                result = Expression(!decisive);
+                return NoError;
+            }
+            // with no operands, fall through to report the builtin's error
+        default: {
+            // every remaining opcode is a builtin procedure, its arguments
+            // are evaluated onto the value stack and passed in place
+            std::vector<Atom> & values = state.values;
+            std::size_t base = values.size();
+            if (parallel && spreads(exp, state)) {
+                std::vector<Expression> args(exp.tail.size());
+                Error error = spread_arguments(exp, frame, state, args.data());
+                if (error != NoError)
+                    return error;
+                for (auto & arg: args) {
+                    values.push_back(arg.head);
+                }
+            }
+            else {
+                for (auto & child: exp.tail) {
+                    Error error = evaluate_in(child, frame, result);
+                    if (error != NoError)
+                        return error;
+                    values.push_back(result.head);
+                }
+            }
+            if (!exp.verified && !accepts_arguments(builtin_signature(exp.op), exp.tail.size())) {
+                clear_environment(state);
+                return ArgumentCountError;
+            }
+            result = Expression(builtin_unchecked(exp.op)(values.data() + base, exp.tail.size()));
+            values.resize(base);
+            return NoError;
+        }
+        }
+    }
+}
+
+// the value of a Number argument, unboxed if it is proven to be one,
+// otherwise read from its boxed value once it is checked to be one
+Error Interpreter::number_argument(const Expression & exp, const std::shared_ptr<Frame> & frame, double & value){
+    if (exp.proven == NumberType)
+        return evaluate_number(exp, frame, value);
+    Expression boxed;
+    Error error = evaluate_in(exp, frame, boxed);
+    if (error == NoError && boxed.head.type != NumberType)
+        return ArgumentTypeError;
+    value = boxed.head.value.num_value;
+    return error;
+}
+
+Error Interpreter::boolean_argument(const Expression & exp, const std::shared_ptr<Frame> & frame, bool & value,
+                                    Error mismatch){
+    if (exp.proven == BooleanType)
+        return evaluate_boolean(exp, frame, value);
+    Expression boxed;
+    Error error = evaluate_in(exp, frame, boxed);
+    if (error == NoError && boxed.head.type != BooleanType)
+        return mismatch;
+    value = boxed.head.value.bool_value;
+    return error;
+}
+
+// evaluate a node proven to produce a Number without building an
+// Expression, computing each builtin as its unchecked procedure does.
+// Procedure calls only happen in evaluate_in, which bounds their depth.
+Error Interpreter::evaluate_number(const Expression & exp, const std::shared_ptr<Frame> & frame, double & value){
+    Error error = NoError;
+    double operand;
+    switch (exp.op) {
+    case LiteralOp:
+        value = exp.head.value.num_value;
+        break;
+    case VariableOp:
+    case ApplyOp: {
+        // a global, applying it yields its value
+        const Expression * bound = env.findExpression(exp.head.value.sym_value);
+        if (bound == nullptr)
+            return UnknownSymbolError;
+        value = bound->head.value.num_value;
+        break;
+    }
+    case CachedOp: {
+        const Atom & slot = cacheSlot(exp.index, frame.get());
+        if (slot.type != NoneType) {
+            value = slot.value.num_value;
+            break;
+        }
+        error = evaluate_number(exp.tail.at(0), frame, value);
+        if (error != NoError)
+            return error;
+        Atom & filled = cacheSlot(exp.index, frame.get());
+        filled.type = NumberType;
+        filled.value.num_value = value;
+        break;
+    }
+    case IfOp: {
+        bool cond;
+        error = boolean_argument(exp.tail[0], frame, cond, ConditionTypeError);
+        if (error != NoError)
+            return error;
+        return evaluate_number(exp.tail[cond ? 1 : 2], frame, value);
+    }
+    case AddOp:
+    case MulOp: {
+        value = (exp.op == AddOp) ? 0.0 : 1.0;
+        for (auto & child: exp.tail) {
+            error = number_argument(child, frame, operand);
+            if (error != NoError)
+                return error;
+            if (exp.op == AddOp)
+                value += operand;
+            else
+                value *= operand;
+        }
+        break;
+    }
+    case SubOp:
+    case DivOp:
+    case PowOp:
+        error = number_argument(exp.tail[0], frame, value);
+        if (error != NoError)
+            return error;
+        if (exp.tail.size() == 1) {
+            value = value * -1;
+            break;
+        }
+        error = number_argument(exp.tail[1], frame, operand);
+        if (exp.op == SubOp)
+            value = value - operand;
+        else if (exp.op == DivOp)
+            value = value / operand;
+        else
+            value = pow(value, operand);
+        break;
+    case Log10Op:
+        error = number_argument(exp.tail[0], frame, value);
+        value = log10(value);
+        break;
+    default:
+        assert(false && "not a Number node");
+        break;
+    }
+    return error;
+}
+
+// evaluate a node proven to produce a Boolean without building an Expression
+Error Interpreter::evaluate_boolean(const Expression & exp, const std::shared_ptr<Frame> & frame, bool & value){
+    Error error = NoError;
+    switch (exp.op) {
+    case LiteralOp:
+        value = exp.head.value.bool_value;
+        break;
+    case VariableOp:
+    case ApplyOp: {
+        const Expression * bound = env.findExpression(exp.head.value.sym_value);
+        if (bound == nullptr)
+            return UnknownSymbolError;
+        value = bound->head.value.bool_value;
+        break;
+    }
+    case CachedOp: {
+        const Atom & slot = cacheSlot(exp.index, frame.get());
+        if (slot.type != NoneType) {
+            value = slot.value.bool_value;
+            break;
+        }
+        error = evaluate_boolean(exp.tail.at(0), frame, value);
+        if (error != NoError)
+            return error;
+        Atom & filled = cacheSlot(exp.index, frame.get());
+        filled.type = BooleanType;
+        filled.value.bool_value = value;
+        break;
+    }
+    case IfOp: {
+        bool cond;
+        error = boolean_argument(exp.tail[0], frame, cond, ConditionTypeError);
+        if (error != NoError)
+            return error;
+        return evaluate_boolean(exp.tail[cond ? 1 : 2], frame, value);
+    }
+    case NotOp:
+        error = boolean_argument(exp.tail[0], frame, value);
+        value = !value;
+        break;
+    case AndOp:
+    case OrOp: {
+        // operands only until one decides the result
+        bool decisive = (exp.op == OrOp);
+        for (auto & child: exp.tail) {
+            error = boolean_argument(child, frame, value);
+            if (error != NoError || value == decisive)
+                return error;
+        }
+        value = !decisive;
+        break;
+    }
+    case LessOp:
+    case LessEqualOp:
+    case MoreOp:
+    case MoreEqualOp:
+    case EqualOp: {
+        double a, b;
+        error = number_argument(exp.tail[0], frame, a);
+        if (error != NoError)
+            return error;
+        error = number_argument(exp.tail[1], frame, b);
+        if (exp.op == LessOp)
+            value = a < b;
+        else if (exp.op == LessEqualOp)
+            value = a <= b;
+        else if (exp.op == MoreOp)
+            value = a > b;
+        else if (exp.op == MoreEqualOp)
+            value = a >= b;
+        else
+            value = a == b;
+        break;
+    }
+    default:
+        assert(false && "not a Boolean node");
+        break;
+    }
+    return error;
+}
+
+// whether exp loops, which machine code does unmetered
+static bool loops(const Expression & exp){
+    if (exp.op == DoOp || exp.op == WhileOp)
+        return true;
+    for (auto & child: exp.tail) {
+        if (loops(child))
+            return true;
+    }
+    return false;
+}
+
+// the compiled engines run programs without procedures or loops, anything
+// that creates or applies a lambda, loops, or refers to a global bound to
+// one is tree walked
+static bool uses_procedures(const Expression & exp, Environment & env){
+    if (exp.op == LambdaOp || exp.op == LocalOp || exp.op == DoOp || exp.op == WhileOp || exp.op == SetOp ||
+        exp.op == PmapOp || exp.op == PreduceOp || exp.op == PforOp)
+        return true;
+    if (exp.op == VariableOp || exp.op == ApplyOp) {
+        const Expression * value = env.findExpression(exp.head.value.sym_value);
+        if (value != nullptr && value->head.type == LambdaType)
+            return true;
+    }
+    for (auto & child: exp.tail) {
+        if (uses_procedures(child, env))
+            return true;
+    }
+    return false;
+}
+
+// read the globals the compiled code uses, returning false
+// unless every one holds a number
+bool Interpreter::jitArguments(){
+    const std::vector<Symbol> & names = jit_program->globals();
+    jit_values.resize(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        const Expression * value = env.findExpression(names[i]);
+        if (value == nullptr || value->head.type != NumberType)
+            return false;
+        jit_values[i] = value->head.value.num_value;
+    }
+    return true;
+}
+
+// run the prepared AST charging the interpreter's account, returning the
+// errors allocations and builtins throw. Running out of steps, time or
+// memory leaves the environment as it was before.
+Error Interpreter::run(Expression & result){
+    AccountScope scope(account);
+    std::size_t defined = env.definitions();
+    Error error;
+    try {
+        error = execute(result);
+    }
+    catch (const MemoryLimitExceeded &) {
+        error = MemoryLimitError;
+    }
+    catch (const BuiltinError & failure) {
+        error = failure.error;
+    }
+    if (error == StepLimitError || error == TimeLimitError || error == MemoryLimitError)
+        env.rollback(defined);
+    return error;
+}
+
+// run the prepared AST as machine code or on the selected engine
+Error Interpreter::execute(Expression & result){
+    // types and constants read from a since cleared environment are stale
+    if (env.generation() != prepared_generation)
+        prepare();
+
+    // errors found by the checker are reported before anything runs
+    if (check_error != NoError)
+        return check_error;
+
+    // numeric programs run as machine code, unless a global they
+    // read is not a number when the engine reports the error. Machine
+    // code is not metered, so a loop in a bounded eval is walked instead.
+    start_metering();
+    bool bounded = step_limit != 0 || time_limit.count() != 0;
+    if (jit && !(bounded && loops(ast))) {
+        if (!jit_tried) {
+            jit_tried = true;
+            std::unique_ptr<JitProgram> compiled(new JitProgram());
+            if (compiled->compile(ast))
+                jit_program.swap(compiled);
+        }
+        if (jit_program && jitArguments()) {
+            result = Expression(jit_program->run(jit_values.data()));
+            return NoError;
+        }
+    }
+
+    cache.clear();
+    walk.values.clear();
+    if (engine != TreeWalkerEngine && !walk_only && chunk.code.empty() && !closure_program)
+        walk_only = uses_procedures(ast, env);
+
+    if (walk_only || engine == TreeWalkerEngine)
+        return evaluate_in(ast, std::shared_ptr<Frame>(), result);
+
+    if (engine == VirtualMachineEngine) {
+        if (chunk.code.empty()) {
+            Error error = compile_chunk(ast, chunk);
+            if (error != NoError)
+                return error;
+        }
+        return vm.run(chunk, env, result);
+    }
+
+    if (!closure_program) {
+        std::unique_ptr<ClosureProgram> compiled(new ClosureProgram());
+        Error error = compiled->compile(ast);
+        if (error != NoError)
+            return error;
+        closure_program.swap(compiled);
+    }
+    return closure_program->run(env, result);
+}
+
+Expression Interpreter::eval(){
+    Expression exp;
+    Error error = run(exp);
+    if (error != NoError) {
+        if (throw_errors)
+            throw InterpreterSemanticError(error_message(error));
+        *output << "Error: Semantic Error" << std::endl;
+        return Expression();
+    }
+    *output << exp << std::endl;
+    return exp;
+}
+
+// make a node from a token's atom, resolving the opcode of symbols
+// and the frame and slot of lambda parameters in scope
+Expression Interpreter::tagged_expression(const Atom & atm){
+    Expression exp(atm);
+    if (atm.type != SymbolType)
+        return exp;
+    exp.op = symbol_opcode(atm.value.sym_value);
+    for (std::size_t i = scopes.size(); exp.op == VariableOp && i > 0; --i) {
+        const std::vector<Symbol> & scope = scopes[i - 1];
+        for (std::size_t j = 0; j < scope.size(); ++j) {
+            if (scope[j] == atm.value.sym_value) {
+                exp.op = LocalOp;
+                exp.depth = scopes.size() - i;
+                exp.index = j;
+                break;
+            }
+        }
+    }
+    return exp;
+}
+
+// true for a bare variable name, usable as a parameter
+static bool is_parameter(const Expression & exp){
+    return (exp.op == VariableOp || exp.op == LocalOp) && exp.tail.empty();
+}
+
+// the parameter names of a lambda's list, or of a function define's
+// signature which starts with the function name
+static Error parameter_names(const Expression & list, bool named, std::vector<Symbol> & params){
+    if (list.op == ApplyOp) {
+        if (!named)
+            params.push_back(list.head.value.sym_value);
+    }
+    else if (list.head.type != NoneType) {
+        return SyntaxError;
+    }
+    for (auto & param: list.tail) {
+        if (!is_parameter(param))
+            return SyntaxError;
+        params.push_back(param.head.value.sym_value);
+    }
+    for (std::size_t i = 0; i < params.size(); ++i) {
+        for (std::size_t j = 0; j < i; ++j) {
+            if (params[i] == params[j])
+                return SyntaxError;
+        }
+    }
+    return NoError;
+}
+
+// a LambdaOp node for the given parameters and body forms
+static Error lambda_expression(const std::vector<Symbol> & params,
+                               const std::vector<Expression> & body, Expression & lambda){
+    if (body.empty())
+        return SyntaxError;
+
+    std::shared_ptr<LambdaCode> code = std::make_shared<LambdaCode>();
+    code->params = params;
+    if (body.size() == 1) {
+        code->body = body.front();
+    }
+    else {
+        code->body = Expression(std::string("begin"));
+        code->body.op = BeginOp;
+        code->body.tail = body;
+    }
+
+    lambda = Expression();
+    lambda.op = LambdaOp;
+    lambda.head.type = LambdaType;
+    lambda.head.value.lambda_value = std::make_shared<Lambda>();
+    lambda.head.value.lambda_value->code = code;
+    return NoError;
+}
+
+Expression Interpreter::build_ast(TokenSequenceType &tokens) {
+    Expression ast;
+    Error error = parse_tokens(tokens, ast);
+    if (error != NoError)
+        throw InterpreterSemanticError(error_message(error));
+    return ast;
+}
+
+// parse one expression from the front of tokens into ast,
+// running out of tokens before it is complete is a syntax error
+Error Interpreter::parse_tokens(TokenSequenceType &tokens, Expression & ast) {
+
+    ast = Expression();
+    Atom atm;
+
+    if (tokens.empty())
+        return SyntaxError;
+
+    if (tokens.front() == "(") {
+
+        tokens.pop_front();
+        if (tokens.empty())
+            return SyntaxError;
+        if (tokens.front() == ")") {
+            // the empty list, only meaningful as a parameter list
+            return NoError;
+        }
+        token_to_atom(tokens.front(), atm);
+        tokens.pop_front();
+        ast = tagged_expression(atm);
+        // a function define whose results are cached
+        bool memo = (atm.type == SymbolType && atm.value.sym_value == "define-memo");
+        if (memo) {
+            ast.op = DefineOp;
+        }
+        else if (ast.op == VariableOp || ast.op == LocalOp) {
+            // a parenthesized variable applies it
+            ast.op = ApplyOp;
+        }
+        else if (ast.op == DoOp) {
+            return parse_do(tokens, ast);
+        }
+
+        // parameters are in scope for the rest of a lambda
+        // or of a function define, (define (name params...) body...)
+        bool scoped = false;
+        std::vector<Symbol> params;
+        while (!tokens.empty() && tokens.front() != ")") {
+            Expression child;
+            Error error = parse_form(tokens, child);
+            if (error != NoError)
+                return error;
+            ast.tail.push_back(child);
+            if (ast.tail.size() == 1 &&
+                (ast.op == LambdaOp || (ast.op == DefineOp && ast.tail[0].op == ApplyOp))) {
+                Error error = parameter_names(ast.tail[0], ast.op == DefineOp, params);
+                if (error != NoError)
+                    return error;
+                scopes.push_back(params);
+                scoped = true;
+            }
+        }
+        if (tokens.empty())
+            return SyntaxError;
+
+        if (scoped) {
+            scopes.pop_back();
+            std::vector<Expression> body(ast.tail.begin() + 1, ast.tail.end());
+            Expression lambda;
+            Error error = lambda_expression(params, body, lambda);
+            if (error != NoError)
+                return error;
+            lambda.head.value.lambda_value->code->memo = memo;
+            if (ast.op == LambdaOp) {
+                ast = lambda;
+            }
+            else {
+                Expression name(ast.tail[0].head);
+                ast.tail.clear();
+                ast.tail.push_back(name);
+                ast.tail.push_back(lambda);
+            }
+        }
+        else if (ast.op == LambdaOp || memo || (ast.op == WhileOp && ast.tail.empty())) {
+            return SyntaxError;
+        }
+    }
+    else if (tokens.front() == ")") {
+        return SyntaxError;
+    }
+    else {
+        token_to_atom(tokens.front(), atm);
+        tokens.pop_front();
+        ast = tagged_expression(atm);
+    }
+
+    return NoError;
+}
+
+// parse one complete form from the front of tokens,
+// a list including its closing parenthesis
+Error Interpreter::parse_form(TokenSequenceType &tokens, Expression & exp) {
+    bool list = !tokens.empty() && tokens.front() == "(";
+    Error error = parse_tokens(tokens, exp);
+    if (error != NoError || !list)
+        return error;
+    if (tokens.empty())
+        return SyntaxError;
+    tokens.pop_front();
+    return NoError;
+}
+
+// move the tokens of one complete form from the front of tokens to form
+static Error take_form(TokenSequenceType &tokens, TokenSequenceType & form) {
+    int open = 0;
+    do {
+        if (tokens.empty())
+            return SyntaxError;
+        if (tokens.front() == "(")
+            ++open;
+        else if (tokens.front() == ")")
+            --open;
+        if (open < 0)
+            return SyntaxError;
+        form.push_back(tokens.front());
+        tokens.pop_front();
+    } while (open > 0);
+    return NoError;
+}
+
+// parse the rest of (do ((var init [step])...) (test result...) body...)
+// after do, leaving its closing parenthesis. Inits are in the enclosing
+// scope, the rest in a scope of the loop variables. The DoOp node holds
+// the count of variables in index, and in its tail the inits, the steps,
+// the test, a begin of the results and the body forms.
+Error Interpreter::parse_do(TokenSequenceType &tokens, Expression & ast) {
+    if (tokens.empty() || tokens.front() != "(")
+        return SyntaxError;
+    tokens.pop_front();
+
+    std::vector<Symbol> names;
+    std::vector<Expression> inits;
+    std::vector<TokenSequenceType> steps;
+    while (!tokens.empty() && tokens.front() != ")") {
+        if (tokens.front() != "(")
+            return SyntaxError;
+        tokens.pop_front();
+        Expression name;
+        Error error = parse_form(tokens, name);
+        if (error != NoError)
+            return error;
+        if (!is_parameter(name) || name.head.type != SymbolType)
+            return SyntaxError;
+        for (auto & other: names) {
+            if (other == name.head.value.sym_value)
+                return SyntaxError;
+        }
+        names.push_back(name.head.value.sym_value);
+
+        Expression init;
+        error = parse_form(tokens, init);
+        if (error != NoError)
+            return error;
+        inits.push_back(init);
+
+        // a step is parsed once every variable is in scope
+        TokenSequenceType step;
+        if (!tokens.empty() && tokens.front() != ")") {
+            error = take_form(tokens, step);
+            if (error != NoError)
+                return error;
+        }
+        else {
+            // without one the variable keeps its value
+            step.push_back(names.back());
+        }
+        steps.push_back(step);
+        if (tokens.empty() || tokens.front() != ")")
+            return SyntaxError;
+        tokens.pop_front();
+    }
+    if (tokens.empty())
+        return SyntaxError;
+    tokens.pop_front();
+
+    ast.index = names.size();
+    ast.tail = inits;
+    scopes.push_back(names);
+    Error error = parse_loop(tokens, steps, ast);
+    scopes.pop_back();
+    return error;
+}
+
+// parse the steps, test clause and body of a do with its variables in scope
+Error Interpreter::parse_loop(TokenSequenceType &tokens, std::vector<TokenSequenceType> & steps, Expression & ast) {
+    for (auto & form: steps) {
+        Expression step;
+        Error error = parse_form(form, step);
+        if (error != NoError)
+            return error;
+        if (!form.empty())
+            return SyntaxError;
+        ast.tail.push_back(step);
+    }
+
+    if (tokens.empty() || tokens.front() != "(")
+        return SyntaxError;
+    tokens.pop_front();
+    Expression test;
+    Error error = parse_form(tokens, test);
+    if (error != NoError)
+        return error;
+    ast.tail.push_back(test);
+    Expression results(std::string("begin"));
+    results.op = BeginOp;
+    while (!tokens.empty() && tokens.front() != ")") {
+        Expression result;
+        error = parse_form(tokens, result);
+        if (error != NoError)
+            return error;
+        results.tail.push_back(result);
+    }
+    if (tokens.empty())
+        return SyntaxError;
+    tokens.pop_front();
+    ast.tail.push_back(results);
+
+    while (!tokens.empty() && tokens.front() != ")") {
+        Expression form;
+        error = parse_form(tokens, form);
+        if (error != NoError)
+            return error;
+        ast.tail.push_back(form);
+    }
+    if (tokens.empty())
+        return SyntaxError;
+    return NoError;
+}
@@ -1,30 +1,197 @@
-#ifndef INTERPRETER_HPP
-#define INTERPRETER_HPP
-
-// system includes
-#include <string>
-#include <istream>
-
-// module includes
-#include "expression.hpp"
-#include "environment.hpp"
-#include "tokenize.hpp"
-
-
-// Interpreter has
-// Environment, which starts at a default
-// parse method, builds an internal AST
-// eval method, updates Environment, returns last result
-class Interpreter{
-public:
-  bool parse(std::istream & expression) noexcept;
-  Expression eval();
-  Expression evaluate(Expression exp);
-  Expression build_ast(TokenSequenceType &tokens);
-private:
-  Environment env;
-  Expression ast;
-};
-
-
-#endif
+#ifndef INTERPRETER_HPP
+#define INTERPRETER_HPP
+
+// system includes
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <istream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+#include "tokenize.hpp"
+#include "bytecode.hpp"
+#include "closure.hpp"
+#include "optimizer.hpp"
+#include "checker.hpp"
+#include "error.hpp"
+#include "jit.hpp"
+#include "memo.hpp"
+#include "parallel.hpp"
+
+// An Engine selects how eval executes the parsed AST:
+// walking the tree directly, compiling it to bytecode for the VM,
+// or compiling it to a tree of pre-bound closures
+enum Engine {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine};
+
+// A WalkState is what one thread walking the tree keeps: the arguments of
+// the builtin calls being evaluated, kept between calls so that once it
+// has grown a builtin call allocates nothing, and the nesting of
+// evaluate_in, bounded so deep non-tail recursion is an error rather than
+// a stack overflow, and the steps it may take before it is next metered.
+// Arguments evaluated on the thread pool each have one, deferring any
+// clearing of the environment until their siblings are done.
+struct WalkState {
+  std::vector<Atom> values;
+  int depth = 0;
+  // of the steps last granted it, those left
+  unsigned long fuel = 0;
+  unsigned long granted = 0;
+  // how many spread calls enclose this walk
+  int spread = 0;
+  bool deferred = false;
+  bool cleared = false;
+};
+
+// Interpreter has
+// Environment, which starts at a default
+// parse method, builds an internal AST
+// eval method, updates Environment, returns last result
+// Errors are passed up internally as Error values, build_ast and evaluate
+// throw InterpreterSemanticError for them, and eval does too once
+// setThrowErrors is enabled rather than printing and returning None
+class Interpreter{
+public:
+  Interpreter(): engine(TreeWalkerEngine), output(&std::cout), optimize(true), throw_errors(false), jit(jit_available()),
+                 memo_capacity(default_memo_capacity), parallel(false),
+                 parallel_threshold(default_parallel_threshold), step_limit(0), time_limit(0),
+                 steps_taken(0), account(std::make_shared<MemoryAccount>()), ast_bytes(0),
+                 prepared_generation(0), check_error(NoError), jit_tried(false), walk_only(false){
+    env.setAccount(account);
+  };
+  void setEngine(Engine selected);
+  void setOptimization(bool enabled);
+  void setJit(bool enabled);
+  void setThrowErrors(bool enabled);
+  // where eval prints its results and parse and eval their errors,
+  // std::cout unless set, so interpreters on several threads need not
+  // share a stream
+  void setOutput(std::ostream & out);
+  void setMemoCapacity(std::size_t capacity);
+  void setParallel(bool enabled);
+  void setParallelThreshold(double cost);
+  // bound each eval to a number of evaluation steps, and to a time
+  // after which it stops, 0 for no bound
+  void setStepLimit(unsigned long steps);
+  void setTimeLimit(std::chrono::nanoseconds limit);
+  unsigned long stepsTaken() const;
+  // bound the memory the interpreter holds, 0 for no bound, past which
+  // an eval fails leaving the environment as it was, and the memory it
+  // holds now and at most so far
+  void setMemoryLimit(std::size_t bytes);
+  std::size_t memoryInUse() const;
+  std::size_t peakMemory() const;
+  // what the heap holding the interpreter's lists has done
+  HeapStats heapStats() const;
+  const std::vector<std::string> & firedRewrites() const;
+  const MemoTable * memoTable(const Symbol & name) const;
+  bool parse(std::istream & expression) noexcept;
+  Expression eval();
+  Expression evaluate(const Expression & exp);
+  Expression build_ast(TokenSequenceType &tokens);
+private:
+  // compiles its expression as a procedure and applies it
+  friend class Program;
+
+
+  Error evaluate_in(const Expression & exp, std::shared_ptr<Frame> frame, Expression & result);
+  Error evaluate_number(const Expression & exp, const std::shared_ptr<Frame> & frame, double & value);
+  Error evaluate_boolean(const Expression & exp, const std::shared_ptr<Frame> & frame, bool & value);
+  // an argument not of the type needed is an ArgumentTypeError, or
+  // for a condition mismatch
+  Error number_argument(const Expression & exp, const std::shared_ptr<Frame> & frame, double & value);
+  Error boolean_argument(const Expression & exp, const std::shared_ptr<Frame> & frame, bool & value,
+                         Error mismatch = ArgumentTypeError);
+  Error spread_arguments(const Expression & exp, const std::shared_ptr<Frame> & frame, WalkState & walk,
+                         Expression * args);
+  void clear_environment(WalkState & walk);
+  void start_metering();
+  Error refuel(WalkState & walk);
+  Error apply_procedure(const Lambda & lambda, const Expression * args, Expression & result);
+  Error apply_each(const Expression & exp, const std::shared_ptr<Frame> & frame, WalkState & walk,
+                   Expression & result);
+  Atom & cacheSlot(int index, Frame * frame);
+  Error parse_tokens(TokenSequenceType &tokens, Expression & ast);
+  Error parse_form(TokenSequenceType &tokens, Expression & exp);
+  Error parse_do(TokenSequenceType &tokens, Expression & ast);
+  Error parse_loop(TokenSequenceType &tokens, std::vector<TokenSequenceType> & steps, Expression & ast);
+  Error run(Expression & result);
+  Error execute(Expression & result);
+  bool jitArguments();
+  Expression tagged_expression(const Atom & atm);
+  void prepare();
+
+  Environment env;
+  Engine engine;
+  std::ostream * output;
+
+  // the AST as parsed, and as prepared for evaluation
+  Expression source;
+  Expression ast;
+
+  // whether the optimizer runs over the AST, and the environment
+  // generation the types checked and constants propagated were read from
+  bool optimize;
+  // whether eval throws its errors
+  bool throw_errors;
+  // whether numeric programs are compiled to machine code
+  bool jit;
+  // the entries each procedure created by define-memo may cache
+  std::size_t memo_capacity;
+  // whether the tree walker evaluates costly independent arguments on
+  // the thread pool, and the estimated cost that makes one costly
+  bool parallel;
+  double parallel_threshold;
+
+  // the bounds on one eval, the time it must finish by, and the steps
+  // granted to walks so far, see refuel
+  unsigned long step_limit;
+  std::chrono::nanoseconds time_limit;
+  std::chrono::steady_clock::time_point deadline;
+  std::atomic<unsigned long> steps_taken;
+
+  // the account charged for the AST, bindings and lists, shared with the
+  // lists built, and the estimate of the AST charged to it
+  std::shared_ptr<MemoryAccount> account;
+  std::size_t ast_bytes;
+
+  unsigned long prepared_generation;
+
+  // the error check_program found preparing ast, reported by eval
+  Error check_error;
+
+  // names of the simplification rules that fired preparing ast
+  std::vector<std::string> rewrites;
+
+  // parameter names of the lambdas enclosing the form being parsed
+  std::vector<std::vector<Symbol>> scopes;
+
+  // values of the program's shared subexpressions, filled during one eval
+  std::vector<Atom> cache;
+
+  // the walk of the thread calling eval
+  WalkState walk;
+
+  // bytecode for ast, compiled on first use by the VM engine
+  Chunk chunk;
+  VirtualMachine vm;
+
+  // closures for ast, compiled on first use by the closure engine
+  std::unique_ptr<ClosureProgram> closure_program;
+
+  // machine code for ast, compiled on first use if the JIT supports it,
+  // and the values of the globals it reads
+  bool jit_tried;
+  std::unique_ptr<JitProgram> jit_program;
+  std::vector<double> jit_values;
+
+  // set when ast uses procedures, which only the tree walker runs
+  bool walk_only;
+};
+
+
+#endif
@@ -0,0 +1,593 @@
+#include "jit.hpp"
+
+// system includes
+#include <cstdint>
+#include <cstring>
+#include <deque>
+
+#if SLISP_JIT
+#include <sys/mman.h>
+#endif
+
+// module includes
+#include "environment.hpp"
+
+bool jit_available(){
+    return SLISP_JIT;
+}
+
+// The compiled function is double fn(const double * globals, double * scratch,
+// const double * constants, double * locals). Values live in registers and in
+// memory addressed from the four arguments; an Operand names either.
+enum Register {RCX = 1, RDX = 2, RSI = 6, RDI = 7};
+
+struct Operand {
+  bool memory;
+  int reg;       // the XMM register, or the base register of a memory operand
+  int disp;
+};
+
+static Operand xmm(int reg){
+    Operand operand = {false, reg, 0};
+    return operand;
+}
+
+static Operand memory(Register base, int disp){
+    Operand operand = {true, base, disp};
+    return operand;
+}
+
+static bool same(const Operand & a, const Operand & b){
+    return a.memory == b.memory && a.reg == b.reg && a.disp == b.disp;
+}
+
+// xmm0 and xmm1 are scratch, temporaries use the rest then spill
+const int first_temporary = 2;
+const int temporary_registers = 14;
+
+// SSE2 opcodes, after their prefix and 0x0F
+const std::uint8_t MovsdLoad = 0x10, MovsdStore = 0x11, Ucomisd = 0x2E,
+                   Xorpd = 0x57, Addsd = 0x58, Mulsd = 0x59, Subsd = 0x5C, Divsd = 0x5E;
+const std::uint8_t ScalarDouble = 0xF2, PackedDouble = 0x66;
+
+// condition codes of jcc
+enum Condition {Below = 0x2, AboveEqual = 0x3, Equal = 0x4, NotEqual = 0x5,
+                BelowEqual = 0x6, Above = 0x7, Parity = 0xA};
+
+// a jump target, bound once its position is known
+struct Label {
+  long position = -1;
+  std::vector<std::size_t> uses;
+};
+
+// emits code for one expression, failing on anything unsupported
+class Emitter {
+public:
+  Emitter(std::vector<Symbol> & names, std::vector<double> & constants)
+      : names(names), constants(constants), spilled(0), locals(0), failed(false){};
+
+  std::vector<std::uint8_t> code;
+  std::vector<Symbol> & names;
+  std::vector<double> & constants;
+  std::size_t spilled;
+  bool failed;
+
+  // the locals slot of each variable of the loops enclosing the
+  // expression being compiled, innermost last, and the slots used
+  std::vector<std::vector<std::size_t>> scopes;
+  std::size_t locals;
+
+  // the location of the temporary at depth
+  Operand temporary(std::size_t depth){
+      if (depth < std::size_t(temporary_registers))
+          return xmm(first_temporary + depth);
+      std::size_t slot = depth - temporary_registers;
+      if (slot + 1 > spilled)
+          spilled = slot + 1;
+      return memory(RSI, slot * sizeof(double));
+  }
+
+  Operand constant(double value){
+      for (std::size_t i = 0; i < constants.size(); ++i) {
+          if (std::memcmp(&constants[i], &value, sizeof(double)) == 0)
+              return memory(RDX, i * sizeof(double));
+      }
+      constants.push_back(value);
+      return memory(RDX, (constants.size() - 1) * sizeof(double));
+  }
+
+  // the slot of a loop variable, failing for any other local
+  Operand local(const Expression & exp){
+      if (exp.depth < 0 || std::size_t(exp.depth) >= scopes.size() || !exp.tail.empty()) {
+          failed = true;
+          return memory(RCX, 0);
+      }
+      const std::vector<std::size_t> & scope = scopes[scopes.size() - 1 - exp.depth];
+      return memory(RCX, scope.at(exp.index) * sizeof(double));
+  }
+
+  Operand global(const Symbol & name){
+      for (std::size_t i = 0; i < names.size(); ++i) {
+          if (names[i] == name)
+              return memory(RDI, i * sizeof(double));
+      }
+      names.push_back(name);
+      return memory(RDI, (names.size() - 1) * sizeof(double));
+  }
+
+  void byte(std::uint8_t value){
+      code.push_back(value);
+  }
+
+  void int32(std::int32_t value){
+      for (int i = 0; i < 4; ++i) {
+          byte((std::uint32_t(value) >> (8 * i)) & 0xFF);
+      }
+  }
+
+  // prefix [rex] 0F opcode modrm [disp32], reg is always an XMM register
+  void sse(std::uint8_t prefix, std::uint8_t opcode, int reg, const Operand & rm){
+      byte(prefix);
+      std::uint8_t rex = 0x40 | ((reg & 8) ? 0x4 : 0) | ((!rm.memory && (rm.reg & 8)) ? 0x1 : 0);
+      if (rex != 0x40)
+          byte(rex);
+      byte(0x0F);
+      byte(opcode);
+      if (rm.memory) {
+          byte(0x80 | ((reg & 7) << 3) | rm.reg);
+          int32(rm.disp);
+      }
+      else {
+          byte(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+      }
+  }
+
+  void move(const Operand & to, const Operand & from){
+      if (same(to, from))
+          return;
+      if (!to.memory) {
+          sse(ScalarDouble, MovsdLoad, to.reg, from);
+      }
+      else if (!from.memory) {
+          sse(ScalarDouble, MovsdStore, from.reg, to);
+      }
+      else {
+          sse(ScalarDouble, MovsdLoad, 0, from);
+          sse(ScalarDouble, MovsdStore, 0, to);
+      }
+  }
+
+  // to = to op from
+  void arithmetic(std::uint8_t opcode, const Operand & to, const Operand & from){
+      if (!to.memory) {
+          sse(ScalarDouble, opcode, to.reg, from);
+          return;
+      }
+      sse(ScalarDouble, MovsdLoad, 0, to);
+      sse(ScalarDouble, opcode, 0, from);
+      sse(ScalarDouble, MovsdStore, 0, to);
+  }
+
+  // set flags comparing a with b, above meaning a > b
+  void compare(const Operand & a, const Operand & b){
+      if (a.memory) {
+          sse(ScalarDouble, MovsdLoad, 0, a);
+          sse(PackedDouble, Ucomisd, 0, b);
+      }
+      else {
+          sse(PackedDouble, Ucomisd, a.reg, b);
+      }
+  }
+
+  void jump(Label & label){
+      byte(0xE9);
+      label.uses.push_back(code.size());
+      int32(0);
+  }
+
+  void jump_if(Condition condition, Label & label){
+      byte(0x0F);
+      byte(0x80 | condition);
+      label.uses.push_back(code.size());
+      int32(0);
+  }
+
+  void bind(Label & label){
+      label.position = code.size();
+  }
+
+  // patch every use of label, once the code is complete
+  void patch(const Label & label){
+      for (auto use: label.uses) {
+          std::int32_t offset = label.position - long(use + 4);
+          for (int i = 0; i < 4; ++i) {
+              code[use + i] = (std::uint32_t(offset) >> (8 * i)) & 0xFF;
+          }
+      }
+  }
+
+  // evaluate a numeric expression, returning where its value is, which is
+  // the temporary at depth unless it is a literal or global read in place
+  Operand value(const Expression & exp, std::size_t depth);
+
+  // jump to label when a boolean expression evaluates to when
+  void branch(const Expression & exp, bool when, Label & label, std::size_t depth);
+
+  // evaluate an expression only for its effects on loop variables
+  void effect(const Expression & exp, std::size_t depth);
+
+  // run a do loop until its test holds, with its variables left in scope
+  // for the caller to compile the results, which it then ends
+  void loop(const Expression & exp, std::size_t depth);
+  void end_loop(){
+      scopes.pop_back();
+  }
+
+  // labels are patched when the code is complete, so they outlive branches
+  std::deque<Label> labels;
+  Label & label(){
+      labels.push_back(Label());
+      return labels.back();
+  }
+};
+
+static bool arity_accepted(const Expression & exp){
+    return accepts_arguments(builtin_signature(exp.op), exp.tail.size());
+}
+
+Operand Emitter::value(const Expression & exp, std::size_t depth){
+    Operand result = temporary(depth);
+    switch (exp.op) {
+    case LiteralOp:
+        if (exp.head.type != NumberType)
+            break;
+        return constant(exp.head.value.num_value);
+    case VariableOp:
+    case ApplyOp:
+        // applying a global that is not a procedure yields its value
+        if (exp.depth >= 0 || !exp.tail.empty())
+            break;
+        return global(exp.head.value.sym_value);
+    case LocalOp:
+        // copied, since a later operand may assign it
+        move(result, local(exp));
+        return result;
+    case CachedOp:
+        // pure, so evaluating it again gives the same value
+        return value(exp.tail.at(0), depth);
+    case SetOp: {
+        if (exp.tail.size() != 2)
+            break;
+        Operand slot = local(exp.tail[0]);
+        move(result, value(exp.tail[1], depth));
+        move(slot, result);
+        return result;
+    }
+    case BeginOp:
+        if (exp.tail.empty())
+            break;
+        for (std::size_t i = 0; i + 1 < exp.tail.size(); ++i) {
+            effect(exp.tail[i], depth);
+        }
+        return value(exp.tail.back(), depth);
+    case DoOp: {
+        loop(exp, depth);
+        Operand results = value(exp.tail.at(2 * exp.index + 1), depth);
+        end_loop();
+        return results;
+    }
+    case IfOp: {
+        if (exp.tail.size() != 3)
+            break;
+        Label & otherwise = label();
+        Label & end = label();
+        branch(exp.tail[0], false, otherwise, depth);
+        move(result, value(exp.tail[1], depth));
+        jump(end);
+        bind(otherwise);
+        move(result, value(exp.tail[2], depth));
+        bind(end);
+        return result;
+    }
+    case AddOp:
+    case MulOp:
+        // folded from 0 or 1 like the builtins, since 0 + -0 is not -0
+        if (!arity_accepted(exp))
+            break;
+        if (exp.op == AddOp && !result.memory)
+            sse(PackedDouble, Xorpd, result.reg, result);
+        else
+            move(result, constant(exp.op == AddOp ? 0.0 : 1.0));
+        for (auto & child: exp.tail) {
+            arithmetic(exp.op == AddOp ? Addsd : Mulsd, result, value(child, depth + 1));
+        }
+        return result;
+    case SubOp:
+    case DivOp:
+        if (!arity_accepted(exp))
+            break;
+        move(result, value(exp.tail[0], depth));
+        if (exp.tail.size() == 1)
+            arithmetic(Mulsd, result, constant(-1.0));
+        else
+            arithmetic(exp.op == SubOp ? Subsd : Divsd, result, value(exp.tail[1], depth + 1));
+        return result;
+    default:
+        break;
+    }
+    failed = true;
+    return result;
+}
+
+void Emitter::branch(const Expression & exp, bool when, Label & label, std::size_t depth){
+    switch (exp.op) {
+    case LiteralOp:
+        if (exp.head.type != BooleanType)
+            break;
+        if (exp.head.value.bool_value == when)
+            jump(label);
+        return;
+    case CachedOp:
+        branch(exp.tail.at(0), when, label, depth);
+        return;
+    case BeginOp:
+        if (exp.tail.empty())
+            break;
+        for (std::size_t i = 0; i + 1 < exp.tail.size(); ++i) {
+            effect(exp.tail[i], depth);
+        }
+        branch(exp.tail.back(), when, label, depth);
+        return;
+    case DoOp:
+        loop(exp, depth);
+        branch(exp.tail.at(2 * exp.index + 1), when, label, depth);
+        end_loop();
+        return;
+    case IfOp: {
+        if (exp.tail.size() != 3)
+            break;
+        Label & otherwise = this->label();
+        Label & end = this->label();
+        branch(exp.tail[0], false, otherwise, depth);
+        branch(exp.tail[1], when, label, depth);
+        jump(end);
+        bind(otherwise);
+        branch(exp.tail[2], when, label, depth);
+        bind(end);
+        return;
+    }
+    case NotOp:
+        if (!arity_accepted(exp))
+            break;
+        branch(exp.tail[0], !when, label, depth);
+        return;
+    case AndOp:
+    case OrOp: {
+        if (!arity_accepted(exp))
+            break;
+        // an operand deciding the result jumps, or skips past the rest
+        bool decisive = (exp.op == OrOp);
+        Label & decided = (when == decisive) ? label : this->label();
+        for (std::size_t i = 0; i + 1 < exp.tail.size(); ++i) {
+            branch(exp.tail[i], decisive, decided, depth);
+        }
+        branch(exp.tail.back(), when, label, depth);
+        if (&decided != &label)
+            bind(decided);
+        return;
+    }
+    case LessOp:
+    case LessEqualOp:
+    case MoreOp:
+    case MoreEqualOp:
+    case EqualOp: {
+        if (!arity_accepted(exp))
+            break;
+        Operand a = value(exp.tail[0], depth);
+        Operand b = value(exp.tail[1], depth + 1);
+        // unordered comparisons set the carry flag, so NaN is never
+        // above, below or equal to anything
+        if (exp.op == LessOp || exp.op == LessEqualOp)
+            compare(b, a);
+        else
+            compare(a, b);
+        if (exp.op == EqualOp) {
+            if (when) {
+                Label & unordered = this->label();
+                jump_if(Parity, unordered);
+                jump_if(Equal, label);
+                bind(unordered);
+            }
+            else {
+                jump_if(Parity, label);
+                jump_if(NotEqual, label);
+            }
+            return;
+        }
+        bool strict = (exp.op == LessOp || exp.op == MoreOp);
+        if (when)
+            jump_if(strict ? Above : AboveEqual, label);
+        else
+            jump_if(strict ? BelowEqual : Below, label);
+        return;
+    }
+    default:
+        break;
+    }
+    failed = true;
+}
+
+// whether exp produces a Boolean, as far as its form shows
+static bool produces_boolean(const Expression & exp){
+    switch (exp.op) {
+    case LiteralOp:
+        return exp.head.type == BooleanType;
+    case CachedOp:
+        return produces_boolean(exp.tail.at(0));
+    case BeginOp:
+        return !exp.tail.empty() && produces_boolean(exp.tail.back());
+    case DoOp:
+        return produces_boolean(exp.tail.at(2 * exp.index + 1));
+    case IfOp:
+        return exp.tail.size() == 3 && produces_boolean(exp.tail[1]);
+    default:
+        return exp.op >= NotOp && exp.op <= EqualOp;
+    }
+}
+
+void Emitter::effect(const Expression & exp, std::size_t depth){
+    switch (exp.op) {
+    case BeginOp:
+        for (auto & child: exp.tail) {
+            effect(child, depth);
+        }
+        return;
+    case WhileOp: {
+        Label & top = label();
+        Label & end = label();
+        bind(top);
+        branch(exp.tail.at(0), false, end, depth);
+        for (std::size_t i = 1; i < exp.tail.size(); ++i) {
+            effect(exp.tail[i], depth);
+        }
+        jump(top);
+        bind(end);
+        return;
+    }
+    case DoOp:
+        loop(exp, depth);
+        effect(exp.tail.at(2 * exp.index + 1), depth);
+        end_loop();
+        return;
+    default:
+        break;
+    }
+    if (produces_boolean(exp)) {
+        Label & next = label();
+        branch(exp, true, next, depth);
+        bind(next);
+    }
+    else {
+        value(exp, depth);
+    }
+}
+
+void Emitter::loop(const Expression & exp, std::size_t depth){
+    // a loop compiles once, so its variables have fixed slots
+    std::size_t count = exp.index;
+    std::vector<std::size_t> scope;
+    for (std::size_t i = 0; i < count; ++i) {
+        scope.push_back(locals++);
+        move(memory(RCX, scope.back() * sizeof(double)), value(exp.tail[i], depth));
+    }
+    scopes.push_back(scope);
+
+    Label & top = label();
+    Label & done = label();
+    bind(top);
+    branch(exp.tail.at(2 * count), true, done, depth);
+    for (std::size_t i = 2 * count + 2; i < exp.tail.size(); ++i) {
+        effect(exp.tail[i], depth);
+    }
+    // every step sees the values before any is assigned
+    for (std::size_t i = 0; i < count; ++i) {
+        const Expression & step = exp.tail[count + i];
+        if (step.op == LocalOp && step.depth == 0 && step.index == int(i))
+            continue;
+        move(temporary(depth + i), value(step, depth + i));
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        const Expression & step = exp.tail[count + i];
+        if (step.op == LocalOp && step.depth == 0 && step.index == int(i))
+            continue;
+        move(memory(RCX, scope[i] * sizeof(double)), temporary(depth + i));
+    }
+    jump(top);
+    bind(done);
+}
+
+#if SLISP_JIT
+
+JitProgram::~JitProgram(){
+    if (code != nullptr)
+        munmap(code, size);
+}
+
+bool JitProgram::compile(const Expression & ast){
+    Emitter emitter(names, constants);
+    boolean = produces_boolean(ast);
+    if (boolean) {
+        // 1 or 0 in xmm0
+        Label & otherwise = emitter.label();
+        emitter.branch(ast, false, otherwise, 0);
+        emitter.move(xmm(0), emitter.constant(1.0));
+        emitter.byte(0xC3);
+        emitter.bind(otherwise);
+        emitter.move(xmm(0), emitter.constant(0.0));
+    }
+    else {
+        emitter.move(xmm(0), emitter.value(ast, 0));
+    }
+    emitter.byte(0xC3);
+    if (emitter.failed)
+        return false;
+    for (auto & label: emitter.labels) {
+        emitter.patch(label);
+    }
+    scratch.resize(emitter.spilled);
+    locals.resize(emitter.locals);
+
+    // written then made executable, never both at once
+    size = emitter.code.size();
+    void * pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED)
+        return false;
+    std::memcpy(pages, emitter.code.data(), size);
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, size);
+        return false;
+    }
+    code = pages;
+    return true;
+}
+
+Atom JitProgram::call(const double * values, double * spilled, double * loop_variables) const{
+    typedef double (*Function)(const double * globals, double * scratch, const double * constants,
+                               double * locals);
+    Function function = reinterpret_cast<Function>(code);
+    double result = function(values, spilled, constants.data(), loop_variables);
+    if (boolean)
+        return Expression(result != 0.0).head;
+    return Expression(result).head;
+}
+
+#else
+
+JitProgram::~JitProgram(){
+}
+
+bool JitProgram::compile(const Expression &){
+    return false;
+}
+
+Atom JitProgram::call(const double *, double *, double *) const{
+    return Expression().head;
+}
+
+#endif
+
+Atom JitProgram::run(const double * values){
+    return call(values, scratch.data(), locals.data());
+}
+
+Atom JitProgram::run(const double * values, double * work) const{
+    return call(values, work, work + scratch.size());
+}
+
+std::size_t JitProgram::workspace() const{
+    return scratch.size() + locals.size();
+}
+
+const std::vector<Symbol> & JitProgram::globals() const{
+    return names;
+}
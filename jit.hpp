@@ -0,0 +1,67 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+// system includes
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// machine code is only generated for x86-64 using the System V calling
+// convention, elsewhere nothing compiles and the interpreter runs everything
+#if defined(__x86_64__) && defined(__unix__)
+#define SLISP_JIT 1
+#else
+#define SLISP_JIT 0
+#endif
+
+// whether this build can compile to machine code
+bool jit_available();
+
+// A JitProgram is a numeric AST compiled to x86-64 machine code in its
+// own executable pages. It supports number literals, globals holding
+// numbers, + - * /, comparisons, not, and, or, if, begin, and do, while
+// and set! over loop variables holding numbers, keeping doubles in XMM
+// registers and loop variables unboxed in memory, and produces the same
+// results bit for bit as the builtins.
+class JitProgram {
+public:
+  JitProgram(): code(nullptr), size(0), boolean(false){};
+  ~JitProgram();
+
+  // compile ast, returning false if it uses anything unsupported
+  bool compile(const Expression & ast);
+
+  // the globals the code reads, run takes their values in this order
+  const std::vector<Symbol> & globals() const;
+
+  // run the compiled code with the values of its globals
+  Atom run(const double * values);
+
+  // run it keeping its temporaries in work, room for workspace()
+  // doubles, rather than in the program, so threads may share it
+  Atom run(const double * values, double * work) const;
+  std::size_t workspace() const;
+private:
+  JitProgram(const JitProgram &);
+  JitProgram & operator=(const JitProgram &);
+
+  Atom call(const double * values, double * spilled, double * loop_variables) const;
+
+  void * code;
+  std::size_t size;
+
+  // whether the result is a Boolean, returned as 0 or 1
+  bool boolean;
+
+  std::vector<Symbol> names;
+  std::vector<double> constants;
+
+  // temporaries that did not fit in registers, and loop variables
+  std::vector<double> scratch;
+  std::vector<double> locals;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "memo.hpp"
+
+// system includes
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+static std::uint64_t number_bits(Number num){
+    std::uint64_t bits;
+    std::memcpy(&bits, &num, sizeof(bits));
+    return bits;
+}
+
+static std::size_t combine(std::size_t seed, std::size_t hash){
+    return seed ^ (hash + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+static std::size_t atom_hash(const Atom & atom){
+    switch (atom.type) {
+    case BooleanType:
+        return atom.value.bool_value ? 1 : 2;
+    case NumberType:
+        return std::hash<std::uint64_t>()(number_bits(atom.value.num_value));
+    case SymbolType:
+        return std::hash<Symbol>()(atom.value.sym_value);
+    case LambdaType:
+        return std::hash<Lambda *>()(atom.value.lambda_value.get());
+    case ListType: {
+        std::size_t seed = atom.value.list_value->size();
+        for (auto & item: *atom.value.list_value) {
+            seed = combine(seed, atom_hash(item));
+        }
+        return seed;
+    }
+    default:
+        return 0;
+    }
+}
+
+static bool same_atom(const Atom & a, const Atom & b){
+    if (a.type != b.type)
+        return false;
+    switch (a.type) {
+    case BooleanType:
+        return a.value.bool_value == b.value.bool_value;
+    case NumberType:
+        return number_bits(a.value.num_value) == number_bits(b.value.num_value);
+    case SymbolType:
+        return a.value.sym_value == b.value.sym_value;
+    case LambdaType:
+        return a.value.lambda_value == b.value.lambda_value;
+    case ListType: {
+        const List & x = *a.value.list_value;
+        const List & y = *b.value.list_value;
+        if (x.size() != y.size())
+            return false;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!same_atom(x[i], y[i]))
+                return false;
+        }
+        return true;
+    }
+    default:
+        return true;
+    }
+}
+
+std::size_t MemoTable::KeyHash::operator()(const Key & key) const{
+    std::size_t seed = key.size();
+    for (auto & atom: key) {
+        seed = combine(seed, atom_hash(atom));
+    }
+    return seed;
+}
+
+bool MemoTable::KeyEqual::operator()(const Key & a, const Key & b) const{
+    if (a.size() != b.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (!same_atom(a[i], b[i]))
+            return false;
+    }
+    return true;
+}
+
+static std::vector<Atom> memo_key(const Expression * args, std::size_t count){
+    std::vector<Atom> key;
+    key.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        key.push_back(args[i].head);
+    }
+    return key;
+}
+
+bool MemoTable::find(const Expression * args, std::size_t count, Expression & result){
+    Key key = memo_key(args, count);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++miss_count;
+        return false;
+    }
+    ++hit_count;
+    // move to the front as the most recently used
+    entries.splice(entries.begin(), entries, it->second);
+    result = it->second->second;
+    return true;
+}
+
+void MemoTable::insert(const Expression * args, std::size_t count, const Expression & result){
+    if (limit == 0)
+        return;
+    Key key = memo_key(args, count);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        it->second->second = result;
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+    if (entries.size() == limit) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+    entries.emplace_front(key, result);
+    index.emplace(std::move(key), entries.begin());
+}
+
+std::size_t MemoTable::size() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+}
+
+std::size_t MemoTable::capacity() const{
+    return limit;
+}
+
+unsigned long MemoTable::hits() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return hit_count;
+}
+
+unsigned long MemoTable::misses() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return miss_count;
+}
@@ -0,0 +1,61 @@
+#ifndef MEMO_HPP
+#define MEMO_HPP
+
+// system includes
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// the entries a memoized procedure keeps unless told otherwise
+const std::size_t default_memo_capacity = 1024;
+
+// A MemoTable caches the results of one pure procedure keyed by its
+// arguments, compared structurally: numbers bit for bit, symbols by
+// name, lists item by item and procedures by identity. It holds at
+// most capacity entries, evicting the least recently used, and counts
+// its hits and misses.
+// Calls to the procedure on several threads may share it.
+class MemoTable {
+public:
+  explicit MemoTable(std::size_t capacity): limit(capacity), hit_count(0), miss_count(0){};
+
+  // copy the result cached for the count arguments at args to result,
+  // returning false if there is none, counting a hit or a miss
+  bool find(const Expression * args, std::size_t count, Expression & result);
+
+  // cache the result for the count arguments at args
+  void insert(const Expression * args, std::size_t count, const Expression & result);
+
+  std::size_t size() const;
+  std::size_t capacity() const;
+  unsigned long hits() const;
+  unsigned long misses() const;
+private:
+  typedef std::vector<Atom> Key;
+
+  struct KeyHash {
+    std::size_t operator()(const Key & key) const;
+  };
+  struct KeyEqual {
+    bool operator()(const Key & a, const Key & b) const;
+  };
+
+  typedef std::list<std::pair<Key, Expression>> Entries;
+
+  mutable std::mutex lock;
+  std::size_t limit;
+  unsigned long hit_count;
+  unsigned long miss_count;
+
+  // most recently used first
+  Entries entries;
+  std::unordered_map<Key, Entries::iterator, KeyHash, KeyEqual> index;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "memory.hpp"
+
+bool MemoryAccount::charge(std::size_t bytes){
+    std::size_t now = used.load();
+    do {
+        std::size_t limit = cap.load();
+        if (limit != 0 && (now + bytes > limit || now + bytes < now))
+            return false;
+    } while (!used.compare_exchange_weak(now, now + bytes));
+    raise_peak(now + bytes);
+    return true;
+}
+
+void MemoryAccount::add(std::size_t bytes){
+    raise_peak(used += bytes);
+}
+
+void MemoryAccount::release(std::size_t bytes){
+    used -= bytes;
+}
+
+void * MemoryAccount::allocate(std::size_t bytes){
+    if (!charge(bytes))
+        throw MemoryLimitExceeded();
+    try {
+        return heap.allocate(bytes);
+    }
+    catch (...) {
+        release(bytes);
+        throw;
+    }
+}
+
+void MemoryAccount::deallocate(void * block, std::size_t bytes){
+    heap.deallocate(block, bytes);
+    release(bytes);
+}
+
+HeapStats MemoryAccount::heapStats() const{
+    return heap.stats();
+}
+
+void MemoryAccount::raise_peak(std::size_t now){
+    std::size_t peak = highest.load();
+    while (now > peak && !highest.compare_exchange_weak(peak, now)) {
+    }
+}
+
+std::size_t MemoryAccount::current() const{
+    return used;
+}
+
+std::size_t MemoryAccount::peak() const{
+    return highest;
+}
+
+std::size_t MemoryAccount::limit() const{
+    return cap;
+}
+
+void MemoryAccount::setLimit(std::size_t bytes){
+    cap = bytes;
+}
+
+const char * MemoryLimitExceeded::what() const noexcept{
+    return "memory limit exceeded";
+}
+
+static thread_local std::shared_ptr<MemoryAccount> charged;
+
+const std::shared_ptr<MemoryAccount> & current_account(){
+    return charged;
+}
+
+AccountScope::AccountScope(const std::shared_ptr<MemoryAccount> & account): saved(charged){
+    charged = account;
+}
+
+AccountScope::~AccountScope(){
+    charged = saved;
+}
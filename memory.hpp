@@ -0,0 +1,113 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+// system includes
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+// module includes
+#include "heap.hpp"
+
+// A MemoryAccount counts the bytes an interpreter holds, now and at its
+// peak, against a limit, which is 0 for none, and owns the heap its
+// lists are allocated on. Threads evaluating for the interpreter may
+// share it.
+class MemoryAccount {
+public:
+  MemoryAccount(): used(0), highest(0), cap(0){};
+
+  // count bytes, refusing them if that would pass the limit
+  bool charge(std::size_t bytes);
+
+  // count bytes already held, whatever the limit
+  void add(std::size_t bytes);
+
+  void release(std::size_t bytes);
+
+  // a block from the heap, charged, throwing MemoryLimitExceeded if
+  // that is refused, and giving it back
+  void * allocate(std::size_t bytes);
+  void deallocate(void * block, std::size_t bytes);
+  HeapStats heapStats() const;
+
+  std::size_t current() const;
+  std::size_t peak() const;
+  std::size_t limit() const;
+  void setLimit(std::size_t bytes);
+private:
+  MemoryAccount(const MemoryAccount &);
+  MemoryAccount & operator=(const MemoryAccount &);
+
+  void raise_peak(std::size_t now);
+
+  std::atomic<std::size_t> used;
+  std::atomic<std::size_t> highest;
+  std::atomic<std::size_t> cap;
+  ListHeap heap;
+};
+
+// thrown by an allocation its account refuses,
+// which evaluation reports as MemoryLimitError
+class MemoryLimitExceeded: public std::bad_alloc {
+public:
+  const char * what() const noexcept;
+};
+
+// the account allocations on this thread are charged to, null for none
+const std::shared_ptr<MemoryAccount> & current_account();
+
+// An AccountScope charges the allocations of this thread to account
+// while it lives, then to the one charged before
+class AccountScope {
+public:
+  explicit AccountScope(const std::shared_ptr<MemoryAccount> & account);
+  ~AccountScope();
+private:
+  AccountScope(const AccountScope &);
+  AccountScope & operator=(const AccountScope &);
+
+  std::shared_ptr<MemoryAccount> saved;
+};
+
+// A CountingAllocator allocates from the heap of the account current on
+// the thread it was made on, charging it, or as std::allocator does if
+// there is none. It keeps the account alive so values may outlive their
+// interpreter.
+template <class T>
+class CountingAllocator {
+public:
+  typedef T value_type;
+
+  CountingAllocator(): account(current_account()){};
+  template <class U>
+  CountingAllocator(const CountingAllocator<U> & other): account(other.account){};
+
+  T * allocate(std::size_t n){
+    if (account)
+      return static_cast<T *>(account->allocate(n * sizeof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T * memory, std::size_t n){
+    if (account)
+      account->deallocate(memory, n * sizeof(T));
+    else
+      ::operator delete(memory);
+  }
+
+  std::shared_ptr<MemoryAccount> account;
+};
+
+template <class T, class U>
+bool operator==(const CountingAllocator<T> & a, const CountingAllocator<U> & b){
+  return a.account == b.account;
+}
+
+template <class T, class U>
+bool operator!=(const CountingAllocator<T> & a, const CountingAllocator<U> & b){
+  return a.account != b.account;
+}
+
+#endif
@@ -0,0 +1,346 @@
+#include "optimizer.hpp"
+
+// system includes
+#include <cstdint>
+#include <cstring>
+#include <map>
+
+// module includes
+#include "rewrite.hpp"
+
+// the logical builtins read booleans, every other builtin reads numbers
+static bool takes_booleans(Opcode op){
+    return op == NotOp || op == AndOp || op == OrOp;
+}
+
+static bool is_literal(const Expression & exp){
+    return exp.op == LiteralOp && exp.tail.empty() &&
+           (exp.head.type == NumberType || exp.head.type == BooleanType);
+}
+
+// evaluate a builtin call whose arguments are all literals of the type it
+// reads, returning false when it cannot be folded or would raise an error
+static bool fold_call(const Expression & exp, Expression & folded){
+    Type expected = takes_booleans(exp.op) ? BooleanType : NumberType;
+    std::vector<Atom> args;
+    for (auto & child: exp.tail) {
+        if (!is_literal(child) || child.head.type != expected)
+            return false;
+        args.push_back(child.head);
+    }
+    // lists are built when the program runs rather than kept in it
+    const Signature & signature = builtin_signature(exp.op);
+    if (signature.argument != expected || signature.result == ListType ||
+        !accepts_arguments(signature, args.size()))
+        return false;
+    folded = Expression(builtin_unchecked(exp.op)(args.data(), args.size()));
+    return true;
+}
+
+Expression & private_lambda_body(Expression & lambda){
+    std::shared_ptr<Lambda> copy = std::make_shared<Lambda>();
+    copy->code = std::make_shared<LambdaCode>(*lambda.head.value.lambda_value->code);
+    lambda.head.value.lambda_value = copy;
+    return copy->code->body;
+}
+
+// fold one node whose children are already folded
+static void fold_node(Expression & exp){
+    switch (exp.op) {
+    case VariableOp:
+    case ApplyOp: {
+        // builtin constants can never be redefined
+        Expression value;
+        if (exp.depth < 0 && builtin_constant(exp.head.value.sym_value, value))
+            exp = value;
+        break;
+    }
+    case IfOp:
+        if (exp.tail.size() == 3 && is_literal(exp.tail[0]) && exp.tail[0].head.type == BooleanType) {
+            Expression taken = exp.tail[exp.tail[0].head.value.bool_value ? 1 : 2];
+            exp = taken;
+        }
+        break;
+    case BeginOp: {
+        // splice nested begins, an empty one still supplies a last value
+        std::vector<Expression> flat;
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            const Expression & child = exp.tail[i];
+            if (child.op == BeginOp && !child.tail.empty())
+                flat.insert(flat.end(), child.tail.begin(), child.tail.end());
+            else
+                flat.push_back(child);
+        }
+        exp.tail.swap(flat);
+        if (exp.tail.size() == 1) {
+            Expression only = exp.tail[0];
+            exp = only;
+        }
+        break;
+    }
+    case AndOp:
+    case OrOp: {
+        // operands after a literal deciding the result never run,
+        // other literal operands make no difference
+        if (exp.tail.empty())
+            break;
+        bool decisive = (exp.op == OrOp);
+        std::vector<Expression> kept;
+        for (auto & child: exp.tail) {
+            bool boolean = is_literal(child) && child.head.type == BooleanType;
+            if (!boolean) {
+                kept.push_back(child);
+            }
+            else if (child.head.value.bool_value == decisive) {
+                kept.push_back(child);
+                break;
+            }
+        }
+        if (kept.empty() || (kept.size() == 1 && is_literal(kept[0])))
+            exp = Expression(kept.empty() ? !decisive : decisive);
+        else
+            exp.tail.swap(kept);
+        break;
+    }
+    case LiteralOp:
+    case LocalOp:
+    case CachedOp:
+    case DefineOp:
+    case LambdaOp:
+    case DoOp:
+    case WhileOp:
+    case SetOp:
+    case PmapOp:
+    case PreduceOp:
+    case PforOp:
+        break;
+    default: {
+        Expression folded;
+        if (fold_call(exp, folded))
+            exp = folded;
+        break;
+    }
+    }
+}
+
+void fold_constants(Expression & exp){
+    if (exp.op == LambdaOp) {
+        fold_constants(private_lambda_body(exp));
+        return;
+    }
+
+    // the name a define binds is not itself evaluated
+    std::size_t first = (exp.op == DefineOp) ? 1 : 0;
+    for (std::size_t i = first; i < exp.tail.size(); ++i) {
+        fold_constants(exp.tail[i]);
+    }
+    fold_node(exp);
+}
+
+// globals known to hold a literal at a point in the program
+typedef std::map<Symbol, Expression> ConstantMap;
+
+// the literal a global holds, from an earlier define in this program
+// or from the environment, returning false if it is not a known literal
+static bool constant_value(const Symbol & name, const ConstantMap & constants,
+                           const Environment & env, Expression & value){
+    auto it = constants.find(name);
+    if (it != constants.end()) {
+        value = it->second;
+        return true;
+    }
+    const Expression * bound = env.findExpression(name);
+    if (bound == nullptr || !is_literal(*bound))
+        return false;
+    value = *bound;
+    return true;
+}
+
+static void propagate(Expression & exp, const ConstantMap & constants, const Environment & env){
+    switch (exp.op) {
+    case VariableOp:
+    case ApplyOp: {
+        // applying a literal yields it, so both forms are replaced
+        Expression value;
+        if (exp.depth < 0 && constant_value(exp.head.value.sym_value, constants, env, value)) {
+            exp = value;
+            return;
+        }
+        for (auto & child: exp.tail) {
+            propagate(child, constants, env);
+        }
+        break;
+    }
+    case LambdaOp:
+        // the body runs later, when every global known here still holds
+        propagate(private_lambda_body(exp), constants, env);
+        return;
+    case DefineOp:
+        for (std::size_t i = 1; i < exp.tail.size(); ++i) {
+            propagate(exp.tail[i], constants, env);
+        }
+        break;
+    case BeginOp: {
+        // a define that succeeds binds its name for the rest of the sequence,
+        // but not beyond it since the begin may sit in an untaken branch
+        ConstantMap sequence = constants;
+        for (auto & child: exp.tail) {
+            propagate(child, sequence, env);
+            if (child.op == DefineOp && child.tail.size() == 2 && is_literal(child.tail[1]))
+                sequence[child.tail[0].head.value.sym_value] = child.tail[1];
+        }
+        break;
+    }
+    default:
+        for (auto & child: exp.tail) {
+            propagate(child, constants, env);
+        }
+        break;
+    }
+    fold_node(exp);
+}
+
+void propagate_constants(Expression & exp, const Environment & env){
+    propagate(exp, ConstantMap(), env);
+}
+
+// a builtin call over literals, variables and other such calls,
+// whose value is fixed for one run of a program or procedure body
+static bool is_shareable(const Expression & exp){
+    if (exp.op < FirstBuiltinOp)
+        return false;
+    for (auto & child: exp.tail) {
+        bool leaf = child.op == LiteralOp || child.op == VariableOp || child.op == LocalOp;
+        if (!leaf && !is_shareable(child))
+            return false;
+    }
+    return true;
+}
+
+// a string identifying a subtree by its structure
+static void write_key(const Expression & exp, std::string & key){
+    key += std::to_string(exp.op);
+    key += ' ';
+    if (exp.head.type == NumberType) {
+        // by bit pattern, so 0 and -0 differ
+        std::uint64_t bits;
+        std::memcpy(&bits, &exp.head.value.num_value, sizeof(bits));
+        key += std::to_string(bits);
+    }
+    else if (exp.head.type == BooleanType)
+        key += exp.head.value.bool_value ? "True" : "False";
+    else if (exp.head.type == SymbolType)
+        key += exp.head.value.sym_value;
+    if (exp.op == LocalOp) {
+        key += ' ';
+        key += std::to_string(exp.depth);
+        key += ' ';
+        key += std::to_string(exp.index);
+    }
+    key += '(';
+    for (auto & child: exp.tail) {
+        write_key(child, key);
+    }
+    key += ')';
+}
+
+static std::string subtree_key(const Expression & exp){
+    std::string key;
+    write_key(exp, key);
+    return key;
+}
+
+typedef std::map<std::string, int> SubtreeCounts;
+
+// count the shareable subtrees of one program or procedure body,
+// which stops at the bodies of the lambdas it creates
+static void count_subtrees(const Expression & exp, SubtreeCounts & counts){
+    if (exp.op == LambdaOp)
+        return;
+    if (is_shareable(exp))
+        ++counts[subtree_key(exp)];
+    std::size_t first = (exp.op == DefineOp) ? 1 : 0;
+    for (std::size_t i = first; i < exp.tail.size(); ++i) {
+        count_subtrees(exp.tail[i], counts);
+    }
+}
+
+static void share_subtrees(Expression & exp, std::size_t first_slot, std::size_t & slots);
+
+// wrap subtrees occurring more than once in a CachedOp, numbering slots from
+// first_slot. Within a shared subtree only subtrees that also occur elsewhere
+// are shared, the rest are evaluated once with it anyway.
+static void share_repeated(Expression & exp, const SubtreeCounts & counts, int enclosing,
+                           std::map<std::string, std::size_t> & slot_of,
+                           std::size_t first_slot, std::size_t & slots){
+    if (exp.op == LambdaOp) {
+        // a procedure body caches in the frame of each call
+        Expression & body = private_lambda_body(exp);
+        LambdaCode & code = *exp.head.value.lambda_value->code;
+        code.cached = 0;
+        share_subtrees(body, code.params.size(), code.cached);
+        return;
+    }
+
+    if (is_shareable(exp)) {
+        std::string key = subtree_key(exp);
+        int count = counts.at(key);
+        if (count > 1 && count > enclosing) {
+            for (auto & child: exp.tail) {
+                share_repeated(child, counts, count, slot_of, first_slot, slots);
+            }
+            auto it = slot_of.find(key);
+            if (it == slot_of.end())
+                it = slot_of.insert(std::make_pair(key, first_slot + slots++)).first;
+            Expression cached;
+            cached.op = CachedOp;
+            cached.index = it->second;
+            cached.tail.push_back(exp);
+            exp = cached;
+            return;
+        }
+    }
+
+    std::size_t first = (exp.op == DefineOp) ? 1 : 0;
+    for (std::size_t i = first; i < exp.tail.size(); ++i) {
+        share_repeated(exp.tail[i], counts, enclosing, slot_of, first_slot, slots);
+    }
+}
+
+static void share_subtrees(Expression & exp, std::size_t first_slot, std::size_t & slots){
+    SubtreeCounts counts;
+    count_subtrees(exp, counts);
+    std::map<std::string, std::size_t> slot_of;
+    share_repeated(exp, counts, 0, slot_of, first_slot, slots);
+}
+
+// whether exp, or a procedure it creates, loops or assigns a variable
+static bool assigns_locals(const Expression & exp){
+    if (exp.op == DoOp || exp.op == WhileOp || exp.op == SetOp)
+        return true;
+    if (exp.op == LambdaOp)
+        return assigns_locals(exp.head.value.lambda_value->code->body);
+    for (auto & child: exp.tail) {
+        if (assigns_locals(child))
+            return true;
+    }
+    return false;
+}
+
+std::size_t share_common_subexpressions(Expression & exp){
+    // a cached value would go stale once a variable it reads changes
+    if (assigns_locals(exp))
+        return 0;
+    std::size_t slots = 0;
+    share_subtrees(exp, 0, slots);
+    return slots;
+}
+
+void optimize_ast(Expression & exp, const Environment & env, std::vector<std::string> * fired){
+    fold_constants(exp);
+    propagate_constants(exp, env);
+    // simplified calls may have literal arguments to fold
+    simplify(exp, fired);
+    fold_constants(exp);
+    share_common_subexpressions(exp);
+}
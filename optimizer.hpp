@@ -0,0 +1,41 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+// system includes
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+
+// rewrite a parsed AST in place before evaluation:
+// builtin calls on literal arguments and builtin constants are evaluated
+// ahead of time, an if with a literal condition becomes the branch taken,
+// and nested begins are flattened.
+// A call that would raise an error is left to raise it at runtime.
+void fold_constants(Expression & exp);
+
+// replace references to globals holding a literal with the literal and
+// fold again. Globals cannot be rebound, so this covers globals already in
+// env and those bound by an earlier define in the same begin sequence.
+void propagate_constants(Expression & exp, const Environment & env);
+
+// evaluate each builtin subexpression repeated within the program, or within
+// a procedure body, only once: occurrences become a CachedOp reading one slot,
+// filled by whichever is evaluated first. Slots of a body follow its parameters
+// in the frame of each call, those of the program are numbered from 0 and
+// their count returned. Programs with loops or set! are left unshared.
+// Must run last, the other passes do not expect a CachedOp.
+std::size_t share_common_subexpressions(Expression & exp);
+
+// run every pass, in order, appending the name of each
+// simplification rule that fired to fired when it is given
+void optimize_ast(Expression & exp, const Environment & env,
+                  std::vector<std::string> * fired = nullptr);
+
+// lambda code is shared by every copy of an AST,
+// so make the lambda's code private to it and return its body to rewrite
+Expression & private_lambda_body(Expression & lambda);
+
+#endif
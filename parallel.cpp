@@ -0,0 +1,193 @@
+#include "parallel.hpp"
+
+// system includes
+#include <map>
+#include <set>
+
+// module includes
+#include "optimizer.hpp"
+
+// iterations a loop is taken to run, and the cost of recursion
+const double loop_iterations = 1000;
+const double unbounded_cost = 1e15;
+
+// procedures bound by an earlier define in this program
+typedef std::map<Symbol, const LambdaCode *> ProcedureMap;
+
+// the code of the procedure a global holds, or nullptr
+static const LambdaCode * procedure_code(const Symbol & name, const ProcedureMap & procedures,
+                                         const Environment & env){
+    auto it = procedures.find(name);
+    if (it != procedures.end())
+        return it->second;
+    const Expression * bound = env.findExpression(name);
+    if (bound == nullptr || bound->head.type != LambdaType)
+        return nullptr;
+    return bound->head.value.lambda_value->code.get();
+}
+
+// record a procedure a define in a sequence binds for the forms after it
+static void bind_procedure(const Expression & exp, ProcedureMap & procedures){
+    if (exp.op == DefineOp && exp.tail.size() == 2 && exp.tail[1].op == LambdaOp)
+        procedures[exp.tail[0].head.value.sym_value] = exp.tail[1].head.value.lambda_value->code.get();
+}
+
+static double cost(const Expression & exp, const ProcedureMap & procedures, const Environment & env,
+                   std::set<const LambdaCode *> & calling){
+    switch (exp.op) {
+    case LambdaOp:
+        return 1;
+    case BeginOp: {
+        ProcedureMap sequence = procedures;
+        double total = 1;
+        for (auto & child: exp.tail) {
+            total += cost(child, sequence, env, calling);
+            bind_procedure(child, sequence);
+        }
+        return total;
+    }
+    case DoOp:
+    case WhileOp: {
+        std::size_t inits = (exp.op == DoOp) ? exp.index : 0;
+        double once = 1, repeated = 0;
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            (i < inits ? once : repeated) += cost(exp.tail[i], procedures, env, calling);
+        }
+        return once + repeated * loop_iterations;
+    }
+    default:
+        break;
+    }
+
+    double total = 1;
+    for (auto & child: exp.tail) {
+        total += cost(child, procedures, env, calling);
+    }
+
+    // the procedure called, and how often: pmap, preduce and pfor apply
+    // the one they are given to many items, like a loop
+    const Expression * callee = nullptr;
+    double calls = 1;
+    if (exp.op == ApplyOp)
+        callee = &exp;
+    else if ((exp.op == PmapOp || exp.op == PreduceOp || exp.op == PforOp) && !exp.tail.empty()) {
+        callee = &exp.tail[0];
+        calls = loop_iterations;
+    }
+    if (callee != nullptr && callee->depth < 0 && callee->head.type == SymbolType) {
+        const LambdaCode * code = procedure_code(callee->head.value.sym_value, procedures, env);
+        if (code != nullptr) {
+            if (calling.count(code))
+                return unbounded_cost;
+            calling.insert(code);
+            total += calls * cost(code->body, procedures, env, calling);
+            calling.erase(code);
+        }
+    }
+    else if (callee != nullptr && callee->op == LambdaOp) {
+        total += calls * cost(callee->head.value.lambda_value->code->body, procedures, env, calling);
+    }
+    return total < unbounded_cost ? total : unbounded_cost;
+}
+
+double estimated_cost(const Expression & exp, const Environment & env){
+    std::set<const LambdaCode *> calling;
+    return cost(exp, ProcedureMap(), env, calling);
+}
+
+// whether exp may be evaluated while its siblings are, the variables
+// of its own innermost scopes being the only ones it may assign
+static bool independent(const Expression & exp, int scopes, const ProcedureMap & procedures,
+                        const Environment & env){
+    switch (exp.op) {
+    case DefineOp:
+    case CachedOp:
+        return false;
+    case LambdaOp:
+        return true;
+    case SetOp:
+        return exp.tail.size() == 2 && exp.tail[0].depth < scopes &&
+               independent(exp.tail[1], scopes, procedures, env);
+    case DoOp:
+        for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+            int inner = scopes + (i < std::size_t(exp.index) ? 0 : 1);
+            if (!independent(exp.tail[i], inner, procedures, env))
+                return false;
+        }
+        return true;
+    case ApplyOp: {
+        if (exp.depth >= 0)
+            return false;
+        const LambdaCode * code = procedure_code(exp.head.value.sym_value, procedures, env);
+        const Expression * bound = env.findExpression(exp.head.value.sym_value);
+        bool known = (code != nullptr) ? code->pure : (bound != nullptr);
+        if (!known)
+            return false;
+        break;
+    }
+    case PmapOp:
+    case PreduceOp:
+    case PforOp: {
+        // the procedure applied must be pure, like one called directly
+        if (exp.tail.empty())
+            return false;
+        const Expression & procedure = exp.tail[0];
+        const LambdaCode * code = nullptr;
+        if (procedure.op == VariableOp)
+            code = procedure_code(procedure.head.value.sym_value, procedures, env);
+        else if (procedure.op == LambdaOp)
+            code = procedure.head.value.lambda_value->code.get();
+        if (code == nullptr || !code->pure)
+            return false;
+        break;
+    }
+    default:
+        break;
+    }
+    for (auto & child: exp.tail) {
+        if (!independent(child, scopes, procedures, env))
+            return false;
+    }
+    return true;
+}
+
+static void mark(Expression & exp, const ProcedureMap & procedures, const Environment & env, double threshold){
+    if (exp.op == LambdaOp) {
+        mark(private_lambda_body(exp), procedures, env, threshold);
+        return;
+    }
+    if (exp.op == BeginOp) {
+        ProcedureMap sequence = procedures;
+        for (auto & child: exp.tail) {
+            mark(child, sequence, env, threshold);
+            bind_procedure(child, sequence);
+        }
+        return;
+    }
+    std::size_t first = (exp.op == DefineOp) ? 1 : 0;
+    for (std::size_t i = first; i < exp.tail.size(); ++i) {
+        mark(exp.tail[i], procedures, env, threshold);
+    }
+
+    // and, or evaluate their operands only until one decides
+    bool call = exp.op == ApplyOp || (exp.op >= FirstBuiltinOp && exp.op != AndOp && exp.op != OrOp);
+    if (!call || exp.tail.size() < 2)
+        return;
+    std::vector<std::size_t> costly;
+    for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+        std::set<const LambdaCode *> calling;
+        if (cost(exp.tail[i], procedures, env, calling) > threshold &&
+            independent(exp.tail[i], 0, procedures, env))
+            costly.push_back(i);
+    }
+    if (costly.size() < 2)
+        return;
+    for (auto i: costly) {
+        exp.tail[i].parallel = true;
+    }
+    exp.proven = NoneType;
+}
+
+void mark_parallel_arguments(Expression & ast, const Environment & env, double threshold){
+    mark(ast, ProcedureMap(), env, threshold);
+}
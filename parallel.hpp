@@ -0,0 +1,26 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+// module includes
+#include "expression.hpp"
+#include "environment.hpp"
+
+// the estimated cost, in nodes evaluated, above which an argument
+// is worth evaluating on the thread pool unless told otherwise
+const double default_parallel_threshold = 10000;
+
+// the estimated number of nodes evaluating exp visits: a loop, or a
+// procedure given to pmap, preduce or pfor, is taken to run many times,
+// a call to a known procedure to run its body, and recursion to be
+// unbounded
+double estimated_cost(const Expression & exp, const Environment & env);
+
+// mark the arguments of builtin and procedure calls to evaluate on the
+// thread pool: those of a call with at least two arguments costing more
+// than threshold and independent of each other, that is which define
+// nothing, assign no variable outside themselves, read no shared
+// subexpression slot and call only pure procedures. A builtin call
+// spreading its arguments is no longer evaluated unboxed.
+void mark_parallel_arguments(Expression & ast, const Environment & env, double threshold);
+
+#endif
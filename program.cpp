@@ -0,0 +1,181 @@
+#include "program.hpp"
+
+// system includes
+#include <sstream>
+
+// module includes
+#include "interpreter.hpp"
+#include "interpreter_semantic_error.hpp"
+
+// values and temporaries of machine code kept on the stack, more are allocated
+const std::size_t stack_doubles = 64;
+
+// whether exp, or the body of a lambda in it, defines anything
+static bool defines(const Expression & exp){
+    if (exp.op == DefineOp)
+        return true;
+    if (exp.op == LambdaOp && defines(exp.head.value.lambda_value->code->body))
+        return true;
+    for (auto & child: exp.tail) {
+        if (defines(child))
+            return true;
+    }
+    return false;
+}
+
+// whether exp, or the body of a lambda in it, reads a global env
+// does not hold, which nothing will ever define
+static bool unknown_global(const Expression & exp, const Environment & env){
+    if ((exp.op == VariableOp || (exp.op == ApplyOp && exp.depth < 0)) &&
+        env.findExpression(exp.head.value.sym_value) == nullptr)
+        return true;
+    if (exp.op == LambdaOp && unknown_global(exp.head.value.lambda_value->code->body, env))
+        return true;
+    for (auto & child: exp.tail) {
+        if (unknown_global(child, env))
+            return true;
+    }
+    return false;
+}
+
+// a copy of the body of a procedure with its parameters read as globals,
+// for machine code to take them with its values, loops counting the do
+// loops enclosing exp inside the body
+static Expression parameters_as_globals(const Expression & exp, int loops){
+    Expression copy = exp;
+    if ((exp.op == LocalOp || exp.op == ApplyOp) && exp.depth == loops) {
+        if (exp.op == LocalOp)
+            copy.op = VariableOp;
+        copy.depth = -1;
+        copy.index = -1;
+    }
+    for (std::size_t i = 0; i < exp.tail.size(); ++i) {
+        // a loop's initial values are outside its scope, the rest inside
+        bool inside = exp.op == DoOp && i >= std::size_t(exp.index);
+        copy.tail[i] = parameters_as_globals(exp.tail[i], inside ? loops + 1 : loops);
+    }
+    return copy;
+}
+
+Program::Program(const std::string & source, const std::vector<Symbol> & parameters){
+    Interpreter compiler;
+    std::istringstream iss(source);
+    TokenSequenceType body = tokenize(iss);
+
+    // source must be one complete expression, which becomes the body of
+    // a procedure taking the parameters
+    TokenSequenceType form = body;
+    Expression parsed;
+    compiler.scopes.push_back(parameters);
+    Error error = compiler.parse_form(form, parsed);
+    compiler.scopes.clear();
+    if (error == NoError && !form.empty())
+        error = SyntaxError;
+    if (error == NoError) {
+        TokenSequenceType tokens = {"(", "lambda", "("};
+        tokens.insert(tokens.end(), parameters.begin(), parameters.end());
+        tokens.push_back(")");
+        tokens.insert(tokens.end(), body.begin(), body.end());
+        tokens.push_back(")");
+        error = compiler.parse_form(tokens, parsed);
+        if (error == NoError && (!tokens.empty() || parsed.op != LambdaOp))
+            error = SyntaxError;
+    }
+    if (error != NoError)
+        throw InterpreterSemanticError(error_message(error));
+    if (defines(parsed))
+        throw InterpreterSemanticError(error_message(InvalidDefineError));
+    if (unknown_global(parsed, compiler.env))
+        throw InterpreterSemanticError(error_message(UnknownSymbolError));
+
+    compiler.source = parsed;
+    compiler.prepare();
+    Expression value;
+    error = compiler.run(value);
+    if (error != NoError)
+        throw InterpreterSemanticError(error_message(error));
+    procedure = value.head.value.lambda_value;
+
+    if (!jit_available())
+        return;
+    std::unique_ptr<JitProgram> compiled(new JitProgram());
+    if (!compiled->compile(parameters_as_globals(procedure->code->body, 0)))
+        return;
+    for (auto & name: compiled->globals()) {
+        std::size_t i = 0;
+        while (i < parameters.size() && parameters[i] != name) {
+            ++i;
+        }
+        // a constant is walked
+        if (i == parameters.size())
+            return;
+        jit_order.push_back(i);
+    }
+    jit_program.swap(compiled);
+}
+
+std::size_t Program::parameters() const{
+    return procedure->code->params.size();
+}
+
+bool Program::machineCode() const{
+    return jit_program != nullptr;
+}
+
+Expression Program::evaluate(const Expression * bindings) const{
+    if (!jit_program)
+        return walk(bindings);
+    for (std::size_t i = 0; i < parameters(); ++i) {
+        if (bindings[i].head.type != NumberType)
+            return walk(bindings);
+    }
+    return run(bindings, nullptr);
+}
+
+Expression Program::evaluate(const double * values) const{
+    if (!jit_program) {
+        std::vector<Expression> bindings(values, values + parameters());
+        return walk(bindings.data());
+    }
+    return run(nullptr, values);
+}
+
+// run the machine code with the numbers in values, or without them
+// those bound in bindings, keeping its temporaries on the stack
+Expression Program::run(const Expression * bindings, const double * values) const{
+    double buffer[stack_doubles];
+    std::vector<double> allocated;
+    std::size_t globals = jit_order.size();
+    double * ordered = buffer;
+    if (globals + jit_program->workspace() > stack_doubles) {
+        allocated.resize(globals + jit_program->workspace());
+        ordered = allocated.data();
+    }
+    for (std::size_t i = 0; i < globals; ++i) {
+        ordered[i] = values ? values[jit_order[i]] : bindings[jit_order[i]].head.value.num_value;
+    }
+    return Expression(jit_program->run(ordered, ordered + globals));
+}
+
+// apply the procedure on the tree walker of this thread, which
+// holds no bindings of its own
+Expression Program::walk(const Expression * bindings) const{
+    static thread_local Interpreter walker;
+    Expression result;
+    AccountScope scope(walker.account);
+    Error error;
+    try {
+        error = walker.apply_procedure(*procedure, bindings, result);
+    }
+    catch (const MemoryLimitExceeded &) {
+        error = MemoryLimitError;
+    }
+    catch (const BuiltinError & failure) {
+        error = failure.error;
+    }
+    if (error != NoError) {
+        walker.walk.values.clear();
+        throw InterpreterSemanticError(error_message(error));
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef PROGRAM_HPP
+#define PROGRAM_HPP
+
+// system includes
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "jit.hpp"
+
+// A Program is one expression compiled once in parameters declared up
+// front, then evaluated any number of times with values bound to them,
+// for embedding a formula run over many records. It reads no environment
+// and may define nothing, so it never changes once built and threads may
+// evaluate it at once. When every value bound is a number a numeric
+// program runs as machine code, anything else is tree walked.
+class Program {
+public:
+  // compile source in the named parameters, throwing
+  // InterpreterSemanticError if it does not parse or check, or defines
+  Program(const std::string & source, const std::vector<Symbol> & parameters);
+
+  std::size_t parameters() const;
+
+  // whether numbers bound are run as machine code
+  bool machineCode() const;
+
+  // the value with bindings[i] bound to parameter i, throwing
+  // InterpreterSemanticError for an error evaluating it
+  Expression evaluate(const Expression * bindings) const;
+  Expression evaluate(const double * values) const;
+private:
+  // evaluates the body over columns of values
+  friend class BatchProgram;
+
+  Expression run(const Expression * bindings, const double * values) const;
+  Expression walk(const Expression * bindings) const;
+
+  // the procedure taking the parameters whose body is the expression
+  std::shared_ptr<Lambda> procedure;
+
+  // the body compiled with its parameters read as globals, and for each
+  // global it reads the parameter it is
+  std::unique_ptr<JitProgram> jit_program;
+  std::vector<std::size_t> jit_order;
+};
+
+#endif
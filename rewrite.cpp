@@ -0,0 +1,244 @@
+#include "rewrite.hpp"
+
+// system includes
+#include <cmath>
+#include <map>
+#include <sstream>
+
+// module includes
+#include "tokenize.hpp"
+#include "environment.hpp"
+#include "optimizer.hpp"
+
+// Only rewrites giving bit-identical results are listed. (+ x 0) is not,
+// since -0 + 0 is 0, nor is regrouping (+ a (+ b c)), which changes rounding.
+// Flattening a nested call on the left is exact because the builtins fold
+// from 0 and 1, and the patterns keep both calls at a valid arity.
+static const RewriteRule rules[] = {
+    {"square",              "(pow ?x 2)",             "(* ?x ?x)",              SimpleNumberOperand},
+    {"reciprocal",          "(pow ?x -1)",            "(/ 1 ?x)",               AnyOperand},
+    {"power-one",           "(pow ?x 1)",             "?x",                     NumberOperand},
+    {"multiply-one",        "(* ?x 1)",               "?x",                     NumberOperand},
+    {"multiply-one",        "(* 1 ?x)",               "?x",                     NumberOperand},
+    {"multiply-minus-one",  "(* ?x -1)",              "(- ?x)",                 AnyOperand},
+    {"multiply-minus-one",  "(* -1 ?x)",              "(- ?x)",                 AnyOperand},
+    {"divide-one",          "(/ ?x 1)",               "?x",                     NumberOperand},
+    {"divide-minus-one",    "(/ ?x -1)",              "(- ?x)",                 AnyOperand},
+    {"subtract-zero",       "(- ?x 0)",               "?x",                     NumberOperand},
+    {"double-negation",     "(- (- ?x))",             "?x",                     NumberOperand},
+    {"double-not",          "(not (not ?x))",         "?x",                     BooleanOperand},
+    {"if-not",              "(if (not ?x) ?a ?b)",    "(if ?x ?b ?a)",          AnyOperand},
+    {"flatten-add",         "(+ (+ ?a ?as...) ?bs...)",
+                            "(+ ?a ?as... ?bs...)",                             AnyOperand},
+    {"flatten-multiply",    "(* (* ?a ?b ?as...) ?c ?bs...)",
+                            "(* ?a ?b ?as... ?c ?bs...)",                       AnyOperand},
+};
+
+// a rule with its pattern and replacement parsed
+struct CompiledRule {
+    const RewriteRule * rule;
+    Expression pattern;
+    Expression replacement;
+};
+
+// the expressions each pattern variable matched, one unless it is a splice
+typedef std::map<Symbol, std::vector<Expression>> Bindings;
+
+static bool is_variable(const Expression & exp){
+    return exp.op == VariableOp && exp.head.value.sym_value[0] == '?';
+}
+
+static bool is_splice(const Expression & exp){
+    const Symbol & name = exp.head.value.sym_value;
+    return is_variable(exp) && name.size() > 3 && name.compare(name.size() - 3, 3, "...") == 0;
+}
+
+// parse a pattern; it has no lambdas, so unlike build_ast no scopes
+static Expression parse_pattern(TokenSequenceType & tokens){
+    Atom atm;
+    if (tokens.front() != "(") {
+        token_to_atom(tokens.front(), atm);
+        tokens.pop_front();
+        Expression exp(atm);
+        if (atm.type == SymbolType)
+            exp.op = symbol_opcode(atm.value.sym_value);
+        return exp;
+    }
+    tokens.pop_front();
+    Expression exp = parse_pattern(tokens);
+    while (tokens.front() != ")") {
+        exp.tail.push_back(parse_pattern(tokens));
+    }
+    tokens.pop_front();
+    return exp;
+}
+
+static Expression parse_pattern(const char * source){
+    std::istringstream iss(source);
+    TokenSequenceType tokens = tokenize(iss);
+    return parse_pattern(tokens);
+}
+
+// the rule table, parsed on first use
+static const std::vector<CompiledRule> & compiled_rules(){
+    static const std::vector<CompiledRule> compiled = [](){
+        std::vector<CompiledRule> parsed;
+        for (auto & rule: rules) {
+            parsed.push_back({&rule, parse_pattern(rule.pattern), parse_pattern(rule.replacement)});
+        }
+        return parsed;
+    }();
+    return compiled;
+}
+
+// literals match exactly, so 0 does not match -0
+static bool same_literal(const Expression & a, const Expression & b){
+    if (!(a == b))
+        return false;
+    return a.head.type != NumberType ||
+           std::signbit(a.head.value.num_value) == std::signbit(b.head.value.num_value);
+}
+
+static bool same_tree(const Expression & a, const Expression & b){
+    if (a.op != b.op || a.depth != b.depth || a.index != b.index || !same_literal(a, b))
+        return false;
+    for (std::size_t i = 0; i < a.tail.size(); ++i) {
+        if (!same_tree(a.tail[i], b.tail[i]))
+            return false;
+    }
+    return true;
+}
+
+// bind a variable, or check it matches what it was bound to earlier
+static bool bind(const Symbol & name, const std::vector<Expression> & values, Bindings & bound){
+    auto it = bound.find(name);
+    if (it == bound.end()) {
+        bound[name] = values;
+        return true;
+    }
+    if (it->second.size() != values.size())
+        return false;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        if (!same_tree(it->second[i], values[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool match(const Expression & pattern, const Expression & exp, Bindings & bound){
+    if (is_variable(pattern))
+        return bind(pattern.head.value.sym_value, std::vector<Expression>(1, exp), bound);
+    if (pattern.op == LiteralOp)
+        return exp.op == LiteralOp && exp.tail.empty() && same_literal(pattern, exp);
+    if (pattern.op != exp.op)
+        return false;
+
+    for (std::size_t i = 0; i < pattern.tail.size(); ++i) {
+        const Expression & sub = pattern.tail[i];
+        if (is_splice(sub)) {
+            std::vector<Expression> rest(exp.tail.begin() + i, exp.tail.end());
+            return bind(sub.head.value.sym_value, rest, bound);
+        }
+        if (i >= exp.tail.size() || !match(sub, exp.tail[i], bound))
+            return false;
+    }
+    return exp.tail.size() == pattern.tail.size();
+}
+
+static Expression instantiate(const Expression & replacement, const Bindings & bound){
+    if (is_variable(replacement))
+        return bound.at(replacement.head.value.sym_value)[0];
+
+    Expression exp = replacement;
+    exp.tail.clear();
+    for (auto & sub: replacement.tail) {
+        if (is_splice(sub)) {
+            const std::vector<Expression> & rest = bound.at(sub.head.value.sym_value);
+            exp.tail.insert(exp.tail.end(), rest.begin(), rest.end());
+        }
+        else {
+            exp.tail.push_back(instantiate(sub, bound));
+        }
+    }
+    if (exp.op >= FirstBuiltinOp)
+        exp.verified = accepts_arguments(builtin_signature(exp.op), exp.tail.size());
+    return exp;
+}
+
+// whether exp can evaluate to a value of type, as far as its form shows
+static bool may_produce(const Expression & exp, Type type){
+    switch (exp.op) {
+    case LiteralOp:
+        return exp.head.type == type;
+    case VariableOp:
+    case LocalOp:
+    case ApplyOp:
+        return true;
+    case BeginOp:
+        return exp.tail.empty() ? type == NoneType : may_produce(exp.tail.back(), type);
+    case IfOp:
+        return exp.tail.size() == 3 && (may_produce(exp.tail[1], type) || may_produce(exp.tail[2], type));
+    case DefineOp:
+        return exp.tail.size() == 2 && may_produce(exp.tail[1], type);
+    case LambdaOp:
+        return type == LambdaType;
+    case DoOp:
+        return may_produce(exp.tail.at(2 * exp.index + 1), type);
+    case WhileOp:
+        return type == NoneType;
+    case SetOp:
+        return exp.tail.size() == 2 && may_produce(exp.tail[1], type);
+    case PmapOp:
+    case PforOp:
+        return type == ListType;
+    case PreduceOp:
+        return true;
+    case CachedOp:
+        return may_produce(exp.tail[0], type);
+    default: {
+        Type result = builtin_signature(exp.op).result;
+        return result == NoneType || type == result;
+    }
+    }
+}
+
+static bool guard_holds(Guard guard, const Bindings & bound){
+    if (guard == AnyOperand)
+        return true;
+    const Expression & x = bound.at("?x")[0];
+    switch (guard) {
+    case NumberOperand:
+        return may_produce(x, NumberType);
+    case BooleanOperand:
+        return may_produce(x, BooleanType);
+    case SimpleNumberOperand:
+        return (x.op == LiteralOp || x.op == VariableOp || x.op == LocalOp) && may_produce(x, NumberType);
+    default:
+        return true;
+    }
+}
+
+void simplify(Expression & exp, std::vector<std::string> * fired){
+    if (exp.op == LambdaOp) {
+        simplify(private_lambda_body(exp), fired);
+        return;
+    }
+
+    // the name a define binds is not itself evaluated
+    std::size_t first = (exp.op == DefineOp) ? 1 : 0;
+    for (std::size_t i = first; i < exp.tail.size(); ++i) {
+        simplify(exp.tail[i], fired);
+    }
+
+    for (auto & rule: compiled_rules()) {
+        Bindings bound;
+        if (match(rule.pattern, exp, bound) && guard_holds(rule.rule->guard, bound)) {
+            if (fired != nullptr)
+                fired->push_back(rule.rule->name);
+            exp = instantiate(rule.replacement, bound);
+            // the result may match again
+            simplify(exp, fired);
+            return;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef REWRITE_HPP
+#define REWRITE_HPP
+
+// system includes
+#include <string>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// A Guard restricts a RewriteRule to matches where the operand bound to ?x
+// can produce a value of the type the rule relies on, or is also cheap
+// enough to evaluate twice
+enum Guard {AnyOperand, NumberOperand, BooleanOperand, SimpleNumberOperand};
+
+// A RewriteRule replaces expressions matching pattern with replacement,
+// both written as slisp where ?name matches any one expression and
+// a trailing ?name... matches the rest of a call's arguments.
+// Every rule must leave the expression simpler, so rewriting terminates.
+struct RewriteRule {
+  const char * name;
+  const char * pattern;
+  const char * replacement;
+  Guard guard;
+};
+
+// rewrite exp in place with the simplification rules until none applies,
+// appending the name of each rule that fired to fired when it is given
+void simplify(Expression & exp, std::vector<std::string> * fired = nullptr);
+
+#endif
@@ -1,69 +1,101 @@
-#include <cstdlib>
-#include "argumentparser.hpp"
-#include "interpreter.hpp"
-#include "expression.hpp"
-#include "interpreter_semantic_error.hpp"
-
-#include <sstream>
-#include <fstream>
-
-//system includes
-#include <iostream>
-
-bool file_exists(std::string& fileName);
-
-int main(int argc, char **argv)
-{
-
-  ArgumentParser commandLine = ArgumentParser(argc, argv);
-  Interpreter interp;
-  Expression result;
-  bool ok;
-
-  if (commandLine.short_program()){
-      std::istringstream iss(commandLine.getProgram());
-      ok = interp.parse(iss);
-      if (!ok)
-          return EXIT_FAILURE;
-      result = interp.eval();
-      if (result.head.type == NoneType)
-          return EXIT_FAILURE;
-      return EXIT_SUCCESS;
-  }
-  else if (commandLine.file_present()){
-      std::string fileName = commandLine.getFilename();
-      if (file_exists(fileName)){
-          std::ifstream programFile;
-          programFile.open(fileName);
-          ok = interp.parse(programFile);
-          programFile.close();
-          if (!ok)
-              return EXIT_FAILURE;
-          result = interp.eval();
-          if (result.head.type == NoneType)
-              return EXIT_FAILURE;
-          return EXIT_SUCCESS;
-      }
-      else
-          std::cout << "Error: file does not exsist" << std::endl;
-          return EXIT_FAILURE;
-  }
-  else{
-    std::string interactive;
-    std::cout << "slisp> ";
-      while (getline(std::cin, interactive)){
-          std::istringstream isss(interactive);
-          ok = interp.parse(isss);
-          Expression result = interp.eval();
-          std::cout << "slisp> ";
-      }
-  }
-
-  return EXIT_FAILURE;
-}
-
-bool file_exists(std::string& fileName)
-{
-    std::ifstream exists(fileName.c_str());
-    return (bool)exists;
-}
+#include <cstdlib>
+#include "argumentparser.hpp"
+#include "interpreter.hpp"
+#include "expression.hpp"
+#include "interpreter_semantic_error.hpp"
+#include "threadpool.hpp"
+
+#include <sstream>
+#include <fstream>
+
+//system includes
+#include <iostream>
+
+bool file_exists(std::string& fileName);
+void print_rewrites(const Interpreter & interp);
+
+int main(int argc, char **argv)
+{
+
+  ArgumentParser commandLine = ArgumentParser(argc, argv);
+  Interpreter interp;
+  Expression result;
+  bool ok;
+
+  interp.setOptimization(commandLine.optimization_enabled());
+  interp.setJit(commandLine.jit_enabled());
+  interp.setParallel(commandLine.parallel_enabled());
+  // the thread running the program works alongside the pool's workers
+  if (commandLine.getThreads() > 0)
+      ThreadPool::setSharedWorkers(commandLine.getThreads() - 1);
+  bool showRewrites = commandLine.rewrites_shown();
+
+  std::string engine = commandLine.getEngine();
+  if (engine == "vm")
+      interp.setEngine(VirtualMachineEngine);
+  else if (engine == "closure")
+      interp.setEngine(ClosureEngine);
+  else if (!engine.empty() && engine != "tree"){
+      std::cout << "Error: unknown engine " << engine << std::endl;
+      return EXIT_FAILURE;
+  }
+
+  if (commandLine.short_program()){
+      std::istringstream iss(commandLine.getProgram());
+      ok = interp.parse(iss);
+      if (!ok)
+          return EXIT_FAILURE;
+      if (showRewrites)
+          print_rewrites(interp);
+      result = interp.eval();
+      if (result.head.type == NoneType)
+          return EXIT_FAILURE;
+      return EXIT_SUCCESS;
+  }
+  else if (commandLine.file_present()){
+      std::string fileName = commandLine.getFilename();
+      if (file_exists(fileName)){
+          std::ifstream programFile;
+          programFile.open(fileName);
+          ok = interp.parse(programFile);
+          programFile.close();
+          if (!ok)
+              return EXIT_FAILURE;
+          if (showRewrites)
+              print_rewrites(interp);
+          result = interp.eval();
+          if (result.head.type == NoneType)
+              return EXIT_FAILURE;
+          return EXIT_SUCCESS;
+      }
+      else
+          std::cout << "Error: file does not exsist" << std::endl;
+          return EXIT_FAILURE;
+  }
+  else{
+    std::string interactive;
+    std::cout << "slisp> ";
+      while (getline(std::cin, interactive)){
+          std::istringstream isss(interactive);
+          ok = interp.parse(isss);
+          if (ok && showRewrites)
+              print_rewrites(interp);
+          Expression result = interp.eval();
+          std::cout << "slisp> ";
+      }
+  }
+
+  return EXIT_FAILURE;
+}
+
+bool file_exists(std::string& fileName)
+{
+    std::ifstream exists(fileName.c_str());
+    return (bool)exists;
+}
+
+void print_rewrites(const Interpreter & interp)
+{
+    for (auto & name: interp.firedRewrites())
+        std::cout << "Rewrite: " << name << std::endl;
+}
@@ -0,0 +1,118 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+#include "interpreter_semantic_error.hpp"
+
+// whether two numbers are the same bit for bit
+static bool same_bits(double a, double b){
+  return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+TEST_CASE( "Test batches evaluated by kernels match each row", "[batch]" ) {
+
+  // rows spanning several blocks, the last one partial, with signed
+  // zeros, infinities and NaN
+  const std::size_t rows = 2 * batch_block + 37;
+  std::vector<double> x(rows), y(rows);
+  bool flags[rows];
+  const double specials[] = {0.0, -0.0, 1.0, -2.5, std::numeric_limits<double>::infinity(),
+                             std::numeric_limits<double>::quiet_NaN()};
+  for (std::size_t i = 0; i < rows; ++i) {
+    x[i] = (i % 7 == 0) ? specials[i % 6] : double(i % 100) / 8 - 5;
+    y[i] = (i % 11 == 0) ? specials[(i / 11) % 6] : double(i % 37) - 12;
+    flags[i] = (i % 3) != 0;
+  }
+  Column columns[] = {x.data(), y.data(), flags};
+  std::vector<Symbol> names = {"x", "y", "flag"};
+  std::vector<Type> types = {NumberType, NumberType, BooleanType};
+
+  std::vector<std::string> numeric = {
+    "(+ x y)", "(+ x)", "(+ x y 1.5 x)", "(- x)", "(- x y)", "(* x y 2)", "(*)", "(/ x y)",
+    "(pow x 2)", "(log10 (* x x))", "(if flag x y)", "(if (and flag (< x y)) (* x 2) (- y 1))",
+    "(if (or (not flag) (= x y) (>= x 3)) (+ x (* y y)) (/ x (+ y 0.5)))", "x", "3", "(* 2 pi)",
+    "(begin (+ x 1) (- y 2))", "(+ (* (+ x y) (+ x y)) (if (<= (+ x y) 0) (+ x y) 1))"};
+  for (auto source: numeric) {
+    INFO(source);
+    BatchProgram batch(source, names, types);
+    Program program(source, names);
+    REQUIRE(batch.vectorized());
+    REQUIRE(batch.resultType() == NumberType);
+    std::vector<double> results(rows);
+    batch.evaluate(columns, rows, results.data());
+    for (std::size_t i = 0; i < rows; ++i) {
+      Expression row[] = {Expression(x[i]), Expression(y[i]), Expression(flags[i])};
+      Expression expected = program.evaluate(row);
+      INFO(i);
+      REQUIRE(same_bits(results[i], expected.head.value.num_value));
+    }
+  }
+
+  std::vector<std::string> logical = {
+    "(< x y)", "(and flag (> x 0))", "(or flag (<= x y) (= x 0))", "(not flag)", "flag", "True",
+    "(if (< x 0) flag (not flag))", "(and flag)"};
+  for (auto source: logical) {
+    INFO(source);
+    BatchProgram batch(source, names, types);
+    Program program(source, names);
+    REQUIRE(batch.vectorized());
+    REQUIRE(batch.resultType() == BooleanType);
+    bool results[rows];
+    batch.evaluate(columns, rows, results);
+    for (std::size_t i = 0; i < rows; ++i) {
+      Expression row[] = {Expression(x[i]), Expression(y[i]), Expression(flags[i])};
+      INFO(i);
+      REQUIRE(Expression(results[i]) == program.evaluate(row));
+    }
+  }
+
+  // no rows at all
+  BatchProgram empty("(+ x y)", names, types);
+  empty.evaluate(columns, 0, static_cast<double *>(nullptr));
+}
+
+TEST_CASE( "Test batches evaluated one row at a time", "[batch]" ) {
+
+  double x[] = {1, 2, 3, 4};
+  bool flags[] = {true, false, true, false};
+  Column columns[] = {x, flags};
+  std::vector<Symbol> names = {"x", "flag"};
+  std::vector<Type> types = {NumberType, BooleanType};
+
+  // lists and procedures have no kernels
+  BatchProgram listed("(length (range x))", names, types);
+  REQUIRE_FALSE(listed.vectorized());
+  double lengths[4];
+  listed.evaluate(columns, 4, lengths);
+  REQUIRE(lengths[3] == 4.);
+
+  // nor does an expression whose type depends on the row, nor a type
+  // error only some rows reach
+  BatchProgram mixed("(if flag x flag)", names, types);
+  REQUIRE_FALSE(mixed.vectorized());
+  REQUIRE(mixed.resultType() == NoneType);
+  double numbers[4];
+  REQUIRE_THROWS_WITH(mixed.evaluate(columns, 4, numbers), "Error: invalid argument type");
+  REQUIRE(numbers[0] == 1.);
+  BatchProgram guarded("(if (< x 10) x (+ flag 1))", names, types);
+  REQUIRE_FALSE(guarded.vectorized());
+  guarded.evaluate(columns, 4, numbers);
+  REQUIRE(numbers[2] == 3.);
+  BatchProgram failing("(if (< x 3) x (+ flag 1))", names, types);
+  REQUIRE_THROWS_WITH(failing.evaluate(columns, 4, numbers), "Error: invalid argument type");
+
+  // columns and results must have the types compiled for
+  BatchProgram sum("(+ x 1)", names, types);
+  bool booleans[4];
+  REQUIRE_THROWS_WITH(sum.evaluate(columns, 4, booleans), "Error: invalid argument type");
+  Column swapped[] = {flags, x};
+  REQUIRE_THROWS_WITH(sum.evaluate(swapped, 4, numbers), "Error: invalid argument type");
+  REQUIRE_THROWS_WITH(BatchProgram("x", names, {NumberType}), "Error: invalid number of arguments");
+  REQUIRE_THROWS_WITH(BatchProgram("x", names, {NumberType, ListType}), "Error: invalid argument type");
+  REQUIRE_THROWS_WITH(BatchProgram("(+ x", names, types), "Error: invalid syntax");
+}
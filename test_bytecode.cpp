@@ -0,0 +1,113 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+
+#include "bytecode.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "checker.hpp"
+
+Expression parse_ast(const std::string & program){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  return interp.build_ast(tokens);
+}
+
+Chunk compiled_chunk(const Expression & ast){
+  Chunk chunk;
+  REQUIRE(compile_chunk(ast, chunk) == NoError);
+  return chunk;
+}
+
+// the value of a chunk run by vm, or None if it failed
+Expression run_chunk(VirtualMachine & vm, const Chunk & chunk, Environment & env, Error & error){
+  Expression result;
+  error = vm.run(chunk, env, result);
+  return result;
+}
+
+TEST_CASE( "Test bytecode compiler output", "[bytecode]" ) {
+
+  { // builtin call with literal arguments
+    Chunk chunk = compiled_chunk(parse_ast("(+ 1 2)"));
+    std::vector<int> expected = {ConstCode, 0, ConstCode, 1, CallCode, AddOp, 2, ReturnCode};
+    REQUIRE(chunk.code == expected);
+    REQUIRE(chunk.constants.size() == 2);
+  }
+
+  { // globals share one name slot
+    Chunk chunk = compiled_chunk(parse_ast("(* pi pi)"));
+    std::vector<int> expected = {GlobalCode, 0, GlobalCode, 0, CallCode, MulOp, 2, ReturnCode};
+    REQUIRE(chunk.code == expected);
+    REQUIRE(chunk.names.size() == 1);
+  }
+
+  { // if jumps over the branch not taken
+    Chunk chunk = compiled_chunk(parse_ast("(if True 1 2)"));
+    std::vector<int> expected = {ConstCode, 0, JumpIfFalseCode, 8, ConstCode, 1, JumpCode, 10,
+                                 ConstCode, 2, ReturnCode};
+    REQUIRE(chunk.code == expected);
+  }
+
+  { // or jumps out at the first true operand
+    Chunk chunk = compiled_chunk(parse_ast("(or a b)"));
+    std::vector<int> expected = {GlobalCode, 0, JumpIfTrueCode, 12, GlobalCode, 1, JumpIfTrueCode, 12,
+                                 ConstCode, 0, JumpCode, 14, ConstCode, 1, ReturnCode};
+    REQUIRE(chunk.code == expected);
+    REQUIRE(chunk.constants[0].value.bool_value == false);
+  }
+
+  { // calls the checker verified skip their arity check
+    Expression ast = parse_ast("(+ 1 2)");
+    check_program(ast, Environment());
+    std::vector<int> expected = {ConstCode, 0, ConstCode, 1, UncheckedCode, AddOp, 2, ReturnCode};
+    REQUIRE(compiled_chunk(ast).code == expected);
+  }
+
+  { // malformed special forms are rejected
+    Chunk chunk;
+    REQUIRE(compile_chunk(parse_ast("(if True 1)"), chunk) == InvalidIfError);
+    REQUIRE(compile_chunk(parse_ast("(define a)"), chunk) == InvalidDefineError);
+    REQUIRE(compile_chunk(parse_ast("(lambda (x) x)"), chunk) == UnsupportedProcedureError);
+    REQUIRE(chunk.code.empty());
+  }
+}
+
+TEST_CASE( "Test virtual machine execution", "[bytecode]" ) {
+
+  VirtualMachine vm;
+  Environment env;
+  Error error;
+
+  REQUIRE(run_chunk(vm, compiled_chunk(parse_ast("(begin (define r 10) (* r r))")), env, error) == Expression(100.));
+  REQUIRE(run_chunk(vm, compiled_chunk(parse_ast("(if (< r 5) (r) (- r))")), env, error) == Expression(-10.));
+  REQUIRE(run_chunk(vm, compiled_chunk(parse_ast("(begin)")), env, error) == Expression());
+  REQUIRE(error == NoError);
+
+  // errors match the tree walker, clearing the environment
+  run_chunk(vm, compiled_chunk(parse_ast("(define r 1)")), env, error);
+  REQUIRE(error == RedefinitionError);
+  run_chunk(vm, compiled_chunk(parse_ast("(r)")), env, error);
+  REQUIRE(error == UnknownSymbolError);
+  run_chunk(vm, compiled_chunk(parse_ast("(not True False)")), env, error);
+  REQUIRE(error == ArgumentCountError);
+}
+
+TEST_CASE( "Test virtual machine shared subexpressions", "[bytecode]" ) {
+
+  Expression ast = parse_ast("(+ (* a a) (- (* a a)) (* a a))");
+  share_common_subexpressions(ast);
+  Chunk chunk = compiled_chunk(ast);
+  REQUIRE(chunk.cache_slots == 1);
+
+  // the cache is filled afresh on every run
+  VirtualMachine vm;
+  Environment two, three;
+  two.addExpression("a", Expression(2.));
+  three.addExpression("a", Expression(3.));
+  Error error;
+  REQUIRE(run_chunk(vm, chunk, two, error) == Expression(4.));
+  REQUIRE(run_chunk(vm, chunk, three, error) == Expression(9.));
+}
@@ -0,0 +1,126 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "checker.hpp"
+
+Expression checked_ast(const std::string & program, const Environment & env, Error & error){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  error = check_program(ast, env);
+  return ast;
+}
+
+TEST_CASE( "Test checker rejects arity and type errors", "[checker]" ) {
+
+  Environment env;
+  env.addExpression("flag", Expression(true));
+
+  std::vector<std::string> invalid = {
+    // arity
+    "(+)", "(- 1 2 3)", "(* 2)", "(not True False)", "(< 1)", "(pow 2)",
+    // types of literals, builtin results and defined constants
+    "(+ True 1)", "(not 1)", "(and (< 1 2) 3)", "(if 1 2 3)", "(+ flag 1)",
+    "(begin (define b (< 1 2)) (* b 2))", "(+ (lambda (x) x) 1)",
+    // malformed special forms
+    "(if True 1)", "(define a)", "(define 1 2)",
+    // wherever they appear
+    "(if True 1 (+))", "(lambda (x) (log10 x 2))", "(f (not 1))",
+    // lists, and the procedures applied to them
+    "(range (list 1))", "(+ (list 1) 2)", "(pmap 1 (list 2))", "(pmap (lambda (x) x) 2)",
+    "(pfor (lambda (x) x) 0 (list))", "(preduce (lambda (a b) a) 0)", "(length 1)", "(length (list) (list))",
+    "(append (list) 2)", "(nth (list))", "(+ (slice (list) 0) 1)"};
+  for (auto program: invalid) {
+    INFO(program);
+    Error error;
+    checked_ast(program, env, error);
+    REQUIRE(error != NoError);
+  }
+
+  // the error found is reported
+  Error error;
+  checked_ast("(- 1 2 3)", env, error);
+  REQUIRE(error == ArgumentCountError);
+  checked_ast("(+ flag 1)", env, error);
+  REQUIRE(error == ArgumentTypeError);
+  checked_ast("(if 1 2 3)", env, error);
+  REQUIRE(error == ConditionTypeError);
+  checked_ast("(define a)", env, error);
+  REQUIRE(error == InvalidDefineError);
+}
+
+TEST_CASE( "Test checker accepts what it cannot prove wrong", "[checker]" ) {
+
+  Environment env;
+
+  std::vector<std::string> valid = {
+    "(*)", "(* 1 2 3)", "(+ x 1)", "(lambda (x) (+ x 1))", "(if c 1 True)",
+    "(begin (define (f x) x) (+ (f 1) 2))", "(begin (if c (define b True) (define b 1)) (+ b 1))",
+    "(list 1 True (list))", "(pmap f xs)", "(preduce f (list) (list))", "(pfor f a b)",
+    "(+ (nth xs 0) 1)", "(not (nth xs 0))", "(slice xs 1 2)", "(append xs (slice xs 1))"};
+  Error error;
+  for (auto program: valid) {
+    INFO(program);
+    checked_ast(program, env, error);
+    REQUIRE(error == NoError);
+  }
+
+  // calls that pass are verified, in procedure bodies too
+  Expression ast = checked_ast("(begin (define (f x) (+ x 1)) (< (f 1) 3))", env, error);
+  REQUIRE(ast.tail[1].verified);
+  REQUIRE(ast.tail[0].tail[1].head.value.lambda_value->code->body.verified);
+
+  // lambdas are marked pure unless they read variables they capture
+  ast = checked_ast("(lambda (x) (lambda (y) (* x y)))", env, error);
+  REQUIRE(ast.head.value.lambda_value->code->pure == false);
+  const Expression & inner = ast.head.value.lambda_value->code->body;
+  REQUIRE(inner.head.value.lambda_value->code->pure == false);
+  ast = checked_ast("(pmap (lambda (x) (* x x)) xs)", env, error);
+  REQUIRE(ast.tail[0].head.value.lambda_value->code->pure);
+}
+
+TEST_CASE( "Test checker records proven types", "[checker]" ) {
+
+  Environment env;
+  Error error;
+
+  { // builtin results and literals are proven, parameters are not
+    Expression ast = checked_ast("(lambda (x) (< (+ x 1) 2))", env, error);
+    Expression & body = ast.head.value.lambda_value->code->body;
+    REQUIRE(body.proven == BooleanType);
+    REQUIRE(body.tail[0].proven == NumberType);
+    REQUIRE(body.tail[0].tail[0].proven == NoneType);
+    REQUIRE(body.tail[1].proven == NumberType);
+  }
+
+  { // an if whose branches agree, and globals holding a value
+    Expression ast = checked_ast("(begin (define r 2) (if c (* r r) pi))", env, error);
+    REQUIRE(ast.proven == NoneType);
+    REQUIRE(ast.tail[1].proven == NumberType);
+    REQUIRE(ast.tail[1].tail[0].proven == NoneType);
+    REQUIRE(ast.tail[1].tail[1].tail[0].proven == NumberType);
+    REQUIRE(checked_ast("(if c 1 True)", env, error).proven == NoneType);
+  }
+}
+
+TEST_CASE( "Test checker errors are reported before anything runs", "[checker]" ) {
+
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    Interpreter interp;
+    interp.setEngine(engine);
+
+    std::istringstream first("(begin (define a 1) (if (< a 2) a (+ a True)))");
+    REQUIRE(interp.parse(first));
+    REQUIRE(interp.eval() == Expression());
+
+    // a was never defined
+    std::istringstream second("(begin (define a 2) a)");
+    REQUIRE(interp.parse(second));
+    REQUIRE(interp.eval() == Expression(2.));
+  }
+}
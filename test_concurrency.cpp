@@ -0,0 +1,104 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "interpreter.hpp"
+
+// a program exercising definitions, procedures, memoization, loops,
+// lists and the thread pool, and what it evaluates to
+static const char * shared_program =
+  "(begin (define k 3) (define-memo (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+  " (define (scale x) (* k x))"
+  " (define xs (pmap scale (range 100)))"
+  " (+ (fib 25) (preduce (lambda (a b) (+ a b)) 0 (slice xs 10))"
+  " (length (append xs xs)) (do ((i 0 (+ i 1)) (s 0 (+ s (nth xs i)))) ((= i 100) s)) pi))";
+
+static double shared_result(){
+  return 75025 + 3 * (4950 - 45) + 200 + 3 * 4950 + std::atan2(0, -1);
+}
+
+// evaluate program in a fresh interpreter on engine, returning its result
+static Expression evaluate_program(const std::string & program, Engine engine){
+  std::ostringstream printed;
+  Interpreter interp;
+  interp.setEngine(engine);
+  interp.setOutput(printed);
+  std::istringstream iss(program);
+  if (!interp.parse(iss))
+    return Expression();
+  return interp.eval();
+}
+
+TEST_CASE( "Test interpreters on 64 threads evaluate independently", "[concurrency]" ) {
+
+  const int thread_count = 64;
+  std::vector<Expression> results(thread_count);
+  std::vector<Expression> bounded(thread_count);
+  std::vector<Expression> numeric(thread_count);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < thread_count; ++t) {
+    threads.push_back(std::thread([&, t]{
+      const Engine engines[] = {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine};
+      Engine engine = engines[t % 3];
+      results[t] = evaluate_program(shared_program, engine);
+
+      // definitions in one interpreter are not seen by the others
+      std::string own = "(begin (define v" + std::to_string(t) + " " + std::to_string(t) + ")"
+                        " (define (f x) (+ x v" + std::to_string(t) + ")) (f 1000))";
+      numeric[t] = evaluate_program(own, engine);
+
+      // limits and their errors are per interpreter too
+      std::ostringstream printed;
+      Interpreter limited;
+      limited.setOutput(printed);
+      limited.setStepLimit(t % 2 ? 1000 : 0);
+      limited.setMemoryLimit(t % 2 ? 0 : 64 * 1024);
+      std::istringstream iss("(begin (define (spin n) (if (< n 0) 0 (spin (+ n 1)))) (spin (length (range 1e5))))");
+      limited.parse(iss);
+      bounded[t] = limited.eval();
+    }));
+  }
+  for (auto & thread: threads) {
+    thread.join();
+  }
+  for (int t = 0; t < thread_count; ++t) {
+    INFO(t);
+    REQUIRE(results[t] == Expression(shared_result()));
+    REQUIRE(numeric[t] == Expression(1000. + t));
+    REQUIRE(bounded[t] == Expression());
+  }
+}
+
+TEST_CASE( "Test interpreters share the builtin table", "[concurrency]" ) {
+
+  // every thread resolves the same builtins while others define names
+  const int thread_count = 16;
+  std::vector<int> mismatches(thread_count, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.push_back(std::thread([&, t]{
+      Environment env;
+      for (int i = 0; i < 200; ++i) {
+        if (symbol_opcode("+") != AddOp || symbol_opcode("nth") != NthOp || symbol_opcode("x") != VariableOp)
+          ++mismatches[t];
+        env.addExpression("x" + std::to_string(i), Expression(double(t)));
+        const Expression * pi = env.findExpression("pi");
+        if (pi == nullptr || !env.keyPresent("pmap") || env.keyPresent("y"))
+          ++mismatches[t];
+        if (i % 50 == 0)
+          env.clear();
+      }
+    }));
+  }
+  for (auto & thread: threads) {
+    thread.join();
+  }
+  for (int t = 0; t < thread_count; ++t) {
+    REQUIRE(mismatches[t] == 0);
+  }
+}
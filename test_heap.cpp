@@ -0,0 +1,101 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "heap.hpp"
+#include "interpreter.hpp"
+
+TEST_CASE( "Test the list heap bumps, reuses and frees blocks", "[heap]" ) {
+
+  ListHeap heap;
+  void * a = heap.allocate(24);
+  void * b = heap.allocate(24);
+  REQUIRE(a != b);
+  REQUIRE(heap.stats().reserved > 0);
+  std::memset(a, 1, 24);
+  std::memset(b, 2, 24);
+
+  // a freed block is reused by its size class only
+  heap.deallocate(a, 24);
+  void * other = heap.allocate(1000);
+  REQUIRE(other != a);
+  REQUIRE(heap.allocate(30) == a);
+
+  // blocks too large for a class come from the system
+  void * large = heap.allocate(1 << 20);
+  std::memset(large, 3, 1 << 20);
+  heap.deallocate(large, 1 << 20);
+
+  HeapStats stats = heap.stats();
+  REQUIRE(stats.allocations == 5);
+  REQUIRE(stats.reused == 1);
+  REQUIRE(stats.freed == 2);
+  REQUIRE(stats.large == 1);
+
+  // every size up to the largest class gets a block of its own
+  std::vector<void *> blocks;
+  for (std::size_t bytes = 1; bytes <= 64 * 1024; bytes += 97) {
+    char * block = static_cast<char *>(heap.allocate(bytes));
+    std::memset(block, 4, bytes);
+    blocks.push_back(block);
+  }
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    heap.deallocate(blocks[i], 1 + 97 * i);
+  }
+}
+
+TEST_CASE( "Test the list heap is shared between threads", "[heap]" ) {
+
+  ListHeap heap;
+  std::atomic<int> overwritten(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.push_back(std::thread([&heap, &overwritten, t]{
+      std::vector<char *> held;
+      for (int i = 0; i < 64 * 300; ++i) {
+        std::size_t bytes = 16 + (i % 50) * 8;
+        char * block = static_cast<char *>(heap.allocate(bytes));
+        block[0] = char(t);
+        held.push_back(block);
+        if (held.size() == 64) {
+          for (std::size_t k = 0; k < held.size(); ++k) {
+            if (held[k][0] != char(t))
+              ++overwritten;
+            heap.deallocate(held[k], 16 + ((i - 63 + k) % 50) * 8);
+          }
+          held.clear();
+        }
+      }
+    }));
+  }
+  for (auto & thread: threads) {
+    thread.join();
+  }
+  REQUIRE(overwritten == 0);
+  HeapStats stats = heap.stats();
+  REQUIRE(stats.allocations == 4 * 64 * 300);
+  REQUIRE(stats.freed == 4 * 64 * 300);
+  REQUIRE(stats.reused > 0);
+}
+
+TEST_CASE( "Test interpreters build lists on their heap", "[heap]" ) {
+
+  Interpreter interp;
+  std::istringstream program("(do ((i 0 (+ i 1)) (xs (list) (list i i i))) ((= i 1000) xs))");
+  REQUIRE(interp.parse(program));
+  Expression last = interp.eval();
+  REQUIRE(last.head.type == ListType);
+  REQUIRE(last.head.value.list_value->size() == 3);
+
+  // each list dropped is given back, and its blocks reused
+  HeapStats stats = interp.heapStats();
+  REQUIRE(stats.allocations >= 2000);
+  REQUIRE(stats.reused >= stats.allocations - 10);
+  REQUIRE(stats.freed >= stats.allocations - 10);
+  REQUIRE(stats.reserved <= 1024 * 1024);
+}
@@ -1,361 +1,859 @@
-#include "catch.hpp"
-
-#include <string>
-#include <sstream>
-#include <fstream>
-#include <iostream>
-
-#include "interpreter_semantic_error.hpp"
-#include "interpreter.hpp"
-#include "expression.hpp"
-#include "test_config.hpp"
-
-Expression run(const std::string & program){
-
-  std::istringstream iss(program);
-
-  Interpreter interp;
-
-  bool ok = interp.parse(iss);
-  if(!ok){
-    std::cerr << "Failed to parse: " << program << std::endl;
-  }
-  REQUIRE(ok == true);
-
-  Expression result;
-  REQUIRE_NOTHROW(result = interp.eval());
-
-  return result;
-}
-
-TEST_CASE( "Test Interpreter parser with numerical literals", "[interpreter]" ) {
-
-  std::vector<std::string> programs = {"(1)", "(+1)", "(+1e+0)", "(1e-0)"};
-
-  for(auto program : programs){
-    std::istringstream iss(program);
-
-    Interpreter interp;
-
-    bool ok = interp.parse(iss);
-
-    REQUIRE(ok == true);
-  }
-}
-
-TEST_CASE( "Test Interpreter parser with expected input", "[interpreter]" ) {
-
-  std::string program = "(begin (define r 10) (* pi (* r r)))";
-
-  std::istringstream iss(program);
-
-  Interpreter interp;
-
-  bool ok = interp.parse(iss);
-
-  REQUIRE(ok == true);
-}
-
-TEST_CASE( "Test Interpreter parser with faulted input", "[interpreter]" ) {
-
-  std::string program = ")(begin (define r 10) (* pi (* r r)))";
-
-  std::istringstream iss(program);
-
-  Interpreter interp;
-
-  bool ok = interp.parse(iss);
-
-  REQUIRE(ok == false);
-}
-
-TEST_CASE( "Test Interpreter parser with a commented input", "[interpreter]" ) {
-
-  std::string program = "(begin (define r 10) (* pi (* r r))) ; not included";
-
-  std::istringstream iss(program);
-
-  Interpreter interp;
-
-  bool ok = interp.parse(iss);
-
-  REQUIRE(ok == true);
-}
-
-TEST_CASE( "Test Interpreter result with literal expressions", "[interpreter]" ) {
-
-  { // Boolean True
-    std::string program = "(True)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  { // Boolean False
-    std::string program = "(False)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  { // Number
-    std::string program = "(4)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(4.));
-  }
-
-  { // Symbol
-    std::string program = "(pi)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(atan2(0, -1))); //failed here
-  }
-
-}
-
-TEST_CASE( "Test Interpreter result with simple procedures (add)", "[interpreter]" ) {
-
-  { // add, binary case
-    std::string program = "(+ 1 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(3.));
-  }
-
-  { // add, 3-ary case
-    std::string program = "(+ 1 2 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(6.));
-  }
-
-  { // add, 6-ary case
-    std::string program = "(+ 1 2 3 4 5 6)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(21.));
-  }
-}
-
-TEST_CASE( "Test Interpreter special form: if", "[interpreter]" ) {
-
-  {
-    std::string program = "(if True (4) (-4))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(4.));
-  }
-
-  {
-    std::string program = "(if False (4) (-4))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(-4.));
-  }
-}
-
-TEST_CASE( "Test Interpreter special forms: begin and define", "[interpreter]" ) {
-
-  {
-    std::string program = "(define answer 42)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(42.));
-  }
-
-  {
-    std::string program = "(begin (define answer 42)\n(answer))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(42.));
-  }
-
-  {
-    std::string program = "(begin (define answer (+ 9 11)) (answer))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(20.));
-  }
-
-  {
-    std::string program = "(begin (define a 1) (define b 1) (+ a b))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(2.));
-  }
-}
-
-TEST_CASE( "Test a complex expression", "[interpreter]" ) {
-
-  {
-    std::string program = "(+ (+ 10 1) (+ 30 (+ 1 1)))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(43.));
-  }
-}
-
-TEST_CASE( "Test Interpreter for all procedures", "[interpreter]" ) {
-
-  {
-    std::string program = "(not True)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(not False)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(and True False (not True))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(and True True (not False))";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(or True False)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(or False False False)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(< 2 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(< 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(<= 3 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(<= 2 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(<= 4 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(>= 3 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(>= 2 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(>= 4 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(> 2 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(> 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(= 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(false));
-  }
-
-  {
-    std::string program = "(= 3 3)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(true));
-  }
-
-  {
-    std::string program = "(+ 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(5.));
-  }
-
-  {
-    std::string program = "(+ 9.1 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(14.1));
-  }
-
-  {
-    std::string program = "(- 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(-2.));
-  }
-
-  {
-    std::string program = "(- 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(1.));
-  }
-
-  {
-    std::string program = "(* 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(6.));
-  }
-
-  {
-    std::string program = "(* 3 2 4 5)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(120.));
-  }
-
-  {
-    std::string program = "(/ 1 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(0.5));
-  }
-
-  {
-    std::string program = "(/ 10 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(5.));
-  }
-
-  {
-    std::string program = "(log10 1000000)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(6.));
-  }
-
-  {
-    std::string program = "(pow 3 2)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(9.));
-  }
-
-  {
-    std::string program = "(pow 4 0.5)";
-    Expression result = run(program);
-    REQUIRE(result == Expression(2.));
-  }
-
-}
+#include "catch.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#include "interpreter_semantic_error.hpp"
+#include "interpreter.hpp"
+#include "expression.hpp"
+#include "test_config.hpp"
+
+Expression run_engine(const std::string & program, Engine engine, bool optimize, bool jit = false){
+
+  std::istringstream iss(program);
+
+  Interpreter interp;
+  interp.setEngine(engine);
+  interp.setOptimization(optimize);
+  interp.setJit(jit);
+
+  bool ok = interp.parse(iss);
+  if(!ok){
+    std::cerr << "Failed to parse: " << program << std::endl;
+  }
+  REQUIRE(ok == true);
+
+  Expression result;
+  REQUIRE_NOTHROW(result = interp.eval());
+
+  return result;
+}
+
+// run a program on every engine with and without optimization, and
+// compiled to machine code, requiring they agree with the plain tree walker
+Expression run(const std::string & program){
+
+  Expression result = run_engine(program, TreeWalkerEngine, false);
+  REQUIRE(run_engine(program, TreeWalkerEngine, true) == result);
+  REQUIRE(run_engine(program, VirtualMachineEngine, false) == result);
+  REQUIRE(run_engine(program, VirtualMachineEngine, true) == result);
+  REQUIRE(run_engine(program, ClosureEngine, true) == result);
+  REQUIRE(run_engine(program, TreeWalkerEngine, false, true) == result);
+
+  return result;
+}
+
+TEST_CASE( "Test Interpreter parser with numerical literals", "[interpreter]" ) {
+
+  std::vector<std::string> programs = {"(1)", "(+1)", "(+1e+0)", "(1e-0)"};
+
+  for(auto program : programs){
+    std::istringstream iss(program);
+
+    Interpreter interp;
+
+    bool ok = interp.parse(iss);
+
+    REQUIRE(ok == true);
+  }
+}
+
+TEST_CASE( "Test Interpreter parser with expected input", "[interpreter]" ) {
+
+  std::string program = "(begin (define r 10) (* pi (* r r)))";
+
+  std::istringstream iss(program);
+
+  Interpreter interp;
+
+  bool ok = interp.parse(iss);
+
+  REQUIRE(ok == true);
+}
+
+TEST_CASE( "Test Interpreter parser with faulted input", "[interpreter]" ) {
+
+  std::string program = ")(begin (define r 10) (* pi (* r r)))";
+
+  std::istringstream iss(program);
+
+  Interpreter interp;
+
+  bool ok = interp.parse(iss);
+
+  REQUIRE(ok == false);
+}
+
+TEST_CASE( "Test Interpreter parser with a commented input", "[interpreter]" ) {
+
+  std::string program = "(begin (define r 10) (* pi (* r r))) ; not included";
+
+  std::istringstream iss(program);
+
+  Interpreter interp;
+
+  bool ok = interp.parse(iss);
+
+  REQUIRE(ok == true);
+}
+
+TEST_CASE( "Test Interpreter result with literal expressions", "[interpreter]" ) {
+
+  { // Boolean True
+    std::string program = "(True)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  { // Boolean False
+    std::string program = "(False)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  { // Number
+    std::string program = "(4)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(4.));
+  }
+
+  { // Symbol
+    std::string program = "(pi)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(atan2(0, -1))); //failed here
+  }
+
+}
+
+TEST_CASE( "Test Interpreter result with simple procedures (add)", "[interpreter]" ) {
+
+  { // add, binary case
+    std::string program = "(+ 1 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(3.));
+  }
+
+  { // add, 3-ary case
+    std::string program = "(+ 1 2 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(6.));
+  }
+
+  { // add, 6-ary case
+    std::string program = "(+ 1 2 3 4 5 6)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(21.));
+  }
+}
+
+TEST_CASE( "Test Interpreter special form: if", "[interpreter]" ) {
+
+  {
+    std::string program = "(if True (4) (-4))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(4.));
+  }
+
+  {
+    std::string program = "(if False (4) (-4))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(-4.));
+  }
+}
+
+TEST_CASE( "Test Interpreter special forms: and, or", "[interpreter]" ) {
+
+  REQUIRE(run("(and True (< 1 2))") == Expression(true));
+  REQUIRE(run("(or False False)") == Expression(false));
+
+  // operands after the one deciding the result are not evaluated
+  REQUIRE(run("(and False undefined)") == Expression(false));
+  REQUIRE(run("(or True undefined)") == Expression(true));
+  REQUIRE(run("(and True (< 1 2) False undefined)") == Expression(false));
+  REQUIRE(run("(begin (and False (define z True)) (or True (define z True)) (define z 3))") == Expression(3.));
+  REQUIRE(run("(begin (define (safe n) (or (= n 0) (< (/ 1 n) 1))) (and (safe 0) (safe 2)))") == Expression(true));
+
+  // evaluated operands still raise errors, as does an empty form
+  REQUIRE(run("(and True undefined)") == Expression());
+  REQUIRE(run("(or)") == Expression());
+}
+
+TEST_CASE( "Test Interpreter special forms: begin and define", "[interpreter]" ) {
+
+  {
+    std::string program = "(define answer 42)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(42.));
+  }
+
+  {
+    std::string program = "(begin (define answer 42)\n(answer))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(42.));
+  }
+
+  {
+    std::string program = "(begin (define answer (+ 9 11)) (answer))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(20.));
+  }
+
+  {
+    std::string program = "(begin (define a 1) (define b 1) (+ a b))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(2.));
+  }
+}
+
+TEST_CASE( "Test a complex expression", "[interpreter]" ) {
+
+  {
+    std::string program = "(+ (+ 10 1) (+ 30 (+ 1 1)))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(43.));
+  }
+}
+
+TEST_CASE( "Test Interpreter for all procedures", "[interpreter]" ) {
+
+  {
+    std::string program = "(not True)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(not False)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(and True False (not True))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(and True True (not False))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(or True False)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(or False False False)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(< 2 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(< 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(<= 3 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(<= 2 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(<= 4 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(>= 3 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(>= 2 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(>= 4 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(> 2 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(> 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(= 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(false));
+  }
+
+  {
+    std::string program = "(= 3 3)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(true));
+  }
+
+  {
+    std::string program = "(+ 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(5.));
+  }
+
+  {
+    std::string program = "(+ 9.1 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(14.1));
+  }
+
+  {
+    std::string program = "(- 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(-2.));
+  }
+
+  {
+    std::string program = "(- 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(1.));
+  }
+
+  {
+    std::string program = "(* 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(6.));
+  }
+
+  {
+    std::string program = "(* 3 2 4 5)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(120.));
+  }
+
+  {
+    std::string program = "(/ 1 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(0.5));
+  }
+
+  {
+    std::string program = "(/ 10 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(5.));
+  }
+
+  {
+    std::string program = "(log10 1000000)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(6.));
+  }
+
+  {
+    std::string program = "(pow 3 2)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(9.));
+  }
+
+  {
+    std::string program = "(pow 4 0.5)";
+    Expression result = run(program);
+    REQUIRE(result == Expression(2.));
+  }
+
+}
+
+TEST_CASE( "Test Interpreter parser resolves opcodes", "[interpreter]" ) {
+
+  std::string program = "(begin (define r 10) (if (< r 11) (* pi r) (- r)))";
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+
+  REQUIRE(ast.op == BeginOp);
+  REQUIRE(ast.tail[0].op == DefineOp);
+  REQUIRE(ast.tail[0].tail[0].op == VariableOp);
+  REQUIRE(ast.tail[0].tail[1].op == LiteralOp);
+  REQUIRE(ast.tail[1].op == IfOp);
+  REQUIRE(ast.tail[1].tail[0].op == LessOp);
+  REQUIRE(ast.tail[1].tail[1].op == MulOp);
+  REQUIRE(ast.tail[1].tail[1].tail[0].op == VariableOp);
+  REQUIRE(ast.tail[1].tail[2].op == SubOp);
+}
+
+TEST_CASE( "Test every engine keeps definitions across programs", "[interpreter]" ) {
+
+  const Engine engines[] = {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine};
+
+  for (auto engine: engines) {
+    Interpreter interp;
+    interp.setEngine(engine);
+
+    std::istringstream first("(define r 10)");
+    REQUIRE(interp.parse(first));
+    REQUIRE(interp.eval() == Expression(10.));
+
+    std::istringstream second("(begin (define d (* 2 r)) (+ d r))");
+    REQUIRE(interp.parse(second));
+    REQUIRE(interp.eval() == Expression(30.));
+
+    // redefinition is an error that clears the environment
+    std::istringstream third("(define r 1)");
+    REQUIRE(interp.parse(third));
+    REQUIRE(interp.eval() == Expression());
+
+    std::istringstream fourth("(d)");
+    REQUIRE(interp.parse(fourth));
+    REQUIRE(interp.eval() == Expression());
+  }
+}
+
+TEST_CASE( "Test Interpreter lambdas and function defines", "[interpreter]" ) {
+
+  {
+    std::string program = "(begin (define square (lambda (x) (* x x))) (square 12))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(144.));
+  }
+
+  {
+    std::string program = "(begin (define (hyp a b) (pow (+ (* a a) (* b b)) 0.5)) (hyp 3 4))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(5.));
+  }
+
+  { // closures capture the frame they are created in
+    std::string program = "(begin (define (adder n) (lambda (x) (+ x n))) (define add3 (adder 3)) (add3 4))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(7.));
+  }
+
+  { // procedures with no parameters, and bodies of several forms
+    std::string program = "(begin (define (seven) (define six 6) (+ six 1)) (seven))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(7.));
+  }
+
+  { // procedures are values
+    std::string program = "(begin (define (twice f x) (f (f x))) (twice (lambda (x) (* 2 x)) 5))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(20.));
+  }
+
+  { // non-tail recursion
+    std::string program = "(begin (define (fact n) (if (< n 2) 1 (* n (fact (- n 1))))) (fact 10))";
+    Expression result = run(program);
+    REQUIRE(result == Expression(3628800.));
+  }
+}
+
+TEST_CASE( "Test Interpreter tail calls run in constant stack", "[interpreter]" ) {
+
+  std::string program = "(begin (define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))"
+                        " (loop 1000000 0))";
+  Expression result = run(program);
+  REQUIRE(result == Expression(1000000.));
+
+  // mutual recursion through begin and if
+  program = "(begin (define (even n) (if (= n 0) True (odd (- n 1))))"
+            " (define (odd n) (if (= n 0) False (begin (even (- n 1)))))"
+            " (even 100001))";
+  result = run(program);
+  REQUIRE(result == Expression(false));
+
+  // subexpressions shared within a body are not shared between calls
+  program = "(begin (define (sum n acc) (if (= n 0) acc (sum (- n 1) (+ acc (* (+ n 1) (+ n 1))))))"
+            " (sum 1000 0))";
+  result = run(program);
+  REQUIRE(result == Expression(334835500.));
+}
+
+TEST_CASE( "Test Interpreter unboxed evaluation of proven subtrees", "[interpreter]" ) {
+
+  // proven subtrees with parameters, shared subexpressions and procedure calls inside
+  std::string program = "(begin (define k 3) (define (f x) (if (< (* x k) 10) (+ x (pow x 2) k) (- (/ x k))))"
+                        " (define (g x) (and (< (f x) (* (f x) 2)) (not (= (f x) 0))))"
+                        " (if (or (g 1) (g 2)) (+ (f 1) (f 5) (log10 (* k 100))) 0))";
+  REQUIRE(run(program) == Expression(5 + -(5 / 3.) + log10(300.)));
+
+  // a shared Boolean subexpression in a body, and a proven value in a frame slot
+  program = "(begin (define (h x y) (if (and (< x y) (> (+ x y) 0)) (if (and (< x y) (> (+ x y) 0)) x 0) y))"
+            " (+ (h 1 2) (h 3 2)))";
+  REQUIRE(run(program) == Expression(3.));
+}
+
+TEST_CASE( "Test Interpreter do and while loops", "[interpreter]" ) {
+
+  { // steps see the values of the previous iteration
+    std::string program = "(do ((i 0 (+ i 1)) (s 0 (+ s i))) ((= i 100) s))";
+    REQUIRE(run(program) == Expression(4950.));
+    program = "(do ((a 0 b) (b 1 (+ a b)) (n 0 (+ n 1))) ((= n 30) a))";
+    REQUIRE(run(program) == Expression(832040.));
+  }
+
+  { // a variable without a step keeps its value unless assigned
+    std::string program = "(do ((i 0) (s 0)) ((= i 10) s) (set! s (+ s i)) (set! i (+ i 1)))";
+    REQUIRE(run(program) == Expression(45.));
+  }
+
+  { // inits are in the enclosing scope, results may be several forms or none
+    std::string program = "(begin (define n 5) (do ((n n (- n 1)) (p 1 (* p n))) ((= n 0) 1 p)))";
+    REQUIRE(run(program) == Expression(120.));
+    REQUIRE(run("(do ((i 0 (+ i 1))) ((> i 3)))") == Expression());
+  }
+
+  { // nested loops, and a Boolean result
+    std::string program = "(do ((i 0 (+ i 1)) (s 0 (do ((j 0 (+ j 1)) (t s (+ t j))) ((= j i) t))))"
+                          " ((= i 10) (< s 200)))";
+    REQUIRE(run(program) == Expression(true));
+  }
+
+  { // while loops assign variables of a procedure or an enclosing do
+    std::string program = "(begin (define (digits n) (do ((count 1)) ((< n 10) count)"
+                          " (while (>= n 10) (set! n (/ n 10)) (set! count (+ count 1)))))"
+                          " (+ (digits 12345) (digits 7)))";
+    REQUIRE(run(program) == Expression(6.));
+    REQUIRE(run("(do ((i 0)) (True (while False (set! i 1)) i))") == Expression(0.));
+  }
+
+  { // set! yields the value it assigns
+    REQUIRE(run("(begin (define (f x) (+ (set! x (* x 2)) x)) (f 3))") == Expression(12.));
+  }
+
+  { // a procedure created in the body keeps the iteration it was created in
+    std::string program = "(begin (define (captured n) (do ((i 0 (+ i 1)) (f 0 (if (= i 2) (lambda () i) f)))"
+                          " ((= i n) (f)))) (captured 5))";
+    REQUIRE(run(program) == Expression(2.));
+  }
+
+  { // a loop in a procedure, and shared subexpressions that change each iteration
+    std::string program = "(begin (define (g n) (do ((i 0 (+ i 1)) (s 0 (+ s (* (+ i 1) (+ i 1))))) ((= i n) s)))"
+                          " (+ (g 10) (do ((i 0 (+ i 1)) (s 0 (+ s (* (+ i 1) (+ i 1))))) ((= i 10) s))))";
+    REQUIRE(run(program) == Expression(770.));
+  }
+}
+
+TEST_CASE( "Test Interpreter lists", "[interpreter]" ) {
+
+  Expression items = run("(list 1 True (list 2))");
+  REQUIRE(items.head.type == ListType);
+  REQUIRE(items.head.value.list_value->size() == 3);
+  REQUIRE(items == run("(list (+ 0 1) (< 1 2) (range 2 3))"));
+  REQUIRE_FALSE(items == run("(list 1 True (list 3))"));
+  REQUIRE(run("(list)") == run("(range 0)"));
+  REQUIRE(run("(range 3)") == run("(list 0 1 2)"));
+  REQUIRE(run("(range 0.5 3)") == run("(list 0.5 1.5 2.5)"));
+  REQUIRE(run("(range 3 1)") == run("(list)"));
+
+  // procedures over the items of a list, or a range of numbers
+  std::string squares = "(begin (define (sq x) (* x x)) (pmap sq (range 5)))";
+  REQUIRE(run(squares) == run("(list 0 1 4 9 16)"));
+  REQUIRE(run("(pfor (lambda (i) (< i 2)) 1 4)") == run("(list True False False)"));
+  REQUIRE(run("(preduce (lambda (a b) (+ a b)) 10 (range 101))") == Expression(5060.));
+  REQUIRE(run("(preduce (lambda (a b) (+ a b)) 10 (list))") == Expression(10.));
+
+  std::ostringstream out;
+  out << run("(list 1 (list True) (list))");
+  REQUIRE(out.str() == "(1 (True) ())");
+}
+
+TEST_CASE( "Test Interpreter list sequences", "[interpreter]" ) {
+
+  REQUIRE(run("(length (range 1000))") == Expression(1000.));
+  REQUIRE(run("(length (list))") == Expression(0.));
+  REQUIRE(run("(nth (list 1 True 3) 1)") == Expression(true));
+  REQUIRE(run("(+ (nth (range 10) 9) 1)") == Expression(10.));
+
+  // slices are views of the list they were cut from, slices of slices too
+  REQUIRE(run("(slice (range 10) 2 5)") == run("(list 2 3 4)"));
+  REQUIRE(run("(slice (range 10) 7)") == run("(list 7 8 9)"));
+  REQUIRE(run("(slice (range 10) 4 4)") == run("(list)"));
+  REQUIRE(run("(slice (slice (range 10) 2 8) 1 3)") == run("(list 3 4)"));
+  REQUIRE(run("(nth (slice (range 10) 5) 0)") == Expression(5.));
+  REQUIRE(run("(length (slice (range 10) 0 10))") == Expression(10.));
+  Expression whole = run("(range 10)");
+  Atom bounds[] = {whole.head, Expression(3.).head, Expression(6.).head};
+  Atom cut = slice_unchecked(bounds, 3);
+  REQUIRE(cut.value.list_value->begin() == whole.head.value.list_value->begin() + 3);
+  Atom inner[] = {cut, Expression(1.).head};
+  REQUIRE(slice_unchecked(inner, 2).value.list_value->parent == whole.head.value.list_value);
+
+  REQUIRE(run("(append (list 1) (slice (range 5) 3) (list) (list True))") == run("(list 1 3 4 True)"));
+  REQUIRE(run("(append)") == run("(list)"));
+  REQUIRE(run("(append (list) (range 3))") == run("(range 3)"));
+
+  // folding a long list reads it as an array
+  REQUIRE(run("(begin (define xs (range 100000))"
+              " (do ((i 0 (+ i 1)) (s 0 (+ s (nth xs i)))) ((= i (length xs)) s)))") == Expression(4999950000.));
+
+  // indices must be whole numbers within the list, and lists must be lists
+  std::vector<std::pair<std::string, Error>> failing = {
+    {"(nth (range 3) 3)", IndexRangeError}, {"(nth (range 3) -1)", IndexRangeError},
+    {"(nth (range 3) 0.5)", IndexRangeError}, {"(nth (list) 0)", IndexRangeError},
+    {"(slice (range 3) 2 1)", IndexRangeError}, {"(slice (range 3) 0 4)", IndexRangeError},
+    {"(nth 3 0)", ArgumentTypeError}, {"(nth (list 1) True)", ArgumentTypeError},
+    {"(do ((i 0 (+ i 1)) (xs (range 3) 1)) ((= i 2) (length xs)))", ArgumentTypeError}};
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    for (auto & program: failing) {
+      INFO(program.first);
+      Interpreter interp;
+      interp.setEngine(engine);
+      interp.setThrowErrors(true);
+      std::istringstream iss(program.first);
+      REQUIRE(interp.parse(iss));
+      REQUIRE_THROWS_WITH(interp.eval(), error_message(program.second));
+    }
+  }
+}
+
+TEST_CASE( "Test Interpreter loop errors", "[interpreter]" ) {
+
+  std::vector<std::string> invalid = {"(do)", "(do ((i 0)))", "(do ((i 0) (i 1)) (True))", "(do ((1 0)) (True))",
+                                      "(do (i 0) (True))", "(do ((i 0 1 2)) (True))", "(do () True)", "(while)",
+                                      "(do ((i 0 (+ i 1)) ((= i 1))"};
+  for (auto program: invalid) {
+    INFO(program);
+    std::istringstream iss(program);
+    Interpreter interp;
+    REQUIRE(interp.parse(iss) == false);
+  }
+
+  // only locals may be assigned, and conditions must be Booleans
+  std::vector<std::string> failing = {"(begin (define a 1) (set! a 2))", "(set! 1 2)", "(do ((i 0)) (1))",
+                                      "(while 1)", "(do ((i 0 (+ i 1))) ((= i 2)) (set! i))",
+                                      "(do ((i 0 (+ i 1))) ((= i 2) (define k i) (define k i)))",
+                                      // pmap, preduce and pfor take a procedure and a list, or numbers
+                                      "(pmap (list 1) (list 1))", "(pmap (lambda (x) x) 1)",
+                                      "(pmap (lambda (x y) x) (list 1))", "(preduce (lambda (x) x) 0 (list 1 2))",
+                                      "(pfor (lambda (x) x) 0 (list 1))", "(pmap (lambda (x) x))",
+                                      "(+ (range 2) 1)"};
+  for (auto program: failing) {
+    INFO(program);
+    std::istringstream iss(program);
+    Interpreter interp;
+    REQUIRE(interp.parse(iss) == true);
+    REQUIRE(interp.eval() == Expression());
+  }
+}
+
+TEST_CASE( "Test Interpreter lambda errors", "[interpreter]" ) {
+
+  std::vector<std::string> invalid = {"(lambda (1) 1)", "(lambda (+) 1)", "(lambda x 1)",
+                                      "(lambda (x x) 1)", "(lambda (x))", "(define (f (x)) 1)"};
+  for (auto program: invalid) {
+    std::istringstream iss(program);
+    Interpreter interp;
+    REQUIRE(interp.parse(iss) == false);
+  }
+
+  std::vector<std::string> failing = {
+    "(begin (define (f x) x) (f 1 2))",
+    "(begin (define (f x) x) (f))",
+    "(begin (define (deep n) (+ 1 (deep n))) (deep 1))"
+  };
+  for (auto program: failing) {
+    std::istringstream iss(program);
+    Interpreter interp;
+    REQUIRE(interp.parse(iss) == true);
+    REQUIRE(interp.eval() == Expression());
+  }
+}
+
+TEST_CASE( "Test Interpreter errors at the API boundary", "[interpreter]" ) {
+
+  // unbalanced input is a syntax error rather than running off the tokens
+  std::vector<std::string> unbalanced = {"(+ 1 2", "(begin (define a 1) (+ a", "(", ""};
+  for (auto program: unbalanced) {
+    std::istringstream iss(program);
+    Interpreter interp;
+    REQUIRE(interp.parse(iss) == false);
+  }
+
+  std::istringstream iss("(+ 1 2");
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  REQUIRE_THROWS_AS(interp.build_ast(tokens), InterpreterSemanticError);
+
+  // eval reports errors by printing, or by throwing when asked to
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    Interpreter quiet;
+    quiet.setEngine(engine);
+    std::istringstream unknown("(+ a 1)");
+    REQUIRE(quiet.parse(unknown));
+    REQUIRE_NOTHROW(quiet.eval());
+
+    Interpreter loud;
+    loud.setEngine(engine);
+    loud.setThrowErrors(true);
+    std::istringstream again("(+ a 1)");
+    REQUIRE(loud.parse(again));
+    try {
+      loud.eval();
+      FAIL("eval did not throw");
+    }
+    catch (const InterpreterSemanticError & error) {
+      REQUIRE(std::string(error.what()) == error_message(UnknownSymbolError));
+    }
+  }
+
+  // so does evaluate, and a failed evaluation leaves the interpreter usable
+  std::istringstream deep("(begin (define (deep n) (+ 1 (deep n))) (deep 1))");
+  tokens = tokenize(deep);
+  Expression ast = interp.build_ast(tokens);
+  REQUIRE_THROWS_AS(interp.evaluate(ast), InterpreterSemanticError);
+  std::istringstream sum("(+ 1 2)");
+  tokens = tokenize(sum);
+  REQUIRE(interp.evaluate(interp.build_ast(tokens)) == Expression(3.));
+}
+
+TEST_CASE( "Test Interpreter step and time limits", "[interpreter]" ) {
+
+  std::string endless = "(do ((i 0 (+ i 1))) ((< i 0) i))";
+  std::string recursion = "(begin (define (spin n) (if (< n 0) 0 (spin (+ n 1)))) (spin 0))";
+
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    for (bool jit: {false, true}) {
+      for (auto program: {endless, recursion}) {
+        INFO(program);
+        Interpreter interp;
+        interp.setEngine(engine);
+        interp.setJit(jit);
+        interp.setThrowErrors(true);
+        interp.setStepLimit(50000);
+
+        // steps are counted exactly on one thread, and a program within them runs
+        std::istringstream small("(begin (define a 1) (define (f x) (+ x a)) (f 2))");
+        REQUIRE(interp.parse(small));
+        REQUIRE(interp.eval() == Expression(3.));
+        REQUIRE(interp.stepsTaken() > 0);
+        REQUIRE(interp.stepsTaken() < 50);
+
+        // a program cut short leaves none of its defines behind
+        std::istringstream iss("(begin (define b 2) " + program + ")");
+        REQUIRE(interp.parse(iss));
+        REQUIRE_THROWS_WITH(interp.eval(), error_message(StepLimitError));
+        REQUIRE(interp.stepsTaken() == 50000);
+        std::istringstream after("(begin (define b 3) (+ a b))");
+        REQUIRE(interp.parse(after));
+        REQUIRE(interp.eval() == Expression(4.));
+        std::istringstream undone("spin");
+        REQUIRE(interp.parse(undone));
+        REQUIRE_THROWS_WITH(interp.eval(), error_message(UnknownSymbolError));
+      }
+    }
+  }
+
+  { // the time limit applies to each eval, the step limit stays off
+    Interpreter interp;
+    interp.setThrowErrors(true);
+    interp.setTimeLimit(std::chrono::milliseconds(20));
+    std::istringstream iss(endless);
+    REQUIRE(interp.parse(iss));
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS_WITH(interp.eval(), error_message(TimeLimitError));
+    REQUIRE_THROWS_WITH(interp.eval(), error_message(TimeLimitError));
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    REQUIRE(interp.stepsTaken() > 1000);
+  }
+
+  { // procedures applied on the thread pool share the budget
+    Interpreter interp;
+    interp.setThrowErrors(true);
+    interp.setParallelThreshold(1);
+    interp.setStepLimit(100000);
+    std::istringstream iss("(begin (define (spin n) (if (< n 0) 0 (spin (+ n 1)))) (pmap spin (range 16)))");
+    REQUIRE(interp.parse(iss));
+    REQUIRE_THROWS_WITH(interp.eval(), error_message(StepLimitError));
+    std::istringstream again("(begin (define (spin n) n) (spin 1))");
+    REQUIRE(interp.parse(again));
+    REQUIRE(interp.eval() == Expression(1.));
+  }
+}
+
+// heap allocations made while counting_allocations is set
+static bool counting_allocations = false;
+static std::size_t allocations = 0;
+
+void * operator new(std::size_t size){
+  if (counting_allocations)
+    ++allocations;
+  void * memory = std::malloc(size ? size : 1);
+  if (memory == nullptr)
+    throw std::bad_alloc();
+  return memory;
+}
+
+void operator delete(void * memory) noexcept{
+  std::free(memory);
+}
+
+TEST_CASE( "Test builtin calls do not allocate", "[interpreter]" ) {
+
+  Interpreter interp;
+  std::istringstream defines("(begin (define a 1) (define b 2))");
+  REQUIRE(interp.parse(defines));
+  REQUIRE(interp.eval() == Expression(2.));
+
+  std::istringstream iss("(+ a (* b 3))");
+  TokenSequenceType tokens = tokenize(iss);
+  Expression ast = interp.build_ast(tokens);
+  Chunk chunk;
+  REQUIRE(compile_chunk(ast, chunk) == NoError);
+  VirtualMachine vm;
+  Environment env;
+  env.addExpression("a", Expression(1.));
+  env.addExpression("b", Expression(2.));
+
+  // the first run of each grows its value stack
+  REQUIRE(interp.evaluate(ast) == Expression(7.));
+  Expression run;
+  REQUIRE(vm.run(chunk, env, run) == NoError);
+  REQUIRE(run == Expression(7.));
+
+  allocations = 0;
+  counting_allocations = true;
+  Expression walked = interp.evaluate(ast);
+  vm.run(chunk, env, run);
+  counting_allocations = false;
+
+  REQUIRE(allocations == 0);
+  REQUIRE(walked == Expression(7.));
+  REQUIRE(run == Expression(7.));
+}
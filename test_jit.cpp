@@ -0,0 +1,128 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "jit.hpp"
+
+Expression jit_ast(Interpreter & interp, const std::string & program){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  return interp.build_ast(tokens);
+}
+
+// numbers must match bit for bit, so -0 differs from 0 and NaN equals NaN
+bool same_atom(const Atom & a, const Atom & b){
+  if (a.type != b.type)
+    return false;
+  if (a.type == NumberType)
+    return std::memcmp(&a.value.num_value, &b.value.num_value, sizeof(double)) == 0;
+  return a.value.bool_value == b.value.bool_value;
+}
+
+// (+ 1 (* 2 (- 3 ... x))), nesting deeper than there are registers
+std::string nested_arithmetic(int depth){
+  const char * ops[] = {"+", "*", "-"};
+  std::string program;
+  for (int i = 0; i < depth; ++i) {
+    program += "(" + std::string(ops[i % 3]) + " " + std::to_string(i % 5 + 1) + " ";
+  }
+  program += "x";
+  for (int i = 0; i < depth; ++i) {
+    program += ")";
+  }
+  return program;
+}
+
+TEST_CASE( "Test JIT results match the tree walker", "[jit]" ) {
+
+  if (!jit_available())
+    return;
+
+  std::vector<std::string> programs = {
+    "(+ 1 2)", "(+ x)", "(+ 1 2 3 x)", "(*)", "(* x 3 y)", "(- x)", "(- x y)", "(/ x y)", "(/ x 0)",
+    "(+ -0)", "(* -0 1)", "(- 0)", "(+ (- 0) -0)", "(/ (- x x) 0)", "(pi)", "(* 2 pi x)",
+    "(< x y)", "(<= x x)", "(> x y)", "(>= y x)", "(= x 2.5)", "(= y x)",
+    "(not (< x y))", "(and (< x y) (> x 0))", "(or (> x y) (= x y))", "(and True)", "(or False)",
+    "(if (< x y) (+ x 1) (- y))", "(if (and (< x 3) (not (= y 0))) (* x y) 0)",
+    "(if (< x y) (< 1 2) (> 1 2))", "(or (if (> x 0) False True) (< x 1))",
+    // NaN is unordered, never less, greater or equal
+    "(< (/ x x) 1)", "(>= (/ x x) 1)", "(= (/ x x) (/ x x))", "(not (= (/ 0 0) 1))", "(/ 0 0)",
+    nested_arithmetic(10), nested_arithmetic(40),
+    // loop variables live unboxed in their own slots
+    "(do ((i 0 (+ i 1)) (s 0 (+ s (* i x)))) ((>= i 10) s))", "(do ((i y (- i 1))) ((< i 0) i))",
+    "(do ((a x) (n 0 (+ n 1))) ((= n 3) a) (set! a (* a y)))", "(begin (do ((i 0 (+ i 1))) ((= i 3))) x)",
+    "(do ((i 0) (s 0)) ((>= i y) (< s x)) (while (< i y) (set! s (+ s i)) (set! i (+ i 1))))",
+    "(do ((i 0 (+ i 1)) (t 0 (do ((j 0 (+ j 1)) (u t (+ u j x))) ((= j i) u)))) ((= i 5) t))",
+    "(begin 1)", "(begin (< x y) (* x 2))", "(begin (+ x 1) (< y x))",
+    "(do ((a 0 b) (b 1 (+ a b)) (n 0 (+ n 1))) ((= n 20) (+ a (set! b x))))",
+    "(+ (+ 1 (+ 2 (+ 3 (+ 4 (+ 5 (+ 6 (+ 7 (+ 8 (+ 9 (+ 10 (+ 11 (+ 12 (+ 13 (+ 14 (+ 15 (+ 16 x))))))))))))))))"
+    "   (* 2 (* 3 (* 4 (* 5 (* 6 (* 7 (* 8 (* 9 (* 10 (* 11 (* 12 (* 13 (* 14 (* 15 (* 16 y))))))))))))))))"};
+
+  for (std::string x: {"2.5", "-0", "0", "1e308", "-7"}) {
+    // the tree walker reads x and y from its environment, the JIT from values
+    Interpreter reference;
+    reference.setJit(false);
+    reference.setOptimization(false);
+    std::istringstream defines("(begin (define x " + x + ") (define y 4))");
+    REQUIRE(reference.parse(defines));
+    reference.eval();
+
+    for (auto program: programs) {
+      INFO(program << " with x = " << x);
+      Expression ast = jit_ast(reference, program);
+      Atom expected = reference.evaluate(ast).head;
+
+      JitProgram jit;
+      REQUIRE(jit.compile(ast));
+      std::vector<double> values;
+      for (auto & name: jit.globals()) {
+        values.push_back(name == "x" ? std::stod(x) : name == "y" ? 4. : atan2(0, -1));
+      }
+      REQUIRE(same_atom(jit.run(values.data()), expected));
+    }
+  }
+}
+
+TEST_CASE( "Test JIT leaves unsupported programs to the interpreter", "[jit]" ) {
+
+  Interpreter interp;
+  std::vector<std::string> unsupported = {
+    "(pow x 2)", "(log10 x)", "(define a 1)", "(lambda (x) x)", "(x 1)",
+    "(+ True 1)", "(not 1)", "(if x 1 2)", "(- 1 2 3)", "(and)", "(while (< x 1))", "(begin)",
+    "(do ((b True)) (b 1))", "(do ((i 0)) ((= i 0)))", "(do ((i 0)) ((= i 0) (lambda (x) i)))"};
+  for (auto program: unsupported) {
+    INFO(program);
+    JitProgram jit;
+    REQUIRE_FALSE(jit.compile(jit_ast(interp, program)));
+  }
+
+  for (bool enabled: {true, false}) {
+    Interpreter numeric;
+    numeric.setJit(enabled);
+
+    // a global that is unbound, or not a number, runs on the engine
+    std::istringstream first("(+ a 1)");
+    REQUIRE(numeric.parse(first));
+    REQUIRE(numeric.eval() == Expression());
+
+    std::istringstream second("(define a 2)");
+    REQUIRE(numeric.parse(second));
+    numeric.eval();
+    std::istringstream third("(* (+ a 1) pi)");
+    REQUIRE(numeric.parse(third));
+    REQUIRE(numeric.eval() == Expression(3 * atan2(0, -1)));
+    REQUIRE(numeric.eval() == Expression(3 * atan2(0, -1)));
+
+    std::istringstream fourth("(begin (define b (< 1 2)) (if b 1 2))");
+    REQUIRE(numeric.parse(fourth));
+    REQUIRE(numeric.eval() == Expression(1.));
+    std::istringstream fifth("(- b)");
+    REQUIRE(numeric.parse(fifth));
+    REQUIRE(numeric.eval() == Expression());
+  }
+}
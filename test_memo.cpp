@@ -0,0 +1,141 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+
+#include "interpreter.hpp"
+#include "interpreter_semantic_error.hpp"
+#include "memo.hpp"
+
+Expression memo_eval(Interpreter & interp, const std::string & program){
+  std::istringstream iss(program);
+  REQUIRE(interp.parse(iss));
+  return interp.eval();
+}
+
+TEST_CASE( "Test memo table keys and eviction", "[memo]" ) {
+
+  Expression found;
+  MemoTable table(2);
+  Expression one[] = {Expression(1.), Expression(true)};
+  Expression two[] = {Expression(2.), Expression(true)};
+  Expression three[] = {Expression(3.), Expression(true)};
+
+  REQUIRE_FALSE(table.find(one, 2, found));
+  table.insert(one, 2, Expression(10.));
+  table.insert(two, 2, Expression(20.));
+  REQUIRE(table.size() == 2);
+
+  // the least recently used entry is evicted
+  REQUIRE(table.find(one, 2, found));
+  REQUIRE(found == Expression(10.));
+  table.insert(three, 2, Expression(30.));
+  REQUIRE(table.size() == 2);
+  REQUIRE_FALSE(table.find(two, 2, found));
+  REQUIRE(table.find(three, 2, found));
+  REQUIRE(found == Expression(30.));
+  REQUIRE(table.find(one, 2, found));
+  REQUIRE(found == Expression(10.));
+  REQUIRE(table.hits() == 3);
+  REQUIRE(table.misses() == 2);
+
+  // keys differ by type, count, and numbers bit for bit
+  Expression zero[] = {Expression(0.)};
+  Expression negative_zero[] = {Expression(-0.)};
+  Expression symbol[] = {Expression(std::string("a"))};
+  MemoTable keys(10);
+  keys.insert(zero, 1, Expression(1.));
+  REQUIRE_FALSE(keys.find(negative_zero, 1, found));
+  REQUIRE_FALSE(keys.find(one, 1, found));
+  REQUIRE_FALSE(keys.find(symbol, 1, found));
+  REQUIRE_FALSE(keys.find(zero, 0, found));
+  REQUIRE(keys.find(zero, 1, found));
+
+  // with no capacity nothing is cached
+  MemoTable none(0);
+  none.insert(one, 2, Expression(1.));
+  REQUIRE_FALSE(none.find(one, 2, found));
+}
+
+TEST_CASE( "Test define-memo caches pure procedures across evals", "[memo]" ) {
+
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    Interpreter interp;
+    interp.setEngine(engine);
+
+    REQUIRE(memo_eval(interp, "(define-memo (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))").head.type ==
+            LambdaType);
+    REQUIRE(interp.memoTable("fib") != nullptr);
+    REQUIRE(memo_eval(interp, "(fib 60)") == Expression(1548008755920.));
+
+    // each argument is computed once, its second use is a hit
+    const MemoTable & table = *interp.memoTable("fib");
+    REQUIRE(table.misses() == 61);
+    REQUIRE(table.hits() == 58);
+
+    // later lines reuse the results
+    REQUIRE(memo_eval(interp, "(+ (fib 50) (fib 60))") == Expression(1548008755920. + 12586269025.));
+    REQUIRE(table.hits() == 60);
+    REQUIRE(table.misses() == 61);
+  }
+
+  { // the cache is bounded
+    Interpreter interp;
+    interp.setMemoCapacity(4);
+    memo_eval(interp, "(define-memo (sq x) (* x x))");
+    REQUIRE(memo_eval(interp, "(+ (sq 1) (sq 2) (sq 3) (sq 4) (sq 5) (sq 1))") == Expression(56.));
+    REQUIRE(interp.memoTable("sq")->size() == 4);
+    REQUIRE(interp.memoTable("sq")->misses() == 6);
+  }
+
+  { // plain defines are not memoized
+    Interpreter interp;
+    memo_eval(interp, "(define (sq x) (* x x))");
+    REQUIRE(interp.memoTable("sq") == nullptr);
+    REQUIRE(interp.memoTable("missing") == nullptr);
+  }
+}
+
+TEST_CASE( "Test define-memo only accepts pure procedures", "[memo]" ) {
+
+  Interpreter interp;
+  memo_eval(interp, "(define k 3)");
+  memo_eval(interp, "(define (scale x) (* k x))");
+  memo_eval(interp, "(define (record x) (define last x))");
+
+  // builtins, globals, and pure procedures defined earlier or in the same program
+  REQUIRE(memo_eval(interp, "(define-memo (f x) (scale (+ x k)))").head.type == LambdaType);
+  REQUIRE(memo_eval(interp, "(begin (define (twice x) (* 2 x)) (define-memo (g x) (twice x)))").head.type ==
+          LambdaType);
+  REQUIRE(memo_eval(interp, "(+ (f 1) (g 2))") == Expression(16.));
+
+  // loops over the procedure's own variables
+  REQUIRE(memo_eval(interp, "(define-memo (total n) (do ((i 0 (+ i 1)) (s 0 (+ s i))) ((= i n) s)))").head.type ==
+          LambdaType);
+  REQUIRE(memo_eval(interp, "(total 10)") == Expression(45.));
+
+  std::vector<std::string> impure = {
+    "(define-memo (h x) (define y x))",
+    "(define-memo (h x) (record x))",
+    "(define-memo (h x) (lambda (y) (+ x y)))",
+    "(define-memo (h x) (unknown x))",
+    "(define-memo (h p x) (p x))",
+    "(begin (define (make k) (begin (define-memo (h x) (+ x k)) h)) (make 1))",
+    "(begin (define (effect x) (define z x)) (define-memo (h x) (effect x)))"};
+  for (auto program: impure) {
+    INFO(program);
+    Interpreter checked;
+    memo_eval(checked, "(define (record x) (define last x))");
+    checked.setThrowErrors(true);
+    std::istringstream iss(program);
+    REQUIRE(checked.parse(iss));
+    REQUIRE_THROWS_WITH(checked.eval(), "Error: define-memo needs a pure procedure");
+  }
+
+  // define-memo only defines functions
+  for (auto program: {"(define-memo x 1)", "(define-memo)", "(define-memo (f x)"}) {
+    Interpreter parsed;
+    std::istringstream iss(program);
+    REQUIRE_FALSE(parsed.parse(iss));
+  }
+}
@@ -0,0 +1,130 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+
+#include "interpreter.hpp"
+#include "interpreter_semantic_error.hpp"
+#include "memory.hpp"
+
+static Expression memory_eval(Interpreter & interp, const std::string & program){
+  std::istringstream iss(program);
+  REQUIRE(interp.parse(iss));
+  return interp.eval();
+}
+
+TEST_CASE( "Test memory accounts count, peak and refuse", "[memory]" ) {
+
+  MemoryAccount account;
+  REQUIRE(account.charge(100));
+  account.add(50);
+  REQUIRE(account.current() == 150);
+  account.release(120);
+  REQUIRE(account.current() == 30);
+  REQUIRE(account.peak() == 150);
+
+  // past the limit charges are refused, adds are not
+  account.setLimit(100);
+  REQUIRE(account.charge(70));
+  REQUIRE_FALSE(account.charge(1));
+  account.add(10);
+  REQUIRE(account.current() == 110);
+  REQUIRE_FALSE(account.charge(1));
+  account.setLimit(0);
+  REQUIRE(account.charge(1000));
+  REQUIRE(account.peak() == 1110);
+}
+
+TEST_CASE( "Test counting allocators charge the current account", "[memory]" ) {
+
+  std::shared_ptr<MemoryAccount> account = std::make_shared<MemoryAccount>();
+  {
+    AccountScope scope(account);
+    REQUIRE(current_account() == account);
+    Items items(100);
+    REQUIRE(account->current() == 100 * sizeof(Atom));
+
+    // the limit is an allocation error, leaving nothing charged
+    account->setLimit(150 * sizeof(Atom));
+    REQUIRE_THROWS_AS(Items(100), MemoryLimitExceeded);
+    REQUIRE(account->current() == 100 * sizeof(Atom));
+  }
+  REQUIRE(current_account() == nullptr);
+  REQUIRE(account->current() == 0);
+
+  // outside a scope nothing is charged
+  Items uncounted(10);
+  REQUIRE(account->current() == 0);
+}
+
+TEST_CASE( "Test interpreters account for their memory", "[memory]" ) {
+
+  Interpreter interp;
+  memory_eval(interp, "(define a 1)");
+  std::size_t small = interp.memoryInUse();
+  REQUIRE(small > 0);
+  REQUIRE(small < 1000 * sizeof(Atom));
+
+  // a list is charged while it is held, by a result or a binding
+  Expression held = memory_eval(interp, "(range 1000)");
+  REQUIRE(interp.memoryInUse() >= 1000 * sizeof(Atom));
+  held = Expression();
+  REQUIRE(interp.memoryInUse() < 1000 * sizeof(Atom));
+  memory_eval(interp, "(define xs (range 1000))");
+  std::size_t bound = interp.memoryInUse();
+  REQUIRE(bound >= 1000 * sizeof(Atom));
+  REQUIRE(interp.peakMemory() >= bound);
+
+  // and released once it is not, here by a redefinition clearing the bindings
+  memory_eval(interp, "(define xs 2)");
+  REQUIRE(interp.memoryInUse() < 1000 * sizeof(Atom));
+}
+
+TEST_CASE( "Test memory limits fail evaluation gracefully", "[memory]" ) {
+
+  for (auto engine: {TreeWalkerEngine, VirtualMachineEngine, ClosureEngine}) {
+    Interpreter interp;
+    interp.setEngine(engine);
+    interp.setThrowErrors(true);
+    memory_eval(interp, "(define n 10)");
+    interp.setMemoryLimit(interp.memoryInUse() + 64 * 1024);
+
+    // lists past the limit fail, as does a program defining one
+    for (auto program: {"(range 1e7)", "(begin (define a 1) (define xs (range 1e7)))",
+                        "(pmap (lambda (x) (range 1e5)) (range 100))"}) {
+      INFO(program);
+      std::istringstream iss(program);
+      REQUIRE(interp.parse(iss));
+      REQUIRE_THROWS_WITH(interp.eval(), error_message(MemoryLimitError));
+    }
+
+    // leaving the environment as it was, and the interpreter usable
+    REQUIRE(memory_eval(interp, "(+ n 1)") == Expression(11.));
+    REQUIRE(memory_eval(interp, "(begin (define a 2) (* a n))") == Expression(20.));
+    REQUIRE(interp.peakMemory() <= interp.memoryInUse() + 64 * 1024);
+  }
+
+  { // bindings are charged too
+    Interpreter interp;
+    interp.setThrowErrors(true);
+    interp.setMemoryLimit(interp.memoryInUse() + 2048);
+    std::string program = "(begin";
+    for (int i = 0; i < 100; ++i) {
+      program += " (define v" + std::to_string(i) + " 1)";
+    }
+    std::istringstream iss(program + ")");
+    REQUIRE(interp.parse(iss));
+    REQUIRE_THROWS_WITH(interp.eval(), error_message(MemoryLimitError));
+    memory_eval(interp, "(define v0 2)");
+  }
+
+  { // interpreters are accounted apart
+    Interpreter limited, unlimited;
+    limited.setMemoryLimit(1);
+    limited.setThrowErrors(true);
+    REQUIRE(memory_eval(unlimited, "(range 1000)").head.type == ListType);
+    std::istringstream iss("(range 1000)");
+    REQUIRE(limited.parse(iss));
+    REQUIRE_THROWS_WITH(limited.eval(), error_message(MemoryLimitError));
+  }
+}
@@ -0,0 +1,234 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <string>
+#include <sstream>
+
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+
+Expression folded_ast(const std::string & program){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  fold_constants(ast);
+  return ast;
+}
+
+TEST_CASE( "Test constant folding of builtin calls", "[optimizer]" ) {
+
+  REQUIRE(folded_ast("(+ 1 (* 2 3))") == Expression(7.));
+  REQUIRE(folded_ast("(* 2 pi)") == Expression(2 * atan2(0, -1)));
+  REQUIRE(folded_ast("(pow 10 3)") == Expression(1000.));
+  REQUIRE(folded_ast("(and True (not False))") == Expression(true));
+
+  { // calls over variables keep their folded arguments
+    Expression ast = folded_ast("(+ x (* 2 3))");
+    REQUIRE(ast.op == AddOp);
+    REQUIRE(ast.tail[0].op == VariableOp);
+    REQUIRE(ast.tail[1] == Expression(6.));
+  }
+
+  { // lambda bodies are folded too
+    Expression ast = folded_ast("(lambda (x) (+ x (* 2 3)))");
+    REQUIRE(ast.op == LambdaOp);
+    Expression & body = ast.head.value.lambda_value->code->body;
+    REQUIRE(body.tail[1] == Expression(6.));
+  }
+
+  { // a define keeps the name it binds
+    Expression ast = folded_ast("(define pi (+ 1 2))");
+    REQUIRE(ast.op == DefineOp);
+    REQUIRE(ast.tail[0].op == VariableOp);
+    REQUIRE(ast.tail[0].head.value.sym_value == "pi");
+    REQUIRE(ast.tail[1] == Expression(3.));
+  }
+}
+
+TEST_CASE( "Test constant folding preserves errors", "[optimizer]" ) {
+
+  std::vector<std::string> unfolded = {"(not True False)", "(- 1 2 3)", "(* 2)", "(+ True 1)", "(not 1)"};
+  for (auto program: unfolded) {
+    Expression ast = folded_ast(program);
+    REQUIRE(ast.op != LiteralOp);
+  }
+
+  // the error is still reported when the program runs
+  std::istringstream iss("(if (< 1 2) (log10 1 2) 0)");
+  Interpreter interp;
+  REQUIRE(interp.parse(iss));
+  REQUIRE(interp.eval() == Expression());
+}
+
+TEST_CASE( "Test dead branch elimination and begin flattening", "[optimizer]" ) {
+
+  REQUIRE(folded_ast("(if True 1 (+))") == Expression(1.));
+  REQUIRE(folded_ast("(if (< 2 1) 1 (- 4))") == Expression(-4.));
+
+  { // non-literal conditions are kept
+    Expression ast = folded_ast("(if a 1 2)");
+    REQUIRE(ast.op == IfOp);
+  }
+
+  { // nested begins are spliced, empty ones still supply a value
+    Expression ast = folded_ast("(begin (begin (define a 1) (define b 2)) (begin (+ a b) (begin)))");
+    REQUIRE(ast.op == BeginOp);
+    REQUIRE(ast.tail.size() == 4);
+    REQUIRE(ast.tail[3].op == BeginOp);
+    REQUIRE(ast.tail[3].tail.empty());
+  }
+
+  { // and, or keep operands that may run and decide the result
+    REQUIRE(folded_ast("(and False x)") == Expression(false));
+    REQUIRE(folded_ast("(or False (< 1 2) x)") == Expression(true));
+    REQUIRE(folded_ast("(and True True)") == Expression(true));
+    Expression ast = folded_ast("(or x False y True z)");
+    REQUIRE(ast.op == OrOp);
+    REQUIRE(ast.tail.size() == 3);
+    REQUIRE(ast.tail[2] == Expression(true));
+    REQUIRE(folded_ast("(and)").op == AndOp);
+  }
+
+  { // a begin of one form is that form
+    Expression ast = folded_ast("(begin (begin (define r 10)))");
+    REQUIRE(ast.op == DefineOp);
+  }
+}
+
+Expression optimized_ast(const std::string & program, const Environment & env){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  optimize_ast(ast, env);
+  return ast;
+}
+
+TEST_CASE( "Test propagation of global constants", "[optimizer]" ) {
+
+  Environment env;
+
+  { // defines earlier in a sequence are propagated and folded
+    Expression ast = optimized_ast("(begin (define r 10) (* pi (* r r)))", env);
+    REQUIRE(ast.op == BeginOp);
+    REQUIRE(ast.tail[0].op == DefineOp);
+    REQUIRE(ast.tail[1] == Expression(atan2(0, -1) * 100));
+  }
+
+  { // into lambda bodies created after the define
+    Expression ast = optimized_ast("(begin (define k 2) (define (f x) (* k (+ k 1) x)) (f 3))", env);
+    Expression & body = ast.tail[1].tail[1].head.value.lambda_value->code->body;
+    REQUIRE(body.op == MulOp);
+    REQUIRE(body.tail[0] == Expression(2.));
+    REQUIRE(body.tail[1] == Expression(3.));
+    REQUIRE(body.tail[2].op == LocalOp);
+  }
+
+  { // into the arguments of procedure calls
+    Expression ast = optimized_ast("(begin (define k 2) (f (+ k 1)))", env);
+    REQUIRE(ast.tail[1].op == ApplyOp);
+    REQUIRE(ast.tail[1].tail[0] == Expression(3.));
+  }
+
+  { // constant conditions fold away
+    Expression ast = optimized_ast("(begin (define debug False) (if debug (log10 10) 7))", env);
+    REQUIRE(ast.tail[1] == Expression(7.));
+  }
+
+  { // globals already in the environment
+    env.addExpression("limit", Expression(4.));
+    REQUIRE(optimized_ast("(< (limit) 5)", env) == Expression(true));
+  }
+}
+
+TEST_CASE( "Test propagation only where a define has run", "[optimizer]" ) {
+
+  Environment env;
+
+  { // a define in a branch may not run
+    Expression ast = optimized_ast("(begin (if c (define r 1) (define r 2)) r)", env);
+    REQUIRE(ast.tail[1].op == VariableOp);
+  }
+
+  { // nor does a define in a nested begin bind beyond it
+    Expression ast = optimized_ast("(begin (if c (begin (define r 1) r) 0) r)", env);
+    REQUIRE(ast.tail[0].tail[1].tail[1] == Expression(1.));
+    REQUIRE(ast.tail[1].op == VariableOp);
+  }
+
+  { // uses before the define are left alone
+    Expression ast = optimized_ast("(begin (define (f) r) (define r 1) (f))", env);
+    Expression & body = ast.tail[0].tail[1].head.value.lambda_value->code->body;
+    REQUIRE(body.op == VariableOp);
+  }
+
+  { // lambda parameters shadow globals
+    env.addExpression("x", Expression(1.));
+    Expression ast = optimized_ast("(lambda (x) (+ x 1))", env);
+    Expression & body = ast.head.value.lambda_value->code->body;
+    REQUIRE(body.tail[0].op == LocalOp);
+  }
+}
+
+TEST_CASE( "Test propagated constants follow a cleared environment", "[optimizer]" ) {
+
+  Interpreter interp;
+
+  std::istringstream first("(define k 1)");
+  REQUIRE(interp.parse(first));
+  REQUIRE(interp.eval() == Expression(1.));
+
+  std::istringstream second("(begin (define z 0) (+ k 1))");
+  REQUIRE(interp.parse(second));
+  REQUIRE(interp.eval() == Expression(2.));
+
+  // redefining z clears the environment, after which k is unknown
+  REQUIRE(interp.eval() == Expression());
+  REQUIRE(interp.eval() == Expression());
+}
+
+Expression shared_ast(const std::string & program, std::size_t & slots){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  slots = share_common_subexpressions(ast);
+  return ast;
+}
+
+TEST_CASE( "Test common subexpression elimination", "[optimizer]" ) {
+
+  std::size_t slots;
+
+  { // repeated calls read one slot
+    Expression ast = shared_ast("(+ (* a b) (- (* a b)))", slots);
+    REQUIRE(slots == 1);
+    REQUIRE(ast.tail[0].op == CachedOp);
+    REQUIRE(ast.tail[1].tail[0].op == CachedOp);
+    REQUIRE(ast.tail[1].tail[0].index == 0);
+  }
+
+  { // in a body, slots follow the parameters and parts of a shared call stay in it
+    Expression ast = shared_ast("(lambda (a b c) (+ (pow (/ a b) c) (* 2 (pow (/ a b) c))))", slots);
+    REQUIRE(slots == 0);
+    LambdaCode & code = *ast.head.value.lambda_value->code;
+    REQUIRE(code.cached == 1);
+    REQUIRE(code.body.tail[0].op == CachedOp);
+    REQUIRE(code.body.tail[0].index == 3);
+    REQUIRE(code.body.tail[0].tail[0].tail[0].op == DivOp);
+    REQUIRE(code.body.tail[1].tail[1].index == 3);
+  }
+
+  { // unless they also occur elsewhere
+    shared_ast("(+ (* (+ a 1) 2) (* (+ a 1) 2) (+ a 1))", slots);
+    REQUIRE(slots == 2);
+  }
+
+  { // procedure calls may have effects, and a program never shares with a body
+    shared_ast("(+ (f 1) (f 1))", slots);
+    REQUIRE(slots == 0);
+    shared_ast("(begin (+ a 1) (lambda (x) (+ a 1)))", slots);
+    REQUIRE(slots == 0);
+  }
+}
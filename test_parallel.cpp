@@ -0,0 +1,187 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+
+#include "interpreter.hpp"
+#include "checker.hpp"
+#include "parallel.hpp"
+
+// a procedure summing a loop, costly enough to spread
+const std::string work = "(define (work n) (do ((i 0 (+ i 1)) (s 0 (+ s (* i n)))) ((= i 2000) s)))";
+
+Expression marked_ast(const std::string & program, const Environment & env, double threshold){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  REQUIRE(check_program(ast, env) == NoError);
+  mark_parallel_arguments(ast, env, threshold);
+  return ast;
+}
+
+Expression parallel_eval(Interpreter & interp, const std::string & program){
+  std::istringstream iss(program);
+  REQUIRE(interp.parse(iss));
+  return interp.eval();
+}
+
+TEST_CASE( "Test cost estimates", "[parallel]" ) {
+
+  Environment env;
+  double call = estimated_cost(marked_ast("(+ 1 2)", env, 0), env);
+  REQUIRE(call == 3);
+
+  // loops repeat their body, calls run the body of the procedure
+  double loop = estimated_cost(marked_ast("(do ((i 0 (+ i 1))) ((= i 10) i))", env, 0), env);
+  REQUIRE(loop > 1000 * 5);
+  double procedure = estimated_cost(marked_ast("(begin (define (f x) (+ x (* x x))) (f 2))", env, 0), env);
+  REQUIRE(procedure > 6);
+  REQUIRE(procedure < 20);
+
+  // recursion is unbounded
+  double recursive = estimated_cost(marked_ast("(begin (define (f x) (if (< x 1) 0 (f (- x 1)))) (f 2))", env, 0), env);
+  REQUIRE(recursive >= 1e15);
+}
+
+TEST_CASE( "Test arguments marked for the thread pool", "[parallel]" ) {
+
+  Environment env;
+
+  { // costly independent arguments of builtins and procedures
+    Expression ast = marked_ast("(begin " + work + " (+ (work 1) 2 (work 3)))", env, 1000);
+    Expression & sum = ast.tail[1];
+    REQUIRE(sum.tail[0].parallel);
+    REQUIRE_FALSE(sum.tail[1].parallel);
+    REQUIRE(sum.tail[2].parallel);
+    REQUIRE(sum.proven == NoneType);
+  }
+
+  std::vector<std::string> sequential = {
+    // too cheap, or only one costly argument
+    "(+ (work 1) (work 2))@1e9", "(+ (work 1) 2)@1000",
+    // and, or decide as they go
+    "(and (< (work 1) 0) (< (work 2) 0))@1000",
+    // effects
+    "(+ (work 1) (begin (define a 1) (work 2)))@1000",
+    "(+ (work 1) (impure 2))@1000",
+  };
+  for (auto & entry: sequential) {
+    INFO(entry);
+    std::string program = entry.substr(0, entry.find('@'));
+    double threshold = std::stod(entry.substr(entry.find('@') + 1));
+    Expression ast = marked_ast("(begin " + work + " (define (impure x) (begin (define b x) (work x))) " +
+                                program + ")", env, threshold);
+    for (auto & child: ast.tail.back().tail) {
+      REQUIRE_FALSE(child.parallel);
+    }
+  }
+
+  { // assigning a variable the other arguments read
+    Expression ast = marked_ast("(lambda (x) (+ (do ((i 0 (+ i 1))) ((= i 9) x) (set! x i)) (do ((i 0 (+ i 1))) ((= i 9) x))))",
+                                env, 1000);
+    Expression & body = ast.head.value.lambda_value->code->body;
+    REQUIRE_FALSE(body.tail[0].parallel);
+    REQUIRE_FALSE(body.tail[1].parallel);
+  }
+}
+
+TEST_CASE( "Test parallel evaluation matches sequential evaluation", "[parallel]" ) {
+
+  std::vector<std::string> programs = {
+    "(+ (work 1) (work 2) (work 3) (work 4) 5)",
+    "(- (work 7) (* (work 2) (work 3)))",
+    "(pick (work 1) (work 2) (pick 1 (work 3) (work 4)))",
+    "(+ (fib 18) (fib 17) (memo 30) (memo 31))",
+    // the first argument to fail decides the error
+    "(+ (work 1) (fib) (work 2) (undefined))",
+    "(+ (work 1) (undefined) (work 2) (fib))",
+    "(+ (deep 1) (work 2))",
+  };
+  std::string setup = "(begin " + work + " (define (pick a b c) b)"
+                      " (define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+                      " (define-memo (memo n) (if (< n 2) n (+ (memo (- n 1)) (memo (- n 2)))))"
+                      " (define (deep n) (+ 1 (deep n))))";
+
+  for (auto & program: programs) {
+    INFO(program);
+    Interpreter sequential;
+    parallel_eval(sequential, setup);
+    Expression expected = parallel_eval(sequential, program);
+    bool defined = parallel_eval(sequential, "(work 0)") == Expression(0.);
+
+    for (int run = 0; run < 10; ++run) {
+      Interpreter interp;
+      interp.setParallel(true);
+      interp.setParallelThreshold(100);
+      parallel_eval(interp, setup);
+      REQUIRE(parallel_eval(interp, program) == expected);
+      // an error clears the environment just as it would have
+      REQUIRE((parallel_eval(interp, "(work 0)") == Expression(0.)) == defined);
+    }
+  }
+}
+
+TEST_CASE( "Test pmap, preduce and pfor on the thread pool", "[parallel]" ) {
+
+  // the same procedures, the second ones impure so always run in order
+  std::string setup = "(begin " + work +
+                      " (define (third x) (/ (work x) 3))"
+                      " (define (inverse x) (/ 1 (+ x 1)))"
+                      " (define (third-in-order x) (begin (lambda () 0) (third x)))"
+                      " (define (add a b) (+ a b))"
+                      " (define (add-in-order a b) (begin (lambda () 0) (+ a b))))";
+
+  for (std::size_t run = 0; run < 5; ++run) {
+    Interpreter interp;
+    interp.setParallelThreshold(100);
+    parallel_eval(interp, setup);
+
+    Expression mapped = parallel_eval(interp, "(pmap third (range 50))");
+    REQUIRE(mapped == parallel_eval(interp, "(pmap third-in-order (range 50))"));
+    REQUIRE(mapped.head.value.list_value->size() == 50);
+    REQUIRE((*mapped.head.value.list_value)[7].value.num_value == 7 * 1999000. / 3);
+    REQUIRE(parallel_eval(interp, "(pfor third 0 50)") == mapped);
+
+    // the items are grouped the same way either way, so even a sum
+    // that rounds differently in another order agrees bit for bit
+    Expression sum = parallel_eval(interp, "(preduce add 0.1 (pmap inverse (range 5000)))");
+    REQUIRE(sum == parallel_eval(interp, "(preduce add-in-order 0.1 (pmap inverse (range 5000)))"));
+    REQUIRE(parallel_eval(interp, "(preduce add 0 (list 5))") == Expression(5.));
+
+    // nested within each other and within spread arguments
+    std::string nested = "(preduce add 0 (pmap (lambda (n) (preduce add 0 (pfor work 0 n))) (range 8)))";
+    Expression expected = parallel_eval(interp, nested);
+    interp.setParallel(true);
+    REQUIRE(parallel_eval(interp, "(+ " + nested + " " + nested + ")").head.value.num_value ==
+            2 * expected.head.value.num_value);
+  }
+}
+
+TEST_CASE( "Test pmap errors do not depend on scheduling", "[parallel]" ) {
+
+  // item 300 calls with too many arguments, clearing the environment,
+  // item 700 reads an unknown symbol, which does not
+  std::string setup = "(begin " + work +
+                      " (define (fail x) (if (= x 300) (work 1 2) (if (= x 700) missing (* x x)))))";
+  for (std::string program: {"(pmap fail (range 1000))", "(pmap fail (range 301 1000))"}) {
+    INFO(program);
+    bool first = program.find("301") == std::string::npos;
+    for (int run = 0; run < 10; ++run) {
+      Interpreter interp;
+      interp.setParallelThreshold(100);
+      interp.setThrowErrors(true);
+      parallel_eval(interp, setup);
+      std::istringstream iss(program);
+      REQUIRE(interp.parse(iss));
+      REQUIRE_THROWS_WITH(interp.eval(), first ? "Error: invalid number of arguments" : "Error: unknown symbol");
+
+      std::istringstream after("(work 0)");
+      REQUIRE(interp.parse(after));
+      if (first)
+        REQUIRE_THROWS(interp.eval());
+      else
+        REQUIRE(interp.eval() == Expression(0.));
+    }
+  }
+}
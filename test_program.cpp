@@ -0,0 +1,117 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "interpreter_semantic_error.hpp"
+#include "program.hpp"
+
+TEST_CASE( "Test programs evaluated with numbers bound", "[program]" ) {
+
+  Program price("(if (< qty 10) (* qty unit) (* qty unit (- 1 discount)))", {"qty", "unit", "discount"});
+  REQUIRE(price.parameters() == 3);
+  REQUIRE(price.machineCode() == jit_available());
+
+  double small[] = {4, 2.5, 0.5};
+  double large[] = {20, 2.5, 0.5};
+  REQUIRE(price.evaluate(small) == Expression(10.));
+  REQUIRE(price.evaluate(large) == Expression(25.));
+  Expression bound[] = {Expression(20.), Expression(2.5), Expression(0.5)};
+  REQUIRE(price.evaluate(bound) == Expression(25.));
+
+  // parameters read in any order, some not at all, and loops over them
+  Program order("(- b a)", {"a", "unused", "b"});
+  double values[] = {1, 100, 3};
+  REQUIRE(order.evaluate(values) == Expression(2.));
+  Program total("(do ((i 0 (+ i 1)) (s 0 (+ s (* i k)))) ((= i n) s))", {"n", "k"});
+  double counts[] = {10, 2};
+  REQUIRE(total.evaluate(counts) == Expression(90.));
+
+  // Boolean results, and no parameters at all
+  Program test("(and (> x 0) (< x 1))", {"x"});
+  double inside[] = {0.5};
+  REQUIRE(test.evaluate(inside) == Expression(true));
+  Program constant("(* 2 pi)", {});
+  REQUIRE(constant.evaluate(static_cast<const double *>(nullptr)) == Expression(2 * atan2(0, -1)));
+
+  // evaluating leaves the program as it was
+  for (int i = 0; i < 100; ++i) {
+    double row[] = {double(i), 1, 0.5};
+    REQUIRE(price.evaluate(row) == Expression(i < 10 ? double(i) : i * 0.5));
+  }
+}
+
+TEST_CASE( "Test programs evaluated with any values bound", "[program]" ) {
+
+  // values machine code does not take are walked
+  Program pick("(if flag (nth xs 1) (length xs))", {"flag", "xs"});
+  Expression list = Program("(range 5)", {}).evaluate(static_cast<const Expression *>(nullptr));
+  Expression first[] = {Expression(true), list};
+  Expression second[] = {Expression(false), list};
+  REQUIRE(pick.evaluate(first) == Expression(1.));
+  REQUIRE(pick.evaluate(second) == Expression(5.));
+
+  Program scale("(+ x 1)", {"x"});
+  Expression flag[] = {Expression(true)};
+  REQUIRE_THROWS_WITH(scale.evaluate(flag), "Error: invalid argument type");
+  Expression number[] = {Expression(1.)};
+  REQUIRE(scale.evaluate(number) == Expression(2.));
+
+  // procedures over the parameters
+  Program sum("(preduce (lambda (a b) (+ a b)) 0 (pmap (lambda (i) (* i k)) xs))", {"xs", "k"});
+  Expression args[] = {list, Expression(3.)};
+  REQUIRE(sum.evaluate(args) == Expression(30.));
+  REQUIRE_FALSE(sum.machineCode());
+
+  Expression past[] = {Expression(true), Program("(list)", {}).evaluate(static_cast<const double *>(nullptr))};
+  REQUIRE_THROWS_WITH(pick.evaluate(past), "Error: list index out of range");
+  REQUIRE(pick.evaluate(first) == Expression(1.));
+}
+
+TEST_CASE( "Test programs that do not compile", "[program]" ) {
+
+  std::vector<std::string> syntax = {"(+ x", "x)", "1 2", "", "(lambda (x))"};
+  for (auto source: syntax) {
+    INFO(source);
+    REQUIRE_THROWS_WITH(Program(source, {"x"}), "Error: invalid syntax");
+  }
+  for (auto names: std::vector<std::vector<Symbol>>{{"x", "x"}, {"+"}, {"1"}}) {
+    REQUIRE_THROWS_WITH(Program("1", names), "Error: invalid syntax");
+  }
+  REQUIRE_THROWS_WITH(Program("(+ x 1)", {"y"}), "Error: unknown symbol");
+  REQUIRE_THROWS_WITH(Program("(pmap (lambda (a) (f a)) x)", {"x"}), "Error: unknown symbol");
+  REQUIRE_THROWS_WITH(Program("(+ x True)", {"x"}), "Error: invalid argument type");
+
+  // a program changes nothing, so it may not define
+  for (auto source: {"(define y x)", "(begin (define (f a) a) (f x))", "(pmap (lambda (a) (define b a)) x)"}) {
+    INFO(source);
+    REQUIRE_THROWS_WITH(Program(source, {"x"}), "Error: invalid define expression");
+  }
+}
+
+TEST_CASE( "Test programs evaluated on several threads", "[program]" ) {
+
+  Program rule("(+ (* a a) (if (< b 0) (- b) b))", {"a", "b"});
+  Program listed("(nth (range n) (- n 1))", {"n"});
+
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.push_back(std::thread([&, t]{
+      for (int i = 0; i < 1000; ++i) {
+        double row[] = {double(t), double(-i)};
+        if (!(rule.evaluate(row) == Expression(double(t * t + i))))
+          ++wrong;
+        Expression count[] = {Expression(double(1 + i % 10))};
+        if (!(listed.evaluate(count) == Expression(double(i % 10))))
+          ++wrong;
+      }
+    }));
+  }
+  for (auto & thread: threads) {
+    thread.join();
+  }
+  REQUIRE(wrong == 0);
+}
@@ -0,0 +1,99 @@
+#include "catch.hpp"
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "rewrite.hpp"
+
+Expression simplified_ast(const std::string & program, std::vector<std::string> * fired = nullptr){
+  std::istringstream iss(program);
+  TokenSequenceType tokens = tokenize(iss);
+  Interpreter interp;
+  Expression ast = interp.build_ast(tokens);
+  simplify(ast, fired);
+  return ast;
+}
+
+TEST_CASE( "Test strength reduction and identities", "[rewrite]" ) {
+
+  { // squares become a multiplication
+    std::vector<std::string> fired;
+    Expression ast = simplified_ast("(lambda (x) (pow x 2))", &fired);
+    Expression & body = ast.head.value.lambda_value->code->body;
+    REQUIRE(body.op == MulOp);
+    REQUIRE(body.tail.size() == 2);
+    REQUIRE(body.tail[0].op == LocalOp);
+    REQUIRE(body.tail[1].op == LocalOp);
+    REQUIRE(fired == std::vector<std::string>{"square"});
+  }
+
+  REQUIRE(simplified_ast("(pow a -1)").op == DivOp);
+  REQUIRE(simplified_ast("(* (pow a 1) 1)").op == VariableOp);
+  REQUIRE(simplified_ast("(/ a -1)").op == SubOp);
+
+  { // rules apply until none does
+    std::vector<std::string> fired;
+    Expression ast = simplified_ast("(- (- (- (- a))))", &fired);
+    REQUIRE(ast.op == VariableOp);
+    REQUIRE(fired.size() == 2);
+  }
+
+  REQUIRE(simplified_ast("(not (not (< a b)))").op == LessOp);
+
+  { // the negated condition is dropped and the branches swapped
+    Expression ast = simplified_ast("(if (not c) 1 2)");
+    REQUIRE(ast.op == IfOp);
+    REQUIRE(ast.tail[0].op == VariableOp);
+    REQUIRE(ast.tail[1] == Expression(2.));
+  }
+}
+
+TEST_CASE( "Test flattening of nested calls", "[rewrite]" ) {
+
+  { // a nested call on the left is spliced in
+    Expression ast = simplified_ast("(+ (+ (+ a b) c) d)");
+    REQUIRE(ast.op == AddOp);
+    REQUIRE(ast.tail.size() == 4);
+  }
+
+  { // only the leftmost argument
+    Expression ast = simplified_ast("(* (* a b) c (* d e))");
+    REQUIRE(ast.op == MulOp);
+    REQUIRE(ast.tail.size() == 4);
+    REQUIRE(ast.tail[3].op == MulOp);
+  }
+}
+
+TEST_CASE( "Test rewrites that would change results are not made", "[rewrite]" ) {
+
+  // -0 + 0 is 0, and regrouping changes rounding
+  std::vector<std::string> kept = {"(+ a 0)", "(+ a (+ b c))", "(- a -0)", "(- 0 a)",
+                                   "(pow (f a) 2)", "(pow a 3)", "(- (- a b))",
+                                   // operands of the wrong type, and calls that raise an error
+                                   "(* True 1)", "(not (not 1))", "(* (* a) b)", "(* (* a b))", "(+ (+) a)"};
+  for (auto program: kept) {
+    std::vector<std::string> fired;
+    simplified_ast(program, &fired);
+    REQUIRE(fired.empty());
+  }
+}
+
+TEST_CASE( "Test rewrites reported by the interpreter", "[rewrite]" ) {
+
+  std::string program = "(begin (define (f x) (* (pow x 2) 1)) (f 3))";
+
+  Interpreter plain;
+  plain.setOptimization(false);
+  std::istringstream first(program);
+  REQUIRE(plain.parse(first));
+  REQUIRE(plain.firedRewrites().empty());
+
+  Interpreter interp;
+  std::istringstream second(program);
+  REQUIRE(interp.parse(second));
+  std::vector<std::string> expected = {"square", "multiply-one"};
+  REQUIRE(interp.firedRewrites() == expected);
+  REQUIRE(interp.eval() == plain.eval());
+}
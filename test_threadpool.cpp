@@ -0,0 +1,55 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+
+TEST_CASE( "Test thread pool runs every task once", "[threadpool]" ) {
+
+  for (std::size_t workers: {0, 1, 3}) {
+    ThreadPool pool(workers);
+    REQUIRE(pool.workers() == workers);
+
+    for (std::size_t count: {0, 1, 2, 7, 1000}) {
+      std::vector<std::atomic<int>> runs(count);
+      for (auto & run: runs) {
+        run = 0;
+      }
+      pool.run(count, [&](std::size_t i){ ++runs[i]; });
+      for (std::size_t i = 0; i < count; ++i) {
+        REQUIRE(runs[i] == 1);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Test thread pool batches nest and run concurrently", "[threadpool]" ) {
+
+  ThreadPool pool(3);
+
+  { // a task running a batch of its own helps run it
+    std::atomic<int> total(0);
+    pool.run(16, [&](std::size_t){
+      pool.run(16, [&](std::size_t j){ total += int(j); });
+    });
+    REQUIRE(total == 16 * 120);
+  }
+
+  { // threads outside the pool share it
+    std::atomic<int> total(0);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 4; ++t) {
+      callers.push_back(std::thread([&]{
+        for (int r = 0; r < 50; ++r) {
+          pool.run(8, [&](std::size_t){ ++total; });
+        }
+      }));
+    }
+    for (auto & caller: callers) {
+      caller.join();
+    }
+    REQUIRE(total == 4 * 50 * 8);
+  }
+}
@@ -0,0 +1,137 @@
+#include "threadpool.hpp"
+
+// the pool a worker thread belongs to and its queue there
+static thread_local const ThreadPool * current_pool = nullptr;
+static thread_local std::size_t current_queue = 0;
+
+// not the index of a queue, for threads that are not workers
+const std::size_t no_queue = std::size_t(-1);
+
+ThreadPool::ThreadPool(std::size_t workers): pending(0), stopping(false){
+    for (std::size_t i = 0; i < workers; ++i) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (std::size_t i = 0; i < workers; ++i) {
+        threads.push_back(std::thread(&ThreadPool::work, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto & thread: threads) {
+        thread.join();
+    }
+}
+
+std::size_t ThreadPool::workers() const{
+    return threads.size();
+}
+
+bool ThreadPool::take(std::size_t self, Task & task){
+    if (self != no_queue) {
+        Queue & own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            --pending;
+            return true;
+        }
+    }
+    std::size_t first = (self == no_queue) ? 0 : self + 1;
+    for (std::size_t i = 0; i < queues.size(); ++i) {
+        Queue & other = *queues[(first + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.lock);
+        if (!other.tasks.empty()) {
+            task = other.tasks.front();
+            other.tasks.pop_front();
+            --pending;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Task & task){
+    (*task.batch->task)(task.index);
+    if (task.batch->remaining.fetch_sub(1) == 1) {
+        // the batch may be gone once its thread sees it done,
+        // so only the pool is touched from here
+        std::lock_guard<std::mutex> lock(done_lock);
+        done.notify_all();
+    }
+}
+
+void ThreadPool::work(std::size_t self){
+    current_pool = this;
+    current_queue = self;
+    for (;;) {
+        Task task;
+        if (take(self, task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_lock);
+        wake.wait(lock, [this]{ return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
+
+void ThreadPool::run(std::size_t count, const std::function<void(std::size_t)> & task){
+    if (queues.empty() || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.task = &task;
+    batch.remaining = count;
+
+    // deal the tasks round the queues, a worker starting with its own
+    std::size_t self = (current_pool == this) ? current_queue : no_queue;
+    std::size_t start = (self == no_queue) ? 0 : self;
+    for (std::size_t q = 0; q < queues.size() && q < count; ++q) {
+        Queue & queue = *queues[(start + q) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        for (std::size_t i = q; i < count; i += queues.size()) {
+            Task dealt = {&batch, i};
+            queue.tasks.push_back(dealt);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_lock);
+        pending += count;
+    }
+    wake.notify_all();
+
+    // help until nothing is left to take, then wait for the rest
+    Task taken;
+    while (batch.remaining > 0 && take(self, taken)) {
+        execute(taken);
+    }
+    std::unique_lock<std::mutex> lock(done_lock);
+    done.wait(lock, [&batch]{ return batch.remaining == 0; });
+}
+
+static std::size_t shared_workers(){
+    std::size_t hardware = std::thread::hardware_concurrency();
+    return hardware > 1 ? hardware - 1 : 0;
+}
+
+static std::atomic<std::size_t> requested_workers(shared_workers());
+
+void ThreadPool::setSharedWorkers(std::size_t workers){
+    requested_workers = workers;
+}
+
+ThreadPool & ThreadPool::shared(){
+    static ThreadPool pool(requested_workers);
+    return pool;
+}
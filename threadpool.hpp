@@ -0,0 +1,76 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+// system includes
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A ThreadPool runs batches of independent tasks on worker threads that
+// each own a deque of tasks: a worker takes its newest task and, out of
+// work, steals the oldest task of another. The thread running a batch
+// takes tasks too until its batch is done, so a task may run a batch of
+// its own without deadlock.
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t workers);
+  ~ThreadPool();
+
+  // the number of worker threads, besides threads running batches
+  std::size_t workers() const;
+
+  // call task(i) for every i below count, returning once all have finished
+  void run(std::size_t count, const std::function<void(std::size_t)> & task);
+
+  // the pool shared by the process, created on first use
+  static ThreadPool & shared();
+
+  // the workers the shared pool is created with, by default one fewer than
+  // the hardware threads, which only takes effect before its first use
+  static void setSharedWorkers(std::size_t workers);
+private:
+  ThreadPool(const ThreadPool &);
+  ThreadPool & operator=(const ThreadPool &);
+
+  struct Batch {
+    const std::function<void(std::size_t)> * task;
+    std::atomic<std::size_t> remaining;
+  };
+
+  struct Task {
+    Batch * batch;
+    std::size_t index;
+  };
+
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  // take a task, from the back of queue self if it is a worker's
+  // own, otherwise from the front of any queue
+  bool take(std::size_t self, Task & task);
+  void execute(const Task & task);
+  void work(std::size_t self);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+
+  // queued tasks not yet taken, for idle workers to sleep on
+  std::atomic<std::size_t> pending;
+  bool stopping;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+
+  // signalled when the last task of a batch finishes
+  std::mutex done_lock;
+  std::condition_variable done;
+};
+
+#endif